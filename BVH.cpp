@@ -0,0 +1,139 @@
+#include "ofApp.h"
+#include "BVH.h"
+
+
+namespace {
+
+	float area(const glm::vec3 &bmin, const glm::vec3 &bmax) {
+		glm::vec3 e = glm::max(bmax - bmin, glm::vec3(0.0f));
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	/*
+		Top down build, the split plane of each node is the best of a fixed number of
+		bins along each axis of the item centroids' bounds
+	*/
+	struct BVHBuilder {
+		static const int num_bins = 16;
+
+		const vector<glm::vec3> &box_min, &box_max;
+		vector<glm::vec3> centroid;
+		vector<uint32_t> &order;
+		vector<BVHNode> &nodes;
+		int max_leaf;
+
+		BVHBuilder(const vector<glm::vec3> &box_min, const vector<glm::vec3> &box_max, vector<uint32_t> &order, vector<BVHNode> &nodes, int max_leaf)
+			: box_min(box_min), box_max(box_max), order(order), nodes(nodes), max_leaf(max_leaf) {}
+
+		int build(int begin, int end, int depth) {
+			int index = nodes.size();
+			nodes.push_back(BVHNode());
+
+			glm::vec3 bmin(std::numeric_limits<float>::infinity()), bmax(-bmin);
+			glm::vec3 cmin = bmin, cmax = bmax;
+			for (int i = begin; i < end; i++) {
+				uint32_t item = order[i];
+				bmin = glm::min(bmin, box_min[item]);
+				bmax = glm::max(bmax, box_max[item]);
+				cmin = glm::min(cmin, centroid[item]);
+				cmax = glm::max(cmax, centroid[item]);
+			}
+			for (int a = 0; a < 3; a++) {
+				nodes[index].bmin[a] = bmin[a];
+				nodes[index].bmax[a] = bmax[a];
+			}
+
+			// Cost in item tests, a traversal step counts as one
+			int count = end - begin;
+			float best_cost = std::numeric_limits<float>::infinity();
+			int best_axis = -1, best_split = 0;
+			float parent_area = area(bmin, bmax);
+
+			for (int a = 0; a < 3 && count > 1 && depth < bvh_max_depth; a++) {
+				float extent = cmax[a] - cmin[a];
+				if (extent <= 0)
+					continue;
+
+				glm::vec3 bin_min[num_bins], bin_max[num_bins];
+				int bin_count[num_bins] = {};
+				for (int b = 0; b < num_bins; b++) {
+					bin_min[b] = glm::vec3(std::numeric_limits<float>::infinity());
+					bin_max[b] = -bin_min[b];
+				}
+				float scale = num_bins / extent;
+				for (int i = begin; i < end; i++) {
+					uint32_t item = order[i];
+					int b = std::min(num_bins - 1, static_cast<int>((centroid[item][a] - cmin[a]) * scale));
+					bin_count[b]++;
+					bin_min[b] = glm::min(bin_min[b], box_min[item]);
+					bin_max[b] = glm::max(bin_max[b], box_max[item]);
+				}
+
+				// Areas and counts left of each split plane, then a sweep from the right
+				float left_area[num_bins];
+				int left_count[num_bins];
+				glm::vec3 lmin = glm::vec3(std::numeric_limits<float>::infinity()), lmax = -lmin;
+				int n = 0;
+				for (int b = 0; b < num_bins - 1; b++) {
+					lmin = glm::min(lmin, bin_min[b]);
+					lmax = glm::max(lmax, bin_max[b]);
+					n += bin_count[b];
+					left_area[b] = area(lmin, lmax);
+					left_count[b] = n;
+				}
+				glm::vec3 rmin = glm::vec3(std::numeric_limits<float>::infinity()), rmax = -rmin;
+				n = 0;
+				for (int b = num_bins - 1; b > 0; b--) {
+					rmin = glm::min(rmin, bin_min[b]);
+					rmax = glm::max(rmax, bin_max[b]);
+					n += bin_count[b];
+					if (left_count[b - 1] == 0 || n == 0)
+						continue;
+					float cost = 1.0f + (left_area[b - 1] * left_count[b - 1] + area(rmin, rmax) * n) / parent_area;
+					if (cost < best_cost) {
+						best_cost = cost;
+						best_axis = a;
+						best_split = b;
+					}
+				}
+			}
+
+			// Leaf when no split pays off, or all centroids coincide
+			if (best_axis < 0 || (count <= max_leaf && best_cost >= count)) {
+				nodes[index].index = begin;
+				nodes[index].count = count;
+				return index;
+			}
+
+			float scale = num_bins / (cmax[best_axis] - cmin[best_axis]);
+			uint32_t *mid = std::partition(order.data() + begin, order.data() + end, [&](uint32_t item) {
+				return std::min(num_bins - 1, static_cast<int>((centroid[item][best_axis] - cmin[best_axis]) * scale)) < best_split;
+			});
+
+			build(begin, mid - order.data(), depth + 1);
+			int right = build(mid - order.data(), end, depth + 1);
+			nodes[index].index = right;
+			nodes[index].count = 0;
+			return index;
+		}
+	};
+}
+
+
+//---Build the hierarchy over the item boxes------------------------------------
+void buildBVH(const vector<glm::vec3> &box_min, const vector<glm::vec3> &box_max, int max_leaf, vector<BVHNode> &nodes, vector<uint32_t> &order) {
+	int count = box_min.size();
+	order.resize(count);
+	BVHBuilder builder(box_min, box_max, order, nodes, max_leaf);
+	builder.centroid.resize(count);
+	for (int i = 0; i < count; i++) {
+		builder.centroid[i] = (box_min[i] + box_max[i]) * 0.5f;
+		order[i] = i;
+	}
+
+	nodes.clear();
+	if (count == 0)
+		return;
+	nodes.reserve(2 * count);
+	builder.build(0, count, 0);
+} // end buildBVH
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ofApp.h"
+
+
+/*
+	BVH Node
+	- 32 byte node of a bounding volume hierarchy, two per cache line
+	- Nodes are stored depth first, an inner node's left child follows it
+*/
+struct BVHNode {
+	float bmin[3];
+	int32_t index;      // first item of a leaf, right child of an inner node
+	float bmax[3];
+	int32_t count;      // items in a leaf, 0 for inner nodes
+
+	// Slab test of the ray o + t * d given 1 / d. The far distance is padded so a box
+	// never misses a ray its contents would catch
+	bool hit(const glm::vec3 &o, const glm::vec3 &inv_d, float t_max, float &t_enter) const {
+		float t0 = (bmin[0] - o.x) * inv_d.x, t1 = (bmax[0] - o.x) * inv_d.x;
+		float near_t = std::min(t0, t1), far_t = std::max(t0, t1);
+		t0 = (bmin[1] - o.y) * inv_d.y; t1 = (bmax[1] - o.y) * inv_d.y;
+		near_t = std::max(near_t, std::min(t0, t1));
+		far_t = std::min(far_t, std::max(t0, t1));
+		t0 = (bmin[2] - o.z) * inv_d.z; t1 = (bmax[2] - o.z) * inv_d.z;
+		near_t = std::max(near_t, std::min(t0, t1));
+		far_t = std::min(far_t, std::max(t0, t1)) * 1.0000004f;
+		t_enter = std::max(near_t, 0.0f);
+		return t_enter <= std::min(far_t, t_max);
+	}
+
+	// Distance to the box, 0 inside it. Never more than the distance to anything inside it
+	float distance(const glm::vec3 &p) const {
+		glm::vec3 q = glm::max(glm::vec3(bmin[0], bmin[1], bmin[2]) - p, p - glm::vec3(bmax[0], bmax[1], bmax[2]));
+		return glm::length(glm::max(q, glm::vec3(0.0f)));
+	}
+};
+
+// Deepest hierarchy the builder makes, traversal stacks hold this many entries
+const int bvh_max_depth = 56;
+
+// Binned surface area heuristic build over the item boxes. order receives the item
+// indices in leaf order, leaves index into it
+void buildBVH(const vector<glm::vec3> &box_min, const vector<glm::vec3> &box_max, int max_leaf, vector<BVHNode> &nodes, vector<uint32_t> &order);
@@ -0,0 +1,408 @@
+#include "ofApp.h"
+#include "CSG.h"
+
+
+CSGNode::~CSGNode() {
+	for (auto child : children)
+		delete child;
+}
+
+
+//---Constructors------------------------------------------------------
+CSGNode *CSGNode::leaf(SceneObject *obj) {
+	CSGNode *n = new CSGNode(CSGOp::leaf);
+	n->obj = obj;
+	n->computeBounds();
+	return n;
+}
+
+CSGNode *CSGNode::unite(const vector<CSGNode*> &children) {
+	CSGNode *n = new CSGNode(CSGOp::unite);
+	n->children = children;
+	n->computeBounds();
+	return n;
+}
+
+CSGNode *CSGNode::intersect(const vector<CSGNode*> &children) {
+	CSGNode *n = new CSGNode(CSGOp::intersect);
+	n->children = children;
+	n->computeBounds();
+	return n;
+}
+
+CSGNode *CSGNode::subtract(CSGNode *a, CSGNode *b) {
+	CSGNode *n = new CSGNode(CSGOp::subtract);
+	n->children = { a, b };
+	n->computeBounds();
+	return n;
+}
+
+CSGNode *CSGNode::smoothUnite(const vector<CSGNode*> &children, float k) {
+	CSGNode *n = new CSGNode(CSGOp::smooth_unite);
+	n->children = children;
+	n->k = std::max(k, 1e-4f);
+	n->computeBounds();
+	return n;
+}
+
+CSGNode *CSGNode::repeat(CSGNode *child, const glm::vec3 &period) {
+	CSGNode *n = new CSGNode(CSGOp::repeat);
+	n->children = { child };
+	n->period = period;
+	n->computeBounds();
+	return n;
+}
+
+CSGNode *CSGNode::twist(CSGNode *child, float k, bool root_height) {
+	CSGNode *n = new CSGNode(CSGOp::twist);
+	n->children = { child };
+	n->k = k;
+	n->root_height = root_height;
+	n->computeBounds();
+	return n;
+}
+
+// m should be rigid, a scale would stop the child distances from being distances
+CSGNode *CSGNode::transform(CSGNode *child, const glm::mat4 &m) {
+	CSGNode *n = new CSGNode(CSGOp::transform);
+	n->children = { child };
+	n->m = m;
+	n->inv = glm::inverse(m);
+	n->computeBounds();
+	return n;
+}
+
+
+//---Bounds of the node's surface---------------------------------------
+void CSGNode::computeBounds() {
+	glm::vec3 cmin, cmax;
+	bounded = false;
+
+	switch (op) {
+	case CSGOp::leaf:
+		bounded = obj->getBounds(bmin, bmax);
+		break;
+
+	case CSGOp::unite:
+	case CSGOp::smooth_unite:
+		// Every child has to be bounded
+		bounded = true;
+		bmin = glm::vec3(std::numeric_limits<float>::infinity());
+		bmax = -bmin;
+		for (auto child : children) {
+			if (!child->getBounds(cmin, cmax)) {
+				bounded = false;
+				break;
+			}
+			bmin = glm::min(bmin, cmin);
+			bmax = glm::max(bmax, cmax);
+		}
+
+		// The smooth min lies at most k/4 below the plain min
+		if (bounded && op == CSGOp::smooth_unite) {
+			bmin -= glm::vec3(k * 0.25f);
+			bmax += glm::vec3(k * 0.25f);
+		}
+		break;
+
+	case CSGOp::intersect:
+		// Any bounded child bounds the intersection
+		for (auto child : children) {
+			if (!child->getBounds(cmin, cmax))
+				continue;
+			bmin = bounded ? glm::max(bmin, cmin) : cmin;
+			bmax = bounded ? glm::min(bmax, cmax) : cmax;
+			bounded = true;
+		}
+		break;
+
+	case CSGOp::subtract:
+		bounded = children[0]->getBounds(bmin, bmax);
+		break;
+
+	case CSGOp::repeat:
+		// Repeats to infinity
+		break;
+
+	case CSGOp::twist:
+		// The twist turns about the y axis, so the child's radius about it bounds x and z
+		if (children[0]->getBounds(cmin, cmax)) {
+			float far_x = std::max(std::abs(cmin.x), std::abs(cmax.x));
+			float far_z = std::max(std::abs(cmin.z), std::abs(cmax.z));
+			float r = std::sqrt(far_x * far_x + far_z * far_z);
+			bmin = glm::vec3(-r, cmin.y, -r);
+			bmax = glm::vec3(r, cmax.y, r);
+			bounded = true;
+		}
+		break;
+
+	case CSGOp::transform:
+		if (children[0]->getBounds(cmin, cmax)) {
+			bmin = glm::vec3(std::numeric_limits<float>::infinity());
+			bmax = -bmin;
+			for (int c = 0; c < 8; c++) {
+				glm::vec3 corner((c & 1) ? cmax.x : cmin.x, (c & 2) ? cmax.y : cmin.y, (c & 4) ? cmax.z : cmin.z);
+				glm::vec3 q = m * glm::vec4(corner, 1);
+				bmin = glm::min(bmin, q);
+				bmax = glm::max(bmax, q);
+			}
+			bounded = true;
+		}
+		break;
+	}
+} // end computeBounds
+
+
+// Signed distance to the bounding box, never more than the distance to the surface inside it
+float CSGNode::boxDistance(const glm::vec3 &p) const {
+	glm::vec3 q = glm::max(bmin - p, p - bmax);
+	return glm::length(glm::max(q, glm::vec3(0.0f))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+}
+
+
+//---Evaluate the tree----------------------------------------------------
+float CSGNode::eval(const glm::vec3 &p, float best) const {
+	return eval(p, best, p.y);
+}
+
+// root_y is the height of the point the tree is evaluated at
+float CSGNode::eval(const glm::vec3 &p, float best, float root_y) const {
+	// The whole subtree is farther away than what was already found
+	if (bounded) {
+		float d = boxDistance(p);
+		if (d >= best)
+			return d;
+	}
+
+	const float inf = std::numeric_limits<float>::infinity();
+	float d;
+
+	switch (op) {
+	case CSGOp::leaf:
+		return obj->sdf(p);
+
+	case CSGOp::unite:
+		d = inf;
+		for (auto child : children)
+			d = std::min(d, child->eval(p, std::min(best, d), root_y));
+		return d;
+
+	case CSGOp::intersect:
+		// Once one child is past best the max is too
+		d = -inf;
+		for (auto child : children) {
+			d = std::max(d, child->eval(p, best, root_y));
+			if (d >= best)
+				break;
+		}
+		return d;
+
+	case CSGOp::subtract:
+		d = children[0]->eval(p, best, root_y);
+		if (d >= best)
+			return d;
+		// The negated distance needs the exact value
+		for (int i = 1; i < children.size(); i++)
+			d = std::max(d, -children[i]->eval(p, inf, root_y));
+		return d;
+
+	case CSGOp::smooth_unite:
+		// Children near each other blend, so they are evaluated exactly
+		d = children[0]->eval(p, inf, root_y);
+		for (int i = 1; i < children.size(); i++) {
+			float b = children[i]->eval(p, inf, root_y);
+			float h = std::max(k - std::abs(d - b), 0.0f) / k;
+			d = std::min(d, b) - h * h * k * 0.25f;
+		}
+		return d;
+
+	case CSGOp::repeat:
+		return children[0]->eval(Torus::repeat(p, period), best, root_y);
+
+	case CSGOp::twist: {
+		float y = root_height ? root_y : p.y;
+		float c = std::cos(k * y);
+		float s = std::sin(k * y);
+		return children[0]->eval(glm::vec3(c * p.x - s * p.z, p.y, s * p.x + c * p.z), best, root_y);
+	}
+
+	case CSGOp::transform:
+		return children[0]->eval(glm::vec3(inv * glm::vec4(p, 1)), best, root_y);
+	}
+
+	return inf;
+} // end eval
+
+
+//---Generated code for eval---------------------------------------------------
+// The same bound skips as eval, with the tree unrolled and its constants inlined
+string CSGNode::writeSource(SDFSource &src, const SDFPoint &p, const string &best) const {
+	return writeSource(src, p, best, p.y);
+}
+
+string CSGNode::writeSource(SDFSource &src, const SDFPoint &p, const string &best, const string &root_y) const {
+	string d = src.var("d");
+	src.line("float " + d + ";");
+	if (bounded) {
+		src.line(d + " = boxDist(" + p.x + ", " + p.y + ", " + p.z + ", " + SDFSource::lit(bmin.x) + ", " + SDFSource::lit(bmin.y) + ", "
+			+ SDFSource::lit(bmin.z) + ", " + SDFSource::lit(bmax.x) + ", " + SDFSource::lit(bmax.y) + ", " + SDFSource::lit(bmax.z) + ");");
+		src.line("if (" + d + " < " + best + ") {");
+	}
+	else {
+		src.line("{");
+	}
+
+	string c;
+	switch (op) {
+	case CSGOp::leaf:
+		c = src.object(obj, p);
+		if (c.empty())
+			return "";
+		src.line(d + " = " + c + ";");
+		break;
+
+	case CSGOp::unite: {
+		src.line(d + " = inf;");
+		string b = src.var("b");
+		src.line("float " + b + ";");
+		for (auto child : children) {
+			src.line(b + " = std::min(" + best + ", " + d + ");");
+			c = child->writeSource(src, p, b, root_y);
+			if (c.empty())
+				return "";
+			src.line(d + " = std::min(" + d + ", " + c + ");");
+		}
+		break;
+	}
+
+	case CSGOp::intersect:
+		src.line(d + " = -inf;");
+		for (int i = 0; i < children.size(); i++) {
+			if (i > 0)
+				src.line("if (" + d + " < " + best + ") {");
+			c = children[i]->writeSource(src, p, best, root_y);
+			if (c.empty())
+				return "";
+			src.line(d + " = std::max(" + d + ", " + c + ");");
+		}
+		for (int i = 1; i < children.size(); i++)
+			src.line("}");
+		break;
+
+	case CSGOp::subtract:
+		c = children[0]->writeSource(src, p, best, root_y);
+		if (c.empty())
+			return "";
+		src.line(d + " = " + c + ";");
+		src.line("if (" + d + " < " + best + ") {");
+		for (int i = 1; i < children.size(); i++) {
+			c = children[i]->writeSource(src, p, "inf", root_y);
+			if (c.empty())
+				return "";
+			src.line(d + " = std::max(" + d + ", -" + c + ");");
+		}
+		src.line("}");
+		break;
+
+	case CSGOp::smooth_unite: {
+		c = children[0]->writeSource(src, p, "inf", root_y);
+		if (c.empty())
+			return "";
+		src.line(d + " = " + c + ";");
+		string h = src.var("h");
+		src.line("float " + h + ";");
+		for (int i = 1; i < children.size(); i++) {
+			c = children[i]->writeSource(src, p, "inf", root_y);
+			if (c.empty())
+				return "";
+			src.line(h + " = std::max(" + SDFSource::lit(k) + " - std::abs(" + d + " - " + c + "), 0.0f) / " + SDFSource::lit(k) + ";");
+			src.line(d + " = std::min(" + d + ", " + c + ") - " + h + " * " + h + " * " + SDFSource::lit(k * 0.25f) + ";");
+		}
+		break;
+	}
+
+	case CSGOp::repeat: {
+		SDFPoint q = { src.var("x"), src.var("y"), src.var("z") };
+		src.line("float " + q.x + " = modp(" + p.x + " + " + SDFSource::lit(0.5f * period.x) + ", " + SDFSource::lit(period.x) + ") - " + SDFSource::lit(0.5f * period.x) + ";");
+		src.line("float " + q.y + " = modp(" + p.y + " + " + SDFSource::lit(0.5f * period.y) + ", " + SDFSource::lit(period.y) + ") - " + SDFSource::lit(0.5f * period.y) + ";");
+		src.line("float " + q.z + " = modp(" + p.z + " + " + SDFSource::lit(0.5f * period.z) + ", " + SDFSource::lit(period.z) + ") - " + SDFSource::lit(0.5f * period.z) + ";");
+		c = children[0]->writeSource(src, q, best, root_y);
+		if (c.empty())
+			return "";
+		src.line(d + " = " + c + ";");
+		break;
+	}
+
+	case CSGOp::twist: {
+		string cs = src.var("c");
+		string sn = src.var("s");
+		const string &y = root_height ? root_y : p.y;
+		src.line("float " + cs + " = std::cos(" + SDFSource::lit(k) + " * " + y + ");");
+		src.line("float " + sn + " = std::sin(" + SDFSource::lit(k) + " * " + y + ");");
+		SDFPoint q = { src.var("x"), p.y, src.var("z") };
+		src.line("float " + q.x + " = " + cs + " * " + p.x + " - " + sn + " * " + p.z + ";");
+		src.line("float " + q.z + " = " + sn + " * " + p.x + " + " + cs + " * " + p.z + ";");
+		c = children[0]->writeSource(src, q, best, root_y);
+		if (c.empty())
+			return "";
+		src.line(d + " = " + c + ";");
+		break;
+	}
+
+	case CSGOp::transform:
+		c = children[0]->writeSource(src, src.transform(inv, p), best, root_y);
+		if (c.empty())
+			return "";
+		src.line(d + " = " + c + ";");
+		break;
+	}
+
+	src.line("}");
+	return d;
+} // end writeSource
+
+
+string CSGNode::getParamKey() const {
+	ostringstream key;
+	switch (op) {
+	case CSGOp::leaf: {
+		string leaf_key = obj->getParamKey();
+		if (leaf_key.empty())
+			return "";
+		return "(" + leaf_key + ")";
+	}
+	case CSGOp::unite: key << "(union"; break;
+	case CSGOp::intersect: key << "(intersect"; break;
+	case CSGOp::subtract: key << "(subtract"; break;
+	case CSGOp::smooth_unite: key << "(smooth " << k; break;
+	case CSGOp::repeat: key << "(repeat " << period.x << " " << period.y << " " << period.z; break;
+	case CSGOp::twist: key << (root_height ? "(twist_root " : "(twist ") << k; break;
+	case CSGOp::transform:
+		key << "(transform";
+		for (int c = 0; c < 4; c++)
+			key << " " << m[c].x << " " << m[c].y << " " << m[c].z << " " << m[c].w;
+		break;
+	}
+
+	for (auto child : children) {
+		string child_key = child->getParamKey();
+		if (child_key.empty())
+			return "";
+		key << " " << child_key;
+	}
+	key << ")";
+	return key.str();
+} // end getParamKey
+
+
+void CSGObject::draw() {
+	glm::vec3 bmin, bmax;
+	ofSetColor(diffuseColor);
+	if (root->getBounds(bmin, bmax)) {
+		glm::vec3 size = bmax - bmin;
+		ofDrawBox(glm::vec3(position.x, -position.y, position.z), size.x, size.y, size.z);
+	}
+	else {
+		ofDrawSphere(glm::vec3(position.x, -position.y, position.z), 1);
+	}
+}
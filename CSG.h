@@ -0,0 +1,119 @@
+#pragma once
+
+#include "ofApp.h"
+#include "SceneObjects.h"
+#include "SDFCompiler.h"
+
+
+enum class CSGOp : uint8_t {
+	leaf,            // Distance of a scene object
+	unite,           // min of the children
+	intersect,       // max of the children
+	subtract,        // first child minus the others
+	smooth_unite,    // polynomial smooth min of the children with blend radius k
+	repeat,          // child repeated over a lattice with the given period
+	twist,           // child twisted about the local y axis by k radians per unit of height
+	transform        // child in the frame of a matrix
+};
+
+
+/*
+	CSG Node
+	- Node of a signed distance expression tree, built with the static constructors
+	- Every node keeps axis aligned bounds of its surface, so eval can return the box
+	  distance instead of evaluating the subtree when the point is farther away than
+	  the closest distance found so far
+	- A node owns its children, leaves don't own their scene object
+*/
+class CSGNode {
+public:
+	~CSGNode();
+	CSGNode(const CSGNode &) = delete;
+	CSGNode &operator=(const CSGNode &) = delete;
+
+	static CSGNode *leaf(SceneObject *obj);
+	static CSGNode *unite(const vector<CSGNode*> &children);
+	static CSGNode *intersect(const vector<CSGNode*> &children);
+	static CSGNode *subtract(CSGNode *a, CSGNode *b);
+	static CSGNode *smoothUnite(const vector<CSGNode*> &children, float k);
+	static CSGNode *repeat(CSGNode *child, const glm::vec3 &period);
+	// root_height takes the angle from the height of the point the whole tree is
+	// evaluated at, as TwistedTorus and TwistedRepeatedTorus do, instead of the local one
+	static CSGNode *twist(CSGNode *child, float k, bool root_height = false);
+	static CSGNode *transform(CSGNode *child, const glm::mat4 &m);
+
+	// Signed distance at p, or a lower bound of it that is >= best.
+	// best = infinity always gives the exact value
+	float eval(const glm::vec3 &p, float best) const;
+
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax) const {
+		bmin = this->bmin;
+		bmax = this->bmax;
+		return bounded;
+	}
+
+	// String of the tree's shape, empty if a leaf can't describe itself
+	string getParamKey() const;
+
+	// Code for eval at p with best held by the expression best, returns the variable
+	// holding the distance, empty if a leaf has no code
+	string writeSource(SDFSource &src, const SDFPoint &p, const string &best) const;
+
+private:
+	CSGNode(CSGOp op) : op(op) {}
+	float eval(const glm::vec3 &p, float best, float root_y) const;
+	string writeSource(SDFSource &src, const SDFPoint &p, const string &best, const string &root_y) const;
+	void computeBounds();
+	float boxDistance(const glm::vec3 &p) const;
+
+	CSGOp op;
+	vector<CSGNode*> children;
+	SceneObject *obj = nullptr;
+	float k = 0.0f;
+	bool root_height = false;
+	glm::vec3 period;
+	glm::mat4 m, inv;
+
+	bool bounded = false;
+	glm::vec3 bmin, bmax;
+};
+
+
+/*
+	CSG Object
+	- Scene object whose distance is a CSG tree, for ray marching
+	- Owns its tree, so it can be moved but not copied
+*/
+class CSGObject : public SceneObject {
+public:
+	CSGObject(CSGNode *root, ofColor diffuse, float power) {
+		this->root = root;
+		diffuseColor = diffuse;
+		this->power = power;
+		type = ObjectType::csg;
+		glm::vec3 bmin, bmax;
+		if (root->getBounds(bmin, bmax))
+			position = (bmin + bmax) * 0.5f;
+	}
+	CSGObject(CSGObject &&o) noexcept : SceneObject(o), root(o.root) { o.root = nullptr; }
+	CSGObject(const CSGObject &) = delete;
+	CSGObject &operator=(const CSGObject &) = delete;
+	~CSGObject() { delete root; }
+
+	void draw();
+
+	float sdf(const glm::vec3 &p) { return root->eval(p, std::numeric_limits<float>::infinity()); }
+	float sdf(const glm::vec3 &p, float best) const { return root->eval(p, best); }
+
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax) { return root->getBounds(bmin, bmax); }
+
+	string getParamKey() {
+		string key = root->getParamKey();
+		return key.empty() ? key : "csg " + key;
+	}
+
+	string writeSource(SDFSource &src, const SDFPoint &p, const string &best) const { return root->writeSource(src, p, best); }
+
+private:
+	CSGNode *root;
+}; // class CSGObject
@@ -1,5 +1,6 @@
 #include "ofApp.h"
 #include "CamObjects.h"
+#include "Sampling.h"
 
 // Convert (u, v) to (x, y, z) 
 // We assume u,v is in [0, 1]
@@ -10,10 +11,74 @@ glm::vec3 ViewPlane::toWorld(float u, float v) {
 	return (glm::vec3((u * w) + min.x, (v * h) + min.y, position.z));
 }
 
+// Precompute the basis and pixel deltas used for ray generation
+//
+void RenderCam::prepare(int width, int height) {
+	forward = glm::normalize(aim);
+	right_axis = glm::normalize(glm::cross(forward, up));
+	up_axis = glm::cross(right_axis, forward);
+
+	plane_origin = position + forward * view_dist + right_axis * view.min.x + up_axis * view.min.y;
+	plane_u = right_axis * view.width();
+	plane_v = up_axis * view.height();
+
+	pixel_du = plane_u / static_cast<float>(width);
+	pixel_dv = plane_v / static_cast<float>(height);
+	pixel00 = plane_origin + 0.5f * (pixel_du + pixel_dv);
+}
+
 // Get a ray from the current camera position to the (u, v) position on
 // the ViewPlane
 //
 Ray RenderCam::getRay(float u, float v) {
-	glm::vec3 pointOnPlane = view.toWorld(u, v);
+	glm::vec3 pointOnPlane = plane_origin + u * plane_u + v * plane_v;
 	return(Ray(position, glm::normalize(pointOnPlane - position)));
-}
\ No newline at end of file
+}
+
+// Thin lens ray, starts on the lens disk and passes through the point of the
+// pinhole ray that lies on the focal plane
+//
+Ray RenderCam::getLensRay(float u, float v, const glm::vec2 &lens) {
+	Ray pinhole = getRay(u, v);
+	if (apeture_size <= 0.0f)
+		return pinhole;
+
+	glm::vec3 focal_point = pinhole.evalPoint(focal_dist / glm::dot(pinhole.d, forward));
+	glm::vec2 disk = apeture_size * concentricSampleDisk(lens);
+	glm::vec3 origin = position + disk.x * right_axis + disk.y * up_axis;
+	return Ray(origin, glm::normalize(focal_point - origin));
+}
+
+// Fill the batch with pinhole rays, one per pixel in row major order
+// Plain loops over float arrays so the compiler can vectorize them
+//
+void RenderCam::generateRays(int x0, int y0, int x1, int y1, RayBatch &batch) {
+	int w = x1 - x0;
+	batch.resize(w * (y1 - y0));
+
+	for (int y = y0; y < y1; y++) {
+		glm::vec3 row = pixel00 + static_cast<float>(y) * pixel_dv - position;
+		float *dx = &batch.dx[(y - y0) * w];
+		float *dy = &batch.dy[(y - y0) * w];
+		float *dz = &batch.dz[(y - y0) * w];
+		float *ox = &batch.ox[(y - y0) * w];
+		float *oy = &batch.oy[(y - y0) * w];
+		float *oz = &batch.oz[(y - y0) * w];
+
+		for (int i = 0; i < w; i++) {
+			float x = static_cast<float>(x0 + i);
+			dx[i] = row.x + x * pixel_du.x;
+			dy[i] = row.y + x * pixel_du.y;
+			dz[i] = row.z + x * pixel_du.z;
+		}
+		for (int i = 0; i < w; i++) {
+			float inv_len = 1.0f / std::sqrt(dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i]);
+			dx[i] *= inv_len;
+			dy[i] *= inv_len;
+			dz[i] *= inv_len;
+			ox[i] = position.x;
+			oy[i] = position.y;
+			oz[i] = position.z;
+		}
+	}
+}
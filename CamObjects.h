@@ -70,18 +70,63 @@ public:
 };
 
 
-//  render camera  - currently must be z axis aligned (we will improve this in project 4)
+// Structure of arrays batch of rays, filled a row or tile at a time by the render camera
+//
+struct RayBatch {
+	void resize(size_t n) {
+		ox.resize(n); oy.resize(n); oz.resize(n);
+		dx.resize(n); dy.resize(n); dz.resize(n);
+	}
+	size_t size() const { return ox.size(); }
+	Ray get(size_t i) const { return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i])); }
+
+	vector<float> ox, oy, oz;    // origins
+	vector<float> dx, dy, dz;    // normalized directions
+};
+
+
+//  render camera with full orientation and a thin lens
+//
+//  The view plane rectangle (view.min, view.max) is placed view_dist in front of the
+//  camera, spanned by the right and up axes of the camera basis.  Rays are generated
+//  from a basis and per pixel deltas precomputed once per frame by prepare()
 //
 class RenderCam : public SceneObject {
 public:
 	RenderCam() {
 		position = glm::vec3(0, 0, 10);
 		aim = glm::vec3(0, 0, -1);
+		up = glm::vec3(0, 1, 0);
+		prepare(1, 1);
 	}
-	Ray getRay(float u, float v);
+
+	void lookAt(const glm::vec3 &target) { aim = glm::normalize(target - position); }
+
+	// Precompute the camera basis and pixel deltas for a width x height frame
+	void prepare(int width, int height);
+
+	Ray getRay(float u, float v);                            // pinhole ray through (u, v) in [0, 1]
+	Ray getLensRay(float u, float v, const glm::vec2 &lens);  // thin lens ray, lens sample in [0, 1)^2
+
+	// Pinhole rays through the centers of the pixels in [x0, x1) x [y0, y1), row major
+	void generateRays(int x0, int y0, int x1, int y1, RayBatch &batch);
+
+	// Width of a pixel's footprint per unit of distance along a camera ray
+	float pixelSpread() { return glm::length(pixel_du) / view_dist; }
+
 	void draw() { ofDrawBox(position, 1.0); };
 	void drawFrustum();
 
-	glm::vec3 aim;
-	ViewPlane view;          // The camera viewplane, this is the view that we will render 
+	glm::vec3 aim;               // direction the camera looks along
+	glm::vec3 up;                // approximate up direction
+	float view_dist = 5.0f;      // distance from the camera to the view plane
+	float focal_dist = 37.0f;    // distance to the plane in focus
+	float apeture_size = 0.0f;   // lens radius, 0 for a pinhole
+	ViewPlane view;              // The camera viewplane, this is the view that we will render 
+
+private:
+	glm::vec3 right_axis, up_axis, forward;   // camera basis
+	glm::vec3 plane_origin;                   // view plane point of (u, v) = (0, 0)
+	glm::vec3 plane_u, plane_v;               // view plane span of u and v
+	glm::vec3 pixel00, pixel_du, pixel_dv;    // center of pixel (0, 0) and per pixel steps
 };
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include "ofApp.h"
+#include "Denoiser.h"
+#include <thread>
+
+
+static float luminance(const glm::vec3 &c) {
+	return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+//---Render buffers----------------------------------------------------
+void RenderBuffers::allocate(int w, int h) {
+	width = w;
+	height = h;
+	color.assign(w * h, glm::vec3(0.0f));
+	albedo.assign(w * h, glm::vec3(0.0f));
+	normal.assign(w * h, glm::vec3(0.0f));
+	depth.assign(w * h, std::numeric_limits<float>::infinity());
+	variance.assign(w * h, 0.0f);
+}
+
+void RenderBuffers::save(const string &prefix) {
+	// Depth and variance are normalized by their largest finite value
+	float max_depth = 0.0f;
+	float max_variance = 0.0f;
+	for (int k = 0; k < width * height; k++) {
+		if (std::isfinite(depth[k]))
+			max_depth = std::max(max_depth, depth[k]);
+		max_variance = std::max(max_variance, variance[k]);
+	}
+
+	ofImage albedo_image, normal_image, depth_image, variance_image;
+	albedo_image.allocate(width, height, OF_IMAGE_COLOR);
+	normal_image.allocate(width, height, OF_IMAGE_COLOR);
+	depth_image.allocate(width, height, OF_IMAGE_COLOR);
+	variance_image.allocate(width, height, OF_IMAGE_COLOR);
+
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) {
+			int k = j * width + i;
+			glm::vec3 a = albedo[k] * 255.0f;
+			glm::vec3 n = (normal[k] * 0.5f + glm::vec3(0.5f)) * 255.0f;
+			float d = std::isfinite(depth[k]) && max_depth > 0 ? 255.0f * (1.0f - depth[k] / max_depth) : 0.0f;
+			float v = max_variance > 0 ? 255.0f * variance[k] / max_variance : 0.0f;
+			albedo_image.setColor(i, j, ofColor(a.x, a.y, a.z));
+			normal_image.setColor(i, j, ofColor(n.x, n.y, n.z));
+			depth_image.setColor(i, j, ofColor(d, d, d));
+			variance_image.setColor(i, j, ofColor(v, v, v));
+		}
+	}
+
+	if (!albedo_image.save(prefix + "_albedo.png") || !normal_image.save(prefix + "_normal.png") ||
+		!depth_image.save(prefix + "_depth.png") || !variance_image.save(prefix + "_variance.png"))
+		cerr << "Could not save feature buffers" << endl;
+}
+
+
+//---One a-trous step over a range of rows------------------------
+void Denoiser::filterRows(int row_begin, int row_end, int step) {
+	// B3 spline kernel
+	const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+	const RenderBuffers &b = *buffers;
+
+	for (int j = row_begin; j < row_end; j++) {
+		for (int i = 0; i < width; i++) {
+			int p = j * width + i;
+			float lum_p = luminance(color[p]);
+			float lum_sigma = sigma_color * std::sqrt(std::max(variance[p], 0.0f)) + 1e-3f;
+			float depth_p = b.depth[p];
+
+			glm::vec3 sum(0.0f);
+			float sum_var = 0.0f;
+			float sum_w = 0.0f;
+
+			for (int y = -2; y <= 2; y++) {
+				int qj = j + y * step;
+				if (qj < 0 || qj >= height)
+					continue;
+				for (int x = -2; x <= 2; x++) {
+					int qi = i + x * step;
+					if (qi < 0 || qi >= width)
+						continue;
+					int q = qj * width + qi;
+
+					// Background only blends with background
+					float depth_q = b.depth[q];
+					bool bg_p = !std::isfinite(depth_p);
+					bool bg_q = !std::isfinite(depth_q);
+					if (bg_p != bg_q)
+						continue;
+
+					float w = kernel[x + 2] * kernel[y + 2];
+					if (!bg_p) {
+						float w_normal = std::pow(std::max(0.0f, glm::dot(b.normal[p], b.normal[q])), sigma_normal);
+						float w_depth = std::exp(-std::abs(depth_p - depth_q) / (sigma_depth * depth_p * step + 1e-4f));
+						glm::vec3 da = b.albedo[p] - b.albedo[q];
+						float w_albedo = std::exp(-glm::dot(da, da) / sigma_albedo);
+						w *= w_normal * w_depth * w_albedo;
+					}
+					w *= std::exp(-std::abs(lum_p - luminance(color[q])) / lum_sigma);
+
+					sum += w * color[q];
+					sum_var += w * w * variance[q];
+					sum_w += w;
+				}
+			}
+
+			// The center pixel always has a positive weight
+			color_out[p] = sum / sum_w;
+			variance_out[p] = sum_var / (sum_w * sum_w);
+		}
+	}
+} // end filterRows
+
+
+//---Filter the color buffer----------------------------------------
+void Denoiser::denoise(const RenderBuffers &in, vector<glm::vec3> &out, uint32_t num_threads) {
+	buffers = &in;
+	width = in.width;
+	height = in.height;
+
+	// Divide out the albedo so only lighting is filtered
+	color.resize(width * height);
+	variance.resize(width * height);
+	for (int k = 0; k < width * height; k++) {
+		glm::vec3 a = glm::max(in.albedo[k], glm::vec3(0.01f));
+		bool demodulate = std::isfinite(in.depth[k]);
+		color[k] = demodulate ? in.color[k] / a : in.color[k];
+		float scale = demodulate ? luminance(glm::vec3(1.0f) / a) : 1.0f;
+		variance[k] = in.variance[k] * scale * scale;
+	}
+	color_out.resize(width * height);
+	variance_out.resize(width * height);
+
+	num_threads = std::max(1u, std::min(num_threads, static_cast<uint32_t>(height)));
+	int rows = (height + num_threads - 1) / num_threads;
+	for (int it = 0; it < iterations; it++) {
+		vector<std::thread> threads;
+		for (int row = 0; row < height; row += rows)
+			threads.push_back(std::thread(&Denoiser::filterRows, this, row, std::min(height, row + rows), 1 << it));
+		for (auto &thread : threads)
+			thread.join();
+
+		std::swap(color, color_out);
+		std::swap(variance, variance_out);
+	}
+
+	// Multiply the albedo back in
+	out.resize(width * height);
+	for (int k = 0; k < width * height; k++) {
+		glm::vec3 a = glm::max(in.albedo[k], glm::vec3(0.01f));
+		out[k] = std::isfinite(in.depth[k]) ? color[k] * a : color[k];
+	}
+} // end denoise
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ofApp.h"
+
+
+/*
+	Sample Stats
+	- Running mean and variance of the sample luminance of a pixel (Welford)
+*/
+struct SampleStats {
+	void add(const glm::vec3 &c) {
+		float l = 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+		n++;
+		float delta = l - mean;
+		mean += delta / n;
+		m2 += delta * (l - mean);
+	}
+
+	// Variance of the mean of the samples
+	float meanVariance() const { return n > 1 ? m2 / ((n - 1) * n) : 0.0f; }
+
+	uint32_t n = 0;
+	float mean = 0.0f;
+	float m2 = 0.0f;
+};
+
+
+/*
+	Render Buffers
+	- Color and auxiliary feature buffers written by RayTracer::render
+*/
+struct RenderBuffers {
+	void allocate(int w, int h);
+
+	// Save the feature buffers as images named <prefix>_albedo.png etc.
+	void save(const string &prefix);
+
+	int width = 0;
+	int height = 0;
+	vector<glm::vec3> color;     // pixel color in [0, 255]
+	vector<glm::vec3> albedo;    // diffuse albedo of the primary hit in [0, 1], 0 for background
+	vector<glm::vec3> normal;    // unit normal of the primary hit
+	vector<float> depth;         // primary hit distance, infinity for background
+	vector<float> variance;      // variance of the pixel mean luminance, 0 for single sample pixels
+};
+
+
+/*
+	Denoiser
+	- Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the
+	  feature buffers, with the variance driven luminance weight of SVGF
+	- Lighting is filtered with the albedo divided out, so texture detail survives
+*/
+class Denoiser {
+public:
+	void denoise(const RenderBuffers &in, vector<glm::vec3> &out, uint32_t num_threads);
+
+	int iterations = 5;           // filter steps, the footprint doubles every step
+	float sigma_color = 4.0f;     // luminance edge stopping, in standard deviations
+	float sigma_normal = 64.0f;   // normal edge stopping exponent
+	float sigma_depth = 0.02f;    // relative depth edge stopping
+	float sigma_albedo = 0.1f;    // albedo edge stopping
+
+private:
+	void filterRows(int row_begin, int row_end, int step);
+
+	const RenderBuffers *buffers;
+	int width, height;
+	vector<glm::vec3> color, color_out;
+	vector<float> variance, variance_out;
+};
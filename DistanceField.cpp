@@ -0,0 +1,200 @@
+#include "ofApp.h"
+#include "DistanceField.h"
+#include <thread>
+
+
+//---Constructor----------------------------------------------------
+BrickMap::BrickMap(SceneObject *obj, const glm::vec3 &bmin, const glm::vec3 &bmax, float voxel_size) {
+	object = obj;
+	this->bmin = bmin;
+	this->voxel_size = voxel_size;
+	cell_size = voxel_size * brick_res;
+
+	// Round the region up to a whole number of cells
+	glm::vec3 extent = (bmax - bmin) / cell_size;
+	dims = glm::ivec3(
+		std::max(1, static_cast<int>(std::ceil(extent.x))),
+		std::max(1, static_cast<int>(std::ceil(extent.y))),
+		std::max(1, static_cast<int>(std::ceil(extent.z))));
+	this->bmax = bmin + glm::vec3(dims.x, dims.y, dims.z) * cell_size;
+}
+
+
+//---Classify cells as narrow band or far field---------------------
+void BrickMap::bakeCells(int z_begin, int z_end) {
+	for (int z = z_begin; z < z_end; z++) {
+		for (int y = 0; y < dims.y; y++) {
+			for (int x = 0; x < dims.x; x++) {
+				glm::vec3 center = cellMin(x, y, z) + glm::vec3(0.5f * cell_size);
+				cell_dist[cellIndex(x, y, z)] = object->sdf(center);
+			}
+		}
+	}
+}
+
+//---Sample the sdf into the bricks of narrow band cells------------
+void BrickMap::bakeBricks(int z_begin, int z_end) {
+	const int n = brick_samples * brick_samples * brick_samples;
+	for (int z = z_begin; z < z_end; z++) {
+		for (int y = 0; y < dims.y; y++) {
+			for (int x = 0; x < dims.x; x++) {
+				int brick = cell_brick[cellIndex(x, y, z)];
+				if (brick < 0)
+					continue;
+
+				glm::vec3 origin = cellMin(x, y, z);
+				float *samples = &bricks[brick * n];
+				for (int k = 0; k < brick_samples; k++)
+					for (int j = 0; j < brick_samples; j++)
+						for (int i = 0; i < brick_samples; i++)
+							samples[(k * brick_samples + j) * brick_samples + i] = object->sdf(origin + glm::vec3(i, j, k) * voxel_size);
+			}
+		}
+	}
+}
+
+//---Bake the brick map, work is split into z slabs per thread------
+void BrickMap::bake(uint32_t num_threads) {
+	num_threads = std::max(1u, std::min(num_threads, static_cast<uint32_t>(dims.z)));
+	int slab = (dims.z + num_threads - 1) / num_threads;
+
+	auto run = [&](void (BrickMap::*pass)(int, int)) {
+		vector<std::thread> threads;
+		for (uint32_t t = 0; t < num_threads; t++) {
+			int z_begin = t * slab;
+			int z_end = std::min(dims.z, z_begin + slab);
+			if (z_begin < z_end)
+				threads.push_back(std::thread(pass, this, z_begin, z_end));
+		}
+		for (auto &thread : threads)
+			thread.join();
+	};
+
+	// Coarse pass over cell centers
+	cell_dist.assign(dims.x * dims.y * dims.z, 0.0f);
+	run(&BrickMap::bakeCells);
+
+	// Cells whose center is within half a diagonal (plus the refine band) of the surface get a brick
+	float band = 0.5f * glm::length(glm::vec3(cell_size)) + refineDistance();
+	int num_bricks = 0;
+	cell_brick.assign(cell_dist.size(), -1);
+	for (size_t c = 0; c < cell_dist.size(); c++) {
+		if (std::abs(cell_dist[c]) < band)
+			cell_brick[c] = num_bricks++;
+	}
+
+	// Fine pass over the narrow band
+	bricks.assign(num_bricks * brick_samples * brick_samples * brick_samples, 0.0f);
+	run(&BrickMap::bakeBricks);
+}
+
+
+//---Trilinearly interpolated distance--------------------------------
+bool BrickMap::sample(const glm::vec3 &p, float &dist) const {
+	glm::vec3 lp = (p - bmin) / cell_size;
+	if (lp.x < 0 || lp.y < 0 || lp.z < 0 || lp.x >= dims.x || lp.y >= dims.y || lp.z >= dims.z)
+		return false;
+
+	int cx = static_cast<int>(lp.x);
+	int cy = static_cast<int>(lp.y);
+	int cz = static_cast<int>(lp.z);
+	int c = cellIndex(cx, cy, cz);
+	int brick = cell_brick[c];
+
+	// Far field, the distance at the cell center minus the offset from the center is a safe bound
+	if (brick < 0) {
+		glm::vec3 center = cellMin(cx, cy, cz) + glm::vec3(0.5f * cell_size);
+		float r = glm::distance(p, center);
+		dist = cell_dist[c] > 0 ? cell_dist[c] - r : cell_dist[c] + r;
+		return true;
+	}
+
+	// Narrow band, interpolate the brick samples
+	glm::vec3 local = (lp - glm::vec3(cx, cy, cz)) * static_cast<float>(brick_res);
+	int i = std::min(static_cast<int>(local.x), brick_res - 1);
+	int j = std::min(static_cast<int>(local.y), brick_res - 1);
+	int k = std::min(static_cast<int>(local.z), brick_res - 1);
+	glm::vec3 f = local - glm::vec3(i, j, k);
+
+	const float *s = &bricks[brick * brick_samples * brick_samples * brick_samples];
+	auto at = [&](int x, int y, int z) { return s[(z * brick_samples + y) * brick_samples + x]; };
+
+	float x00 = glm::mix(at(i, j, k), at(i + 1, j, k), f.x);
+	float x10 = glm::mix(at(i, j + 1, k), at(i + 1, j + 1, k), f.x);
+	float x01 = glm::mix(at(i, j, k + 1), at(i + 1, j, k + 1), f.x);
+	float x11 = glm::mix(at(i, j + 1, k + 1), at(i + 1, j + 1, k + 1), f.x);
+	dist = glm::mix(glm::mix(x00, x10, f.y), glm::mix(x01, x11, f.y), f.z);
+
+	return true;
+} // end sample
+
+
+// --- DISK -------------------------------------------------------------------
+// --- CACHE ------------------------------------------------------------------
+
+// Key from the object parameters and the bake settings
+string BrickMap::cacheKey() {
+	ostringstream key;
+	key << object->getParamKey() << " | " << bmin.x << " " << bmin.y << " " << bmin.z << " "
+		<< dims.x << " " << dims.y << " " << dims.z << " " << voxel_size;
+
+	ostringstream hex;
+	hex << std::hex << std::hash<string>()(key.str());
+	return hex.str();
+}
+
+bool BrickMap::save(const string &path) {
+	ofstream out(path, ios::binary);
+	if (!out) {
+		cerr << "Could not write brick map cache: " << path << endl;
+		return false;
+	}
+
+	uint32_t num_cells = cell_dist.size();
+	uint32_t num_samples = bricks.size();
+	out.write("BRK1", 4);
+	out.write(reinterpret_cast<const char*>(&dims), sizeof(dims));
+	out.write(reinterpret_cast<const char*>(&num_cells), sizeof(num_cells));
+	out.write(reinterpret_cast<const char*>(&num_samples), sizeof(num_samples));
+	out.write(reinterpret_cast<const char*>(cell_dist.data()), num_cells * sizeof(float));
+	out.write(reinterpret_cast<const char*>(cell_brick.data()), num_cells * sizeof(int32_t));
+	out.write(reinterpret_cast<const char*>(bricks.data()), num_samples * sizeof(float));
+	return static_cast<bool>(out);
+}
+
+bool BrickMap::load(const string &path) {
+	ifstream in(path, ios::binary);
+	if (!in)
+		return false;
+
+	char magic[4];
+	glm::ivec3 file_dims;
+	uint32_t num_cells, num_samples;
+	in.read(magic, 4);
+	in.read(reinterpret_cast<char*>(&file_dims), sizeof(file_dims));
+	in.read(reinterpret_cast<char*>(&num_cells), sizeof(num_cells));
+	in.read(reinterpret_cast<char*>(&num_samples), sizeof(num_samples));
+	if (!in || string(magic, 4) != "BRK1" || !(file_dims == dims) || num_cells != static_cast<uint32_t>(dims.x * dims.y * dims.z)) {
+		cerr << "Ignoring stale brick map cache: " << path << endl;
+		return false;
+	}
+
+	cell_dist.resize(num_cells);
+	cell_brick.resize(num_cells);
+	bricks.resize(num_samples);
+	in.read(reinterpret_cast<char*>(cell_dist.data()), num_cells * sizeof(float));
+	in.read(reinterpret_cast<char*>(cell_brick.data()), num_cells * sizeof(int32_t));
+	in.read(reinterpret_cast<char*>(bricks.data()), num_samples * sizeof(float));
+	if (!in)
+		return false;
+
+	// Brick indices are offsets into bricks, a corrupt file must not point past them
+	const int64_t n = brick_samples * brick_samples * brick_samples;
+	for (int32_t brick : cell_brick) {
+		if (brick < -1 || (static_cast<int64_t>(brick) + 1) * n > num_samples) {
+			cerr << "Ignoring corrupt brick map cache: " << path << endl;
+			return false;
+		}
+	}
+	return true;
+}
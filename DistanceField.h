@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ofApp.h"
+#include "SceneObjects.h"
+
+
+/*
+	Brick Map
+	- Sparse baked distance field for expensive SDF objects
+	- The bake region is split into coarse cells. Cells near the surface
+	  store a brick of distance samples (narrow band), cells far from the
+	  surface only store the distance at their center (far field bound)
+*/
+class BrickMap {
+public:
+	BrickMap(SceneObject *obj, const glm::vec3 &bmin, const glm::vec3 &bmax, float voxel_size);
+
+	// Sample the object's sdf into the brick map
+	void bake(uint32_t num_threads);
+
+	// Disk cache
+	bool load(const string &path);
+	bool save(const string &path);
+	string cacheKey();
+
+	// Interpolated distance at p, returns false if p is outside the baked region
+	bool sample(const glm::vec3 &p, float &dist) const;
+
+	// Below this distance the exact sdf should be used to refine the hit
+	float refineDistance() const { return 2.0f * voxel_size; }
+
+	SceneObject *object;
+
+private:
+	static const int brick_res = 8;                   // voxels per brick side
+	static const int brick_samples = brick_res + 1;   // samples per brick side, shared with neighbours
+
+	int cellIndex(int x, int y, int z) const { return (z * dims.y + y) * dims.x + x; }
+	glm::vec3 cellMin(int x, int y, int z) const { return bmin + glm::vec3(x, y, z) * cell_size; }
+	void bakeCells(int z_begin, int z_end);
+	void bakeBricks(int z_begin, int z_end);
+
+	glm::vec3 bmin, bmax;
+	float voxel_size;
+	float cell_size;
+	glm::ivec3 dims;
+
+	vector<float> cell_dist;      // distance at each cell center
+	vector<int32_t> cell_brick;   // index of the cell's brick, -1 for far field cells
+	vector<float> bricks;         // brick_samples^3 samples per brick
+};
@@ -0,0 +1,114 @@
+#include "ofApp.h"
+#include "Instance.h"
+
+
+//---Transforms of the instance and what its prototype supports------------
+void Instance::prepare() {
+	glm::mat4 m = glm::translate(glm::mat4(1.0), position);
+	m = glm::rotate(m, glm::radians(rotate_amt), rotate_axis);
+	to_world = glm::scale(m, glm::vec3(scale));
+	to_local = glm::inverse(to_world);
+
+	// Rotation times a uniform scale, normals are renormalized after it
+	normal_to_world = glm::mat3(to_world);
+
+	geometry = nullptr;
+	traced = marched = false;
+	if (!prototype)
+		return;
+
+	switch (prototype->type) {
+	case ObjectType::mesh:
+		geometry = static_cast<Mesh*>(prototype)->geometry;
+		traced = geometry && geometry->isValid();
+		break;
+	case ObjectType::sphere:
+		traced = marched = true;
+		break;
+	case ObjectType::torus:
+	case ObjectType::twisted_torus:
+	case ObjectType::twisted_repeated_torus:
+	case ObjectType::csg:
+		marched = true;
+		break;
+	default:
+		cerr << "Instance prototype type not supported: " << static_cast<int>(prototype->type) << endl;
+		break;
+	}
+} // end prepare
+
+
+//---Closest hit in prototype space------------------------------------------
+bool Instance::intersect(const Ray &r, float t_max, float &t, glm::vec3 &normal) const {
+	glm::vec3 o = to_local * glm::vec4(r.p, 1);
+	glm::vec3 d = to_local * glm::vec4(r.d, 0);
+	glm::vec3 n;
+
+	if (geometry) {
+		// The direction keeps the scale, so hit distances stay world distances
+		if (!geometry->intersect(Ray(o - prototype->position, d), t_max, t, n))
+			return false;
+	}
+	else {
+		glm::vec3 point;
+		float len = glm::length(d);
+		if (!prototype->intersect(Ray(o, d / len), point, n))
+			return false;
+		t = glm::distance(o, point) / len;
+		if (t >= t_max)
+			return false;
+	}
+
+	normal = glm::normalize(normal_to_world * n);
+	return true;
+} // end intersect
+
+
+bool Instance::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+	float t;
+	if (!traced || !intersect(ray, std::numeric_limits<float>::infinity(), t, normal))
+		return false;
+	point = ray.p + ray.d * t;
+	return true;
+}
+
+
+//---Distance in prototype space, scaled back to world units-----------------
+float Instance::distance(const glm::vec3 &p, float best) const {
+	glm::vec3 q = to_local * glm::vec4(p, 1);
+	if (prototype->type == ObjectType::csg)
+		return static_cast<CSGObject*>(prototype)->sdf(q, best / scale) * scale;
+	return prototype->sdf(q) * scale;
+}
+
+
+//---World bounds of the prototype's transformed bounds------------------------
+bool Instance::getBounds(glm::vec3 &bmin, glm::vec3 &bmax) {
+	glm::vec3 pmin, pmax;
+	if (!prototype || !prototype->getBounds(pmin, pmax))
+		return false;
+
+	bmin = glm::vec3(std::numeric_limits<float>::infinity());
+	bmax = -bmin;
+	for (int c = 0; c < 8; c++) {
+		glm::vec3 corner((c & 1) ? pmax.x : pmin.x, (c & 2) ? pmax.y : pmin.y, (c & 4) ? pmax.z : pmin.z);
+		glm::vec3 q = to_world * glm::vec4(corner, 1);
+		bmin = glm::min(bmin, q);
+		bmax = glm::max(bmax, q);
+	}
+	return true;
+} // end getBounds
+
+
+void Instance::draw() {
+	glm::vec3 bmin, bmax;
+	ofSetColor(diffuseColor);
+	if (getBounds(bmin, bmax)) {
+		glm::vec3 center = (bmin + bmax) * 0.5f;
+		glm::vec3 size = bmax - bmin;
+		ofDrawBox(glm::vec3(center.x, -center.y, center.z), size.x, size.y, size.z);
+	}
+	else {
+		ofDrawSphere(glm::vec3(position.x, -position.y, position.z), 1);
+	}
+}
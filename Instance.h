@@ -0,0 +1,61 @@
+#pragma once
+
+#include "ofApp.h"
+#include "SceneObjects.h"
+#include "CSG.h"
+#include "Mesh.h"
+
+
+/*
+	Instance
+	- Copy of a prototype object placed by its own rotation, uniform scale and
+	  translation, with its own material
+	- The prototype is shared and not added to the scene itself, so thousands of
+	  instances cost a transform each and no geometry
+	- Mesh and sphere prototypes are ray traced, tori, CSG trees and spheres are
+	  ray marched
+*/
+class Instance : public SceneObject {
+public:
+	Instance(SceneObject *prototype, glm::vec3 p, ofColor diffuse, float power) {
+		this->prototype = prototype;
+		position = p;
+		diffuseColor = diffuse;
+		this->power = power;
+		type = ObjectType::instance;
+		prepare();
+	}
+
+	void setRotateAmt(float r) { rotate_amt = r; prepare(); }
+	void setRotateAxis(const glm::vec3 &ra) { rotate_axis = glm::normalize(ra); prepare(); }
+	void setScale(float s) { scale = s; prepare(); }
+
+	// Recompute the transforms, called by the setters and at render start
+	void prepare();
+
+	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+	float sdf(const glm::vec3 &p) { return distance(p, std::numeric_limits<float>::infinity()); }
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax);
+	void draw();
+
+	// Closest hit nearer than t_max with the ray moved into prototype space
+	bool intersect(const Ray &r, float t_max, float &t, glm::vec3 &normal) const;
+
+	// Distance to the instance, a lower bound when that is already at least best
+	float distance(const glm::vec3 &p, float best) const;
+
+	bool isTraced() const { return traced; }
+	bool isMarched() const { return marched; }
+
+	SceneObject *prototype = nullptr;
+
+private:
+	float rotate_amt = 0.0f;
+	glm::vec3 rotate_axis = glm::vec3(0, 1, 0);
+	float scale = 1.0f;
+
+	glm::mat4 to_world, to_local;
+	glm::mat3 normal_to_world;
+	TriangleMesh *geometry = nullptr;     // set for mesh prototypes
+	bool traced = false, marched = false;
+}; // end class Instance
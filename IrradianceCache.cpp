@@ -0,0 +1,130 @@
+#include "ofApp.h"
+#include "IrradianceCache.h"
+#include <mutex>
+
+
+// Octant of p in a node, one bit per axis on the positive side
+static int octant(const glm::vec3 &center, const glm::vec3 &p) {
+	return (p.x >= center.x ? 1 : 0) | (p.y >= center.y ? 2 : 0) | (p.z >= center.z ? 4 : 0);
+}
+
+static glm::vec3 octantOffset(int oct) {
+	return glm::vec3((oct & 1) ? 1.0f : -1.0f, (oct & 2) ? 1.0f : -1.0f, (oct & 4) ? 1.0f : -1.0f);
+}
+
+
+void IrradianceCache::clear() {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	records.clear();
+	nodes.clear();
+	root = -1;
+}
+
+
+size_t IrradianceCache::size() const {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return records.size();
+}
+
+
+int IrradianceCache::addNode(const glm::vec3 &center, float half) {
+	Node node;
+	node.center = center;
+	node.half = half;
+	for (int i = 0; i < 8; i++)
+		node.child[i] = -1;
+	nodes.push_back(node);
+	return nodes.size() - 1;
+}
+
+
+//---Interpolate the records valid at p------------------------------------
+// Records are weighted by 1 / error - 1 / accuracy, which falls to 0 at the edge of
+// a record's validity so neighbouring records blend without seams
+bool IrradianceCache::lookup(const glm::vec3 &p, const glm::vec3 &n, glm::vec3 &E) const {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	if (root < 0)
+		return false;
+
+	glm::vec3 sum(0.0f);
+	float sum_w = 0.0f;
+
+	static thread_local vector<int> stack;
+	stack.clear();
+	stack.push_back(root);
+	while (!stack.empty()) {
+		const Node &node = nodes[stack.back()];
+		stack.pop_back();
+
+		for (uint32_t r : node.records) {
+			const Record &rec = records[r];
+			glm::vec3 dp = p - rec.p;
+			float error = glm::length(dp) / rec.R + std::sqrt(std::max(0.0f, 1.0f - glm::dot(n, rec.n)));
+			if (error >= accuracy)
+				continue;
+
+			// A point in front of the record sees surfaces the record didn't
+			if (glm::dot(dp, (n + rec.n) * 0.5f) < -0.05f * rec.R)
+				continue;
+
+			glm::vec3 rot = glm::cross(rec.n, n);
+			glm::vec3 e;
+			for (int c = 0; c < 3; c++)
+				e[c] = std::max(0.0f, rec.E[c] + glm::dot(rot, rec.rot_grad[c]) + glm::dot(dp, rec.trans_grad[c]));
+
+			float w = 1.0f / std::max(error, 1e-6f) - 1.0f / accuracy;
+			sum += w * e;
+			sum_w += w;
+		}
+
+		// A child's records are valid no further than its half edge outside it
+		for (int i = 0; i < 8; i++) {
+			if (node.child[i] < 0)
+				continue;
+			const Node &child = nodes[node.child[i]];
+			glm::vec3 d = glm::abs(p - child.center);
+			if (std::max(d.x, std::max(d.y, d.z)) <= 2.0f * child.half)
+				stack.push_back(node.child[i]);
+		}
+	}
+
+	if (sum_w <= 0.0f)
+		return false;
+	E = sum / sum_w;
+	return true;
+} // end lookup
+
+
+//---Add a record in the deepest node its radius fits----------------------
+void IrradianceCache::insert(const Record &record) {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	float radius = accuracy * record.R;
+
+	if (root < 0)
+		root = addNode(record.p, std::max(radius, 1.0f));
+
+	// Grow the root towards the record until it holds the record and its radius
+	for (;;) {
+		glm::vec3 d = glm::abs(record.p - nodes[root].center);
+		if (std::max(d.x, std::max(d.y, d.z)) <= nodes[root].half && radius <= nodes[root].half)
+			break;
+		glm::vec3 dir = octantOffset(octant(nodes[root].center, record.p));
+		int grown = addNode(nodes[root].center + dir * nodes[root].half, 2.0f * nodes[root].half);
+		nodes[grown].child[octant(nodes[grown].center, nodes[root].center)] = root;
+		root = grown;
+	}
+
+	int node = root;
+	while (0.5f * nodes[node].half >= radius) {
+		int oct = octant(nodes[node].center, record.p);
+		if (nodes[node].child[oct] < 0) {
+			float half = 0.5f * nodes[node].half;
+			int child = addNode(nodes[node].center + octantOffset(oct) * half, half);
+			nodes[node].child[oct] = child;
+		}
+		node = nodes[node].child[oct];
+	}
+
+	nodes[node].records.push_back(records.size());
+	records.push_back(record);
+} // end insert
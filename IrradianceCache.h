@@ -0,0 +1,53 @@
+#pragma once
+
+#include "ofApp.h"
+#include <shared_mutex>
+
+
+/*
+	Irradiance Cache
+	- Sparse records of the indirect irradiance arriving at diffuse points (Ward et al. 1988)
+	- Every record has rotational and translational gradients (Ward and Heckbert 1992), points
+	  near a record extrapolate from it instead of tracing a hemisphere of their own
+	- Records are kept in an octree by their radius of validity, the root grows to take
+	  records outside it
+	- Lookups share a reader lock and insertions take it alone, so the render threads
+	  fill one cache together
+*/
+class IrradianceCache {
+public:
+	struct Record {
+		glm::vec3 p, n;
+		glm::vec3 E;                // irradiance
+		float R;                    // harmonic mean distance to the surfaces seen from p
+		glm::vec3 rot_grad[3];      // rotational gradient of each color channel
+		glm::vec3 trans_grad[3];    // translational gradient of each color channel
+	};
+
+	void clear();
+
+	// Weighted irradiance of the records valid at p with unit normal n, false when there are none
+	bool lookup(const glm::vec3 &p, const glm::vec3 &n, glm::vec3 &E) const;
+
+	void insert(const Record &record);
+
+	size_t size() const;
+
+	// Largest error of a record at a point it is used for, smaller is more records
+	float accuracy = 0.2f;
+
+private:
+	struct Node {
+		glm::vec3 center;
+		float half;                 // half the edge of the node's cube
+		int32_t child[8];           // -1 when empty
+		vector<uint32_t> records;   // records whose radius fits this node but not a child
+	};
+
+	int addNode(const glm::vec3 &center, float half);
+
+	vector<Record> records;
+	vector<Node> nodes;
+	int root = -1;
+	mutable std::shared_mutex mutex;
+};
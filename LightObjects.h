@@ -15,13 +15,15 @@ public:
 		position = p;
 		intensity = i;
 		radius = r;
+		type = ObjectType::luminaire;
 	}
 	Luminaire(glm::vec3 p, float i) {
 		position = p;
 		intensity = i;
 		radius = 3;
+		type = ObjectType::luminaire;
 	}
-	Luminaire() {}
+	Luminaire() { type = ObjectType::luminaire; }
 
 	void draw() {
 		ofSetColor(ofColor::white);
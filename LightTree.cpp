@@ -0,0 +1,130 @@
+#include "ofApp.h"
+#include "LightTree.h"
+
+
+//---Build the tree over all point and cone lights--------------------
+void LightTree::build(const vector<Light*> &lights, const vector<ConeLight*> &cones) {
+	refs.clear();
+	nodes.clear();
+
+	for (int i = 0; i < lights.size(); i++)
+		refs.push_back({ lights[i]->position, lights[i]->intensity, i, false });
+	for (int i = 0; i < cones.size(); i++)
+		refs.push_back({ cones[i]->position, cones[i]->intensity, i, true });
+
+	if (!refs.empty()) {
+		nodes.reserve(2 * refs.size());
+		buildNode(0, refs.size());
+	}
+}
+
+//---Median split along the longest axis, one light per leaf----------
+int LightTree::buildNode(int begin, int end) {
+	int index = nodes.size();
+	nodes.push_back(Node());
+
+	Node node;
+	node.bmin = glm::vec3(std::numeric_limits<float>::infinity());
+	node.bmax = glm::vec3(-std::numeric_limits<float>::infinity());
+	node.intensity = 0;
+	for (int i = begin; i < end; i++) {
+		node.bmin = glm::min(node.bmin, refs[i].position);
+		node.bmax = glm::max(node.bmax, refs[i].position);
+		node.intensity += refs[i].intensity;
+	}
+
+	if (end - begin == 1) {
+		node.left = node.right = -1;
+		node.light = begin;
+	}
+	else {
+		glm::vec3 extent = node.bmax - node.bmin;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		int mid = (begin + end) / 2;
+		std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+			[axis](const LightRef &a, const LightRef &b) { return a.position[axis] < b.position[axis]; });
+
+		node.light = -1;
+		node.left = buildNode(begin, mid);
+		node.right = buildNode(mid, end);
+	}
+
+	nodes[index] = node;
+	return index;
+} // end buildNode
+
+
+// Squared distance from p to the node bounds, 0 inside
+float LightTree::distance2(const Node &node, const glm::vec3 &p) {
+	glm::vec3 d = glm::max(glm::max(node.bmin - p, p - node.bmax), glm::vec3(0.0f));
+	return glm::dot(d, d);
+}
+
+// Estimated contribution of a node at p, distance is measured to the node center
+// and clamped by the node size so nearby clusters aren't over weighted
+float LightTree::importance(const Node &node, const glm::vec3 &p) const {
+	glm::vec3 center = 0.5f * (node.bmin + node.bmax);
+	glm::vec3 half = 0.5f * (node.bmax - node.bmin);
+	float d2 = glm::max(glm::dot(center - p, center - p), glm::max(glm::dot(half, half), 1e-4f));
+	return node.intensity / d2;
+}
+
+
+//---Deterministic culling of lights that can't contribute enough-------
+void LightTree::cull(const glm::vec3 &p, float threshold, vector<LightRef> &result) const {
+	result.clear();
+	if (nodes.empty())
+		return;
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node &node = nodes[stack[--top]];
+
+		// The summed intensity over the closest distance bounds every light below the node
+		float d2 = distance2(node, p);
+		if (d2 > 0 && node.intensity / d2 < threshold)
+			continue;
+
+		if (node.light >= 0) {
+			result.push_back(refs[node.light]);
+		}
+		else {
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+} // end cull
+
+
+//---Stochastic light selection by importance-----------------------
+bool LightTree::sample(const glm::vec3 &p, float u, LightRef &light, float &pdf) const {
+	if (nodes.empty())
+		return false;
+
+	pdf = 1.0f;
+	int index = 0;
+	while (nodes[index].light < 0) {
+		const Node &node = nodes[index];
+		float wl = importance(nodes[node.left], p);
+		float wr = importance(nodes[node.right], p);
+		float pl = wl + wr > 0 ? wl / (wl + wr) : 0.5f;
+
+		// Reuse the random number for the next level
+		if (u < pl) {
+			u = u / pl;
+			pdf *= pl;
+			index = node.left;
+		}
+		else {
+			u = (u - pl) / (1.0f - pl);
+			pdf *= 1.0f - pl;
+			index = node.right;
+		}
+		u = glm::min(u, 0.99999994f);
+	}
+
+	light = refs[nodes[index].light];
+	return pdf > 0;
+} // end sample
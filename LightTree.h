@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ofApp.h"
+#include "LightObjects.h"
+
+
+/*
+	Light Tree
+	- Bounding volume hierarchy over the point and cone lights
+	- Nodes store the summed intensity of their lights so whole subtrees can be
+	  culled or importance sampled by their inverse square contribution at a point
+*/
+class LightTree {
+public:
+	// Reference to a light in the tree, index is into the light or cone light list
+	struct LightRef {
+		glm::vec3 position;
+		float intensity;
+		int index;
+		bool isCone;
+	};
+
+	void build(const vector<Light*> &lights, const vector<ConeLight*> &cones);
+
+	// Lights whose inverse square intensity at p is at least threshold
+	void cull(const glm::vec3 &p, float threshold, vector<LightRef> &result) const;
+
+	// Pick one light with probability proportional to its estimated contribution at p
+	// u is a uniform random number in [0, 1), pdf is the probability of the picked light
+	bool sample(const glm::vec3 &p, float u, LightRef &light, float &pdf) const;
+
+	bool empty() const { return refs.empty(); }
+
+private:
+	struct Node {
+		glm::vec3 bmin, bmax;
+		float intensity;     // Sum of the intensities below the node
+		int left, right;     // Child nodes, -1 for leaves
+		int light;           // Light of a leaf node
+	};
+
+	int buildNode(int begin, int end);
+	float importance(const Node &node, const glm::vec3 &p) const;
+	static float distance2(const Node &node, const glm::vec3 &p);
+
+	vector<LightRef> refs;
+	vector<Node> nodes;
+};
@@ -0,0 +1,812 @@
+#include "ofApp.h"
+#include "Mesh.h"
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+// Cache file layout
+//   header:   "MSH2", int32 vertex, triangle and node counts, int32 BVHNode size
+//   vertices: float x, y, z from byte 64
+//   indices:  uint32 triple per triangle in leaf order, right after the vertices
+//   nodes:    BVHNode records, 32 byte aligned
+static const size_t header_bytes = 64;
+
+static const char cache_magic[4] = { 'M', 'S', 'H', '2' };
+
+static size_t nodeOffset(int num_vertices, int num_triangles) {
+	size_t end = header_bytes + num_vertices * sizeof(glm::vec3) + num_triangles * 3 * sizeof(uint32_t);
+	return (end + 31) & ~static_cast<size_t>(31);
+}
+
+
+// The traversals trust the hierarchy: leaves within the triangles, children after
+// their parent and within the nodes, and no deeper than their fixed stacks
+static bool validTree(const BVHNode *nodes, int num_nodes, int num_triangles) {
+	struct Entry { int node; int depth; };
+	vector<Entry> stack = { { 0, 0 } };
+	while (!stack.empty()) {
+		Entry e = stack.back();
+		stack.pop_back();
+		const BVHNode &n = nodes[e.node];
+		if (e.depth > bvh_max_depth || n.count < 0 || n.index < 0)
+			return false;
+		if (n.count > 0) {
+			if (static_cast<int64_t>(n.index) + n.count > num_triangles)
+				return false;
+			continue;
+		}
+		if (e.node + 1 >= num_nodes || n.index <= e.node || n.index >= num_nodes)
+			return false;
+		stack.push_back({ e.node + 1, e.depth + 1 });
+		stack.push_back({ n.index, e.depth + 1 });
+	}
+	return true;
+}
+
+
+//---Load the mesh, from the cache file when it is current--------------------
+TriangleMesh::TriangleMesh(const string &path) : path(path) {
+	static_assert(sizeof(glm::vec3) == 12 && sizeof(BVHNode) == 32, "cache layout");
+
+	// The cache file is keyed by the source path, size and modification time
+	string source = ofToDataPath(path);
+	std::error_code ec;
+	uintmax_t size = std::filesystem::file_size(source, ec);
+	if (ec) {
+		cerr << "Could not find mesh at path: " << path << endl;
+		return;
+	}
+	auto mtime = std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+
+	ostringstream key, hex;
+	key << path << " " << size << " " << mtime << " " << string(cache_magic, 4) << sizeof(BVHNode);
+	hex << std::hex << std::hash<string>()(key.str());
+
+	string dir = MeshCache::instance().getCacheDir();
+	ofDirectory::createDirectory(dir, false, true);
+	string cache_path = ofToDataPath(dir + "mesh_" + hex.str() + ".msh");
+
+	if (mapCache(cache_path))
+		return;
+
+	float before_time = ofGetElapsedTimeMillis();
+	if (!parse(source)) {
+		cerr << "Could not load mesh: " << path << endl;
+		vertex_data.clear();
+		triangle_data.clear();
+		num_vertices = num_triangles = 0;
+		return;
+	}
+	float parse_time = ofGetElapsedTimeMillis();
+	buildBVH();
+	cout << "Mesh " << path << ": " << num_triangles << " triangles, parse " << parse_time - before_time
+		<< "ms, BVH " << ofGetElapsedTimeMillis() - parse_time << "ms" << endl;
+
+	vertices = vertex_data.data();
+	triangles = triangle_data.data();
+	nodes = node_data.data();
+
+	if (!writeCache(cache_path))
+		cerr << "Could not write mesh cache: " << cache_path << endl;
+} // end TriangleMesh
+
+
+TriangleMesh::~TriangleMesh() {
+#ifndef _WIN32
+	if (mapping && fallback.empty())
+		munmap(const_cast<uint8_t*>(mapping), mapping_size);
+#endif
+}
+
+
+void TriangleMesh::getBounds(glm::vec3 &bmin, glm::vec3 &bmax) const {
+	if (!num_nodes) {
+		bmin = bmax = glm::vec3(0);
+		return;
+	}
+	bmin = glm::vec3(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]);
+	bmax = glm::vec3(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]);
+}
+
+
+//---Read the source file and parse it by its extension-----------------------
+bool TriangleMesh::parse(const string &source) {
+	ifstream in(source, ios::binary | ios::ate);
+	if (!in)
+		return false;
+	size_t size = in.tellg();
+
+	// Terminated so number parsing never runs off the end
+	vector<char> text(size + 1);
+	in.seekg(0);
+	in.read(text.data(), size);
+	if (!in)
+		return false;
+	text[size] = '\0';
+
+	string ext = ofToLower(ofFilePath::getFileExt(source));
+	bool ok;
+	if (ext == "obj")
+		ok = parseOBJ(text.data(), text.data() + size);
+	else if (ext == "ply")
+		ok = parsePLY(text.data(), text.data() + size);
+	else {
+		cerr << "Unsupported mesh format: " << ext << endl;
+		return false;
+	}
+	if (!ok)
+		return false;
+
+	// Every index has to name a vertex
+	num_vertices = vertex_data.size();
+	num_triangles = triangle_data.size() / 3;
+	for (uint32_t i : triangle_data) {
+		if (i >= static_cast<uint32_t>(num_vertices))
+			return false;
+	}
+	return num_triangles > 0;
+} // end parse
+
+
+static const char *skipSpace(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+static const char *nextLine(const char *p, const char *end) {
+	p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+	return p ? p + 1 : end;
+}
+
+// Line starts with the keyword followed by a blank
+static bool isKeyword(const char *p, const char *end, char c) {
+	return p + 1 < end && p[0] == c && (p[1] == ' ' || p[1] == '\t');
+}
+
+
+//---OBJ, parsed in parallel over line aligned chunks--------------------------
+// A first pass counts the vertices of each chunk so every chunk knows where its
+// vertices go, which also resolves relative (negative) indices
+bool TriangleMesh::parseOBJ(const char *begin, const char *end) {
+	size_t size = end - begin;
+	int num_chunks = size < (1 << 20) ? 1 : std::max(1u, std::thread::hardware_concurrency());
+
+	vector<const char*> bounds(num_chunks + 1);
+	bounds[0] = begin;
+	bounds[num_chunks] = end;
+	for (int c = 1; c < num_chunks; c++)
+		bounds[c] = std::max(bounds[c - 1], nextLine(begin + size * c / num_chunks, end));
+
+	auto parallel = [num_chunks](const std::function<void(int)> &pass) {
+		vector<std::thread> threads;
+		for (int c = 0; c < num_chunks; c++)
+			threads.push_back(std::thread(pass, c));
+		for (auto &thread : threads)
+			thread.join();
+	};
+
+	// Vertices per chunk
+	vector<size_t> vertex_base(num_chunks + 1, 0);
+	parallel([&](int c) {
+		size_t count = 0;
+		for (const char *p = bounds[c]; p < bounds[c + 1]; p = nextLine(p, bounds[c + 1])) {
+			if (isKeyword(skipSpace(p, bounds[c + 1]), bounds[c + 1], 'v'))
+				count++;
+		}
+		vertex_base[c + 1] = count;
+	});
+	for (int c = 0; c < num_chunks; c++)
+		vertex_base[c + 1] += vertex_base[c];
+	vertex_data.resize(vertex_base[num_chunks]);
+
+	// Vertices and triangles
+	vector<vector<uint32_t>> chunk_tris(num_chunks);
+	vector<uint8_t> chunk_ok(num_chunks, 1);
+	parallel([&](int c) {
+		const char *chunk_end = bounds[c + 1];
+		size_t vertex = vertex_base[c];
+		vector<int64_t> polygon;
+
+		for (const char *p = bounds[c]; p < chunk_end; p = nextLine(p, chunk_end)) {
+			const char *q = skipSpace(p, chunk_end);
+
+			if (isKeyword(q, chunk_end, 'v')) {
+				char *e;
+				glm::vec3 &v = vertex_data[vertex++];
+				q += 2;
+				for (int a = 0; a < 3; a++) {
+					v[a] = std::strtof(q, &e);
+					if (e == q) {
+						chunk_ok[c] = 0;
+						return;
+					}
+					q = e;
+				}
+			}
+			else if (isKeyword(q, chunk_end, 'f')) {
+				// Vertex index of each corner, texture and normal indices are skipped
+				polygon.clear();
+				q += 2;
+				for (;;) {
+					q = skipSpace(q, chunk_end);
+					if (q >= chunk_end || *q == '\n' || *q == '\r' || *q == '#')
+						break;
+					char *e;
+					long index = std::strtol(q, &e, 10);
+					if (e == q || index == 0) {
+						chunk_ok[c] = 0;
+						return;
+					}
+					polygon.push_back(index > 0 ? index - 1 : static_cast<int64_t>(vertex) + index);
+					q = e;
+					while (q < chunk_end && !std::isspace(static_cast<unsigned char>(*q)))
+						q++;
+				}
+
+				for (int k = 1; k + 1 < polygon.size(); k++) {
+					if (polygon[0] < 0 || polygon[k] < 0 || polygon[k + 1] < 0) {
+						chunk_ok[c] = 0;
+						return;
+					}
+					chunk_tris[c].push_back(polygon[0]);
+					chunk_tris[c].push_back(polygon[k]);
+					chunk_tris[c].push_back(polygon[k + 1]);
+				}
+			}
+		}
+	});
+
+	size_t total = 0;
+	for (int c = 0; c < num_chunks; c++) {
+		if (!chunk_ok[c])
+			return false;
+		total += chunk_tris[c].size();
+	}
+	triangle_data.reserve(total);
+	for (auto &tris : chunk_tris)
+		triangle_data.insert(triangle_data.end(), tris.begin(), tris.end());
+	return true;
+} // end parseOBJ
+
+
+// PLY property types
+enum class PlyType { int8, uint8, int16, uint16, int32, uint32, float32, float64, none };
+
+static PlyType plyType(const string &name) {
+	if (name == "char" || name == "int8") return PlyType::int8;
+	if (name == "uchar" || name == "uint8") return PlyType::uint8;
+	if (name == "short" || name == "int16") return PlyType::int16;
+	if (name == "ushort" || name == "uint16") return PlyType::uint16;
+	if (name == "int" || name == "int32") return PlyType::int32;
+	if (name == "uint" || name == "uint32") return PlyType::uint32;
+	if (name == "float" || name == "float32") return PlyType::float32;
+	if (name == "double" || name == "float64") return PlyType::float64;
+	return PlyType::none;
+}
+
+static int plySize(PlyType type) {
+	static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+	return sizes[static_cast<int>(type)];
+}
+
+// Little endian value at p
+static double plyRead(const char *p, PlyType type) {
+	switch (type) {
+	case PlyType::int8: { int8_t v; std::memcpy(&v, p, 1); return v; }
+	case PlyType::uint8: { uint8_t v; std::memcpy(&v, p, 1); return v; }
+	case PlyType::int16: { int16_t v; std::memcpy(&v, p, 2); return v; }
+	case PlyType::uint16: { uint16_t v; std::memcpy(&v, p, 2); return v; }
+	case PlyType::int32: { int32_t v; std::memcpy(&v, p, 4); return v; }
+	case PlyType::uint32: { uint32_t v; std::memcpy(&v, p, 4); return v; }
+	case PlyType::float32: { float v; std::memcpy(&v, p, 4); return v; }
+	case PlyType::float64: { double v; std::memcpy(&v, p, 8); return v; }
+	default: return 0;
+	}
+}
+
+struct PlyProperty {
+	string name;
+	PlyType type;
+	PlyType count_type = PlyType::none;     // set for list properties
+};
+
+struct PlyElement {
+	string name;
+	size_t count = 0;
+	vector<PlyProperty> props;
+};
+
+
+//---PLY, ascii or binary little endian----------------------------------------
+// Binary vertex records have a fixed size and are converted in parallel
+bool TriangleMesh::parsePLY(const char *begin, const char *end) {
+	// Header
+	const char *p = begin;
+	bool binary = false;
+	vector<PlyElement> elements;
+	for (bool first = true;; first = false) {
+		if (p >= end)
+			return false;
+		const char *line_end = nextLine(p, end);
+		istringstream line(string(p, line_end));
+		p = line_end;
+
+		string word;
+		line >> word;
+		if (first && word != "ply")
+			return false;
+		if (word == "format") {
+			string format;
+			line >> format;
+			if (format == "binary_little_endian")
+				binary = true;
+			else if (format != "ascii") {
+				cerr << "Only ascii and binary little endian PLY files are supported" << endl;
+				return false;
+			}
+		}
+		else if (word == "element") {
+			PlyElement element;
+			if (!(line >> element.name >> element.count))
+				return false;
+			elements.push_back(element);
+		}
+		else if (word == "property" && !elements.empty()) {
+			PlyProperty prop;
+			string type;
+			line >> type;
+			if (type == "list") {
+				string count_type;
+				line >> count_type >> type;
+				prop.count_type = plyType(count_type);
+				if (prop.count_type == PlyType::none)
+					return false;
+			}
+			prop.type = plyType(type);
+			line >> prop.name;
+			if (prop.type == PlyType::none)
+				return false;
+			elements.back().props.push_back(prop);
+		}
+		else if (word == "end_header")
+			break;
+	}
+
+	// Reads one value of the body, ascii values are separated by white space
+	bool ok = true;
+	auto value = [&](PlyType type) -> double {
+		if (binary) {
+			if (p + plySize(type) > end) {
+				ok = false;
+				return 0;
+			}
+			double v = plyRead(p, type);
+			p += plySize(type);
+			return v;
+		}
+		char *e;
+		double v = std::strtod(p, &e);
+		if (e == p)
+			ok = false;
+		p = e;
+		return v;
+	};
+
+	for (const auto &element : elements) {
+		if (element.name == "vertex") {
+			int axis[3] = { -1, -1, -1 };
+			bool fixed = true;
+			size_t stride = 0;
+			vector<size_t> offset;
+			for (int i = 0; i < element.props.size(); i++) {
+				const PlyProperty &prop = element.props[i];
+				if (prop.name == "x") axis[0] = i;
+				if (prop.name == "y") axis[1] = i;
+				if (prop.name == "z") axis[2] = i;
+				fixed = fixed && prop.count_type == PlyType::none;
+				offset.push_back(stride);
+				stride += plySize(prop.type);
+			}
+			if (axis[0] < 0 || axis[1] < 0 || axis[2] < 0)
+				return false;
+			vertex_data.resize(element.count);
+
+			if (binary && fixed) {
+				if (p + element.count * stride > end)
+					return false;
+				const char *data = p;
+				uint32_t num_threads = element.count < (1 << 16) ? 1 : std::max(1u, std::thread::hardware_concurrency());
+				size_t range = (element.count + num_threads - 1) / num_threads;
+				vector<std::thread> threads;
+				for (uint32_t t = 0; t < num_threads; t++) {
+					threads.push_back(std::thread([&, t]() {
+						size_t last = std::min(element.count, (t + 1) * range);
+						for (size_t v = t * range; v < last; v++) {
+							const char *record = data + v * stride;
+							for (int a = 0; a < 3; a++)
+								vertex_data[v][a] = plyRead(record + offset[axis[a]], element.props[axis[a]].type);
+						}
+					}));
+				}
+				for (auto &thread : threads)
+					thread.join();
+				p += element.count * stride;
+				continue;
+			}
+
+			for (size_t v = 0; v < element.count && ok; v++) {
+				for (int i = 0; i < element.props.size(); i++) {
+					const PlyProperty &prop = element.props[i];
+					int count = prop.count_type == PlyType::none ? 1 : value(prop.count_type);
+					for (int k = 0; k < count; k++) {
+						double x = value(prop.type);
+						for (int a = 0; a < 3; a++) {
+							if (axis[a] == i)
+								vertex_data[v][a] = x;
+						}
+					}
+				}
+			}
+		}
+		else {
+			// Faces are fanned into triangles, every other element is skipped
+			vector<int64_t> polygon;
+			for (size_t f = 0; f < element.count && ok; f++) {
+				for (const auto &prop : element.props) {
+					bool indices = element.name == "face" && (prop.name == "vertex_indices" || prop.name == "vertex_index");
+					int count = prop.count_type == PlyType::none ? 1 : value(prop.count_type);
+					polygon.clear();
+					for (int k = 0; k < count; k++) {
+						double x = value(prop.type);
+						if (indices)
+							polygon.push_back(x);
+					}
+					for (int k = 1; k + 1 < polygon.size(); k++) {
+						triangle_data.push_back(polygon[0]);
+						triangle_data.push_back(polygon[k]);
+						triangle_data.push_back(polygon[k + 1]);
+					}
+				}
+			}
+		}
+		if (!ok)
+			return false;
+	}
+	return true;
+} // end parsePLY
+
+
+void TriangleMesh::buildBVH() {
+	vector<glm::vec3> tri_min(num_triangles), tri_max(num_triangles);
+	for (int i = 0; i < num_triangles; i++) {
+		const glm::vec3 &a = vertex_data[triangle_data[3 * i]];
+		const glm::vec3 &b = vertex_data[triangle_data[3 * i + 1]];
+		const glm::vec3 &c = vertex_data[triangle_data[3 * i + 2]];
+		tri_min[i] = glm::min(a, glm::min(b, c));
+		tri_max[i] = glm::max(a, glm::max(b, c));
+	}
+
+	vector<uint32_t> order;
+	::buildBVH(tri_min, tri_max, 4, node_data, order);
+	num_nodes = node_data.size();
+
+	// Triangles in leaf order
+	vector<uint32_t> sorted(triangle_data.size());
+	for (int i = 0; i < num_triangles; i++)
+		std::memcpy(&sorted[3 * i], &triangle_data[3 * order[i]], 3 * sizeof(uint32_t));
+	triangle_data.swap(sorted);
+} // end buildBVH
+
+
+//---Binary cache----------------------------------------------------------------
+bool TriangleMesh::mapCache(const string &cache_path) {
+	size_t size;
+#ifndef _WIN32
+	int fd = ::open(cache_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(header_bytes)) {
+		close(fd);
+		return false;
+	}
+	size = st.st_size;
+	void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		return false;
+	mapping = static_cast<const uint8_t*>(m);
+#else
+	ifstream in(cache_path, ios::binary | ios::ate);
+	if (!in)
+		return false;
+	size = in.tellg();
+	fallback.resize(size);
+	in.seekg(0);
+	in.read(reinterpret_cast<char*>(fallback.data()), size);
+	if (!in || size < header_bytes)
+		return false;
+	mapping = fallback.data();
+#endif
+	mapping_size = size;
+
+	int32_t counts[4];
+	std::memcpy(counts, mapping + 4, sizeof(counts));
+	bool ok = std::memcmp(mapping, cache_magic, 4) == 0 && counts[0] > 0 && counts[1] > 0 && counts[2] > 0 &&
+		counts[3] == sizeof(BVHNode) && nodeOffset(counts[0], counts[1]) + counts[2] * sizeof(BVHNode) <= size;
+
+	// A corrupt file must not send the traversals outside the arrays
+	if (ok) {
+		const uint32_t *tri = reinterpret_cast<const uint32_t*>(mapping + header_bytes + counts[0] * sizeof(glm::vec3));
+		for (size_t k = 0; k < 3 * static_cast<size_t>(counts[1]) && ok; k++)
+			ok = tri[k] < static_cast<uint32_t>(counts[0]);
+		if (ok)
+			ok = validTree(reinterpret_cast<const BVHNode*>(mapping + nodeOffset(counts[0], counts[1])), counts[2], counts[1]);
+	}
+
+	if (!ok) {
+		cerr << "Ignoring stale or corrupt mesh cache: " << cache_path << endl;
+#ifndef _WIN32
+		munmap(const_cast<uint8_t*>(mapping), size);
+#endif
+		fallback.clear();
+		mapping = nullptr;
+		return false;
+	}
+
+	num_vertices = counts[0];
+	num_triangles = counts[1];
+	num_nodes = counts[2];
+	vertices = reinterpret_cast<const glm::vec3*>(mapping + header_bytes);
+	triangles = reinterpret_cast<const uint32_t*>(mapping + header_bytes + num_vertices * sizeof(glm::vec3));
+	nodes = reinterpret_cast<const BVHNode*>(mapping + nodeOffset(num_vertices, num_triangles));
+	return true;
+} // end mapCache
+
+
+bool TriangleMesh::writeCache(const string &cache_path) {
+	string tmp_path = cache_path + ".tmp";
+	ofstream out(tmp_path, ios::binary);
+	if (!out)
+		return false;
+
+	char header[header_bytes] = {};
+	int32_t counts[4] = { num_vertices, num_triangles, num_nodes, static_cast<int32_t>(sizeof(BVHNode)) };
+	std::memcpy(header, cache_magic, 4);
+	std::memcpy(header + 4, counts, sizeof(counts));
+	out.write(header, header_bytes);
+	out.write(reinterpret_cast<const char*>(vertices), num_vertices * sizeof(glm::vec3));
+	out.write(reinterpret_cast<const char*>(triangles), num_triangles * 3 * sizeof(uint32_t));
+	size_t at = header_bytes + num_vertices * sizeof(glm::vec3) + num_triangles * 3 * sizeof(uint32_t);
+	static const char pad[32] = {};
+	out.write(pad, nodeOffset(num_vertices, num_triangles) - at);
+	out.write(reinterpret_cast<const char*>(nodes), num_nodes * sizeof(BVHNode));
+	out.close();
+	if (!out)
+		return false;
+
+	// Readers never see a half written cache
+	return std::rename(tmp_path.c_str(), cache_path.c_str()) == 0;
+} // end writeCache
+
+
+//---Ray queries-------------------------------------------------------------------
+namespace {
+
+	/*
+		Watertight ray triangle test (Woop, Benthin and Wald 2013)
+		- Vertices are moved into a frame where the ray runs along +z from the origin,
+		  the edge functions are then 2D and evaluated the same way for every triangle
+		  sharing an edge
+	*/
+	struct RayFrame {
+		glm::vec3 o;
+		glm::vec3 inv_d;
+		int kx, ky, kz;
+		float sx, sy, sz;
+
+		RayFrame(const Ray &r) {
+			o = r.p;
+			inv_d = 1.0f / r.d;
+			glm::vec3 a = glm::abs(r.d);
+			kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+			kx = (kz + 1) % 3;
+			ky = (kx + 1) % 3;
+			if (r.d[kz] < 0)
+				std::swap(kx, ky);
+			sx = r.d[kx] / r.d[kz];
+			sy = r.d[ky] / r.d[kz];
+			sz = 1.0f / r.d[kz];
+		}
+
+		bool triangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, float t_max, float &t) const {
+			glm::vec3 a = v0 - o, b = v1 - o, c = v2 - o;
+			float ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+			float bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+			float cx = c[kx] - sx * c[kz], cy = c[ky] - sy * c[kz];
+
+			float u = cx * by - cy * bx;
+			float v = ax * cy - ay * cx;
+			float w = bx * ay - by * ax;
+
+			// Edges through the ray are decided in double precision
+			if (u == 0.0f || v == 0.0f || w == 0.0f) {
+				u = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+				v = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+				w = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+			}
+
+			if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+				return false;
+			float det = u + v + w;
+			if (det == 0.0f)
+				return false;
+
+			// Distance scaled by det, compared without dividing
+			float T = u * (sz * a[kz]) + v * (sz * b[kz]) + w * (sz * c[kz]);
+			if (det < 0 ? (T >= 0 || T <= t_max * det) : (T <= 0 || T >= t_max * det))
+				return false;
+			t = T / det;
+			return true;
+		}
+	};
+
+	struct StackEntry {
+		int node;
+		float t;
+	};
+}
+
+
+//---Closest hit------------------------------------------------------------------
+bool TriangleMesh::intersect(const Ray &r, float t_max, float &t, glm::vec3 &normal) const {
+	RayFrame ray(r);
+	float t_enter;
+	if (!num_nodes || !nodes[0].hit(ray.o, ray.inv_d, t_max, t_enter))
+		return false;
+
+	StackEntry stack[bvh_max_depth + 8];
+	int depth = 0;
+	int node = 0;
+	int hit = -1;
+
+	for (;;) {
+		const BVHNode &n = nodes[node];
+		if (n.count > 0) {
+			for (int i = n.index; i < n.index + n.count; i++) {
+				const uint32_t *tri = triangles + 3 * i;
+				float ti;
+				if (ray.triangle(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], t_max, ti)) {
+					t_max = ti;
+					hit = i;
+				}
+			}
+		}
+		else {
+			// Nearer child first, the other waits on the stack
+			int near_child = node + 1, far_child = n.index;
+			float near_t, far_t;
+			bool near_hit = nodes[near_child].hit(ray.o, ray.inv_d, t_max, near_t);
+			bool far_hit = nodes[far_child].hit(ray.o, ray.inv_d, t_max, far_t);
+			if (near_hit && far_hit) {
+				if (far_t < near_t) {
+					std::swap(near_child, far_child);
+					std::swap(near_t, far_t);
+				}
+				stack[depth++] = { far_child, far_t };
+				node = near_child;
+				continue;
+			}
+			if (near_hit || far_hit) {
+				node = near_hit ? near_child : far_child;
+				continue;
+			}
+		}
+
+		// Next waiting node that can still hold a closer hit
+		for (node = -1; depth > 0 && node < 0;) {
+			depth--;
+			if (stack[depth].t <= t_max)
+				node = stack[depth].node;
+		}
+		if (node < 0)
+			break;
+	}
+
+	if (hit < 0)
+		return false;
+
+	const uint32_t *tri = triangles + 3 * hit;
+	t = t_max;
+	normal = glm::normalize(glm::cross(vertices[tri[1]] - vertices[tri[0]], vertices[tri[2]] - vertices[tri[0]]));
+	return true;
+} // end intersect
+
+
+//---Any hit------------------------------------------------------------------------
+bool TriangleMesh::occluded(const Ray &r, float t_max) const {
+	RayFrame ray(r);
+	float t_enter;
+	if (!num_nodes || !nodes[0].hit(ray.o, ray.inv_d, t_max, t_enter))
+		return false;
+
+	int stack[bvh_max_depth + 8];
+	int depth = 0;
+	stack[depth++] = 0;
+
+	while (depth > 0) {
+		const BVHNode &n = nodes[stack[--depth]];
+		if (n.count > 0) {
+			for (int i = n.index; i < n.index + n.count; i++) {
+				const uint32_t *tri = triangles + 3 * i;
+				float t;
+				if (ray.triangle(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], t_max, t))
+					return true;
+			}
+			continue;
+		}
+
+		int left = &n - nodes + 1;
+		if (nodes[n.index].hit(ray.o, ray.inv_d, t_max, t_enter))
+			stack[depth++] = n.index;
+		if (nodes[left].hit(ray.o, ray.inv_d, t_max, t_enter))
+			stack[depth++] = left;
+	}
+	return false;
+} // end occluded
+
+
+//---Registry------------------------------------------------------------------------
+MeshCache &MeshCache::instance() {
+	static MeshCache cache;
+	return cache;
+}
+
+TriangleMesh *MeshCache::get(const string &path) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	TriangleMesh *&mesh = meshes[path];
+	if (!mesh)
+		mesh = new TriangleMesh(path);
+	return mesh;
+}
+
+
+//---Mesh scene object----------------------------------------------------------------
+bool Mesh::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+	float t;
+	if (!geometry || !geometry->intersect(Ray(ray.p - position, ray.d), std::numeric_limits<float>::infinity(), t, normal))
+		return false;
+	point = ray.p + ray.d * t;
+	return true;
+}
+
+bool Mesh::getBounds(glm::vec3 &bmin, glm::vec3 &bmax) {
+	if (!geometry || !geometry->isValid())
+		return false;
+	geometry->getBounds(bmin, bmax);
+	bmin += position;
+	bmax += position;
+	return true;
+}
+
+void Mesh::draw() {
+	glm::vec3 bmin, bmax;
+	if (!getBounds(bmin, bmax))
+		return;
+	glm::vec3 center = (bmin + bmax) * 0.5f;
+	glm::vec3 size = bmax - bmin;
+	ofSetColor(diffuseColor);
+	ofDrawBox(glm::vec3(center.x, -center.y, center.z), size.x, size.y, size.z);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "ofApp.h"
+#include "Ray.h"
+#include "SceneObjects.h"
+#include "BVH.h"
+#include <mutex>
+#include <map>
+
+
+/*
+	Triangle Mesh
+	- Indexed triangles of an OBJ or PLY file, polygons are split into fans
+	- Bounding volume hierarchy over the triangles, triangles are stored in leaf order
+	- Ray triangle tests are watertight, rays through shared edges and vertices can't
+	  slip between triangles
+	- The loaded mesh and its hierarchy are written to a binary cache file, later loads
+	  map that file and use it in place
+*/
+class TriangleMesh {
+public:
+	TriangleMesh(const string &path);
+	~TriangleMesh();
+
+	// Closest hit nearer than t_max, normal is the unit geometric normal
+	// (front side counter clockwise)
+	bool intersect(const Ray &r, float t_max, float &t, glm::vec3 &normal) const;
+
+	// Any hit nearer than t_max
+	bool occluded(const Ray &r, float t_max) const;
+
+	bool isValid() const { return num_triangles > 0; }
+	int numTriangles() const { return num_triangles; }
+	void getBounds(glm::vec3 &bmin, glm::vec3 &bmax) const;
+
+private:
+	bool parse(const string &source);
+	bool parseOBJ(const char *begin, const char *end);
+	bool parsePLY(const char *begin, const char *end);
+	void buildBVH();
+	bool mapCache(const string &cache_path);
+	bool writeCache(const string &cache_path);
+
+	string path;
+
+	// Arrays in use, pointing into the vectors below or into the mapped cache file
+	const glm::vec3 *vertices = nullptr;
+	const uint32_t *triangles = nullptr;    // three vertex indices per triangle, in leaf order
+	const BVHNode *nodes = nullptr;
+	int num_vertices = 0;
+	int num_triangles = 0;
+	int num_nodes = 0;
+
+	vector<glm::vec3> vertex_data;
+	vector<uint32_t> triangle_data;
+	vector<BVHNode> node_data;
+
+	const uint8_t *mapping = nullptr;       // mapped cache file
+	size_t mapping_size = 0;
+	vector<uint8_t> fallback;               // whole cache file when mapping isn't available
+};
+
+
+/*
+	Mesh Cache
+	- Shared registry of triangle meshes, one per file, so every Mesh using a file
+	  shares its triangles and hierarchy
+*/
+class MeshCache {
+public:
+	static MeshCache &instance();
+
+	// Mesh of the file at path, loaded on first use
+	TriangleMesh *get(const string &path);
+
+	void setCacheDir(const string &dir) { cache_dir = dir; }
+	string getCacheDir() { return cache_dir; }
+
+private:
+	MeshCache() {}
+
+	string cache_dir = "../../cache/";
+
+	std::mutex registry_mutex;
+	map<string, TriangleMesh*> meshes;
+};
+
+
+/*
+	Mesh
+	- Triangle mesh of a file placed at position
+	- Ray traced and path traced, the ray marcher has no distance for it
+*/
+class Mesh : public SceneObject {
+public:
+	Mesh(const string &path, glm::vec3 p, ofColor diffuse, float power) {
+		position = p;
+		diffuseColor = diffuse;
+		this->power = power;
+		type = ObjectType::mesh;
+		geometry = MeshCache::instance().get(path);
+	}
+	Mesh() { type = ObjectType::mesh; }
+
+	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax);
+	void draw();
+
+	TriangleMesh *geometry = nullptr;
+}; // end class Mesh
@@ -0,0 +1,276 @@
+#include "ofApp.h"
+#include "PathGuide.h"
+
+
+// Point of the (cos theta, phi) square of a unit direction
+static glm::vec2 dirToSquare(const glm::vec3 &d) {
+	float phi = std::atan2(d.y, d.x);
+	if (phi < 0.0f)
+		phi += glm::two_pi<float>();
+	return glm::vec2(glm::clamp((d.z + 1.0f) * 0.5f, 0.0f, 1.0f), glm::clamp(phi * glm::one_over_two_pi<float>(), 0.0f, 1.0f));
+}
+
+static glm::vec3 squareToDir(const glm::vec2 &q) {
+	float cos_theta = 2.0f * q.x - 1.0f;
+	float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+	float phi = glm::two_pi<float>() * q.y;
+	return glm::vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+// Quadrant of q in its node, q is moved into the quadrant's own unit square
+static int descend(glm::vec2 &q) {
+	int cx = q.x >= 0.5f ? 1 : 0;
+	int cy = q.y >= 0.5f ? 1 : 0;
+	q = glm::min(q * 2.0f - glm::vec2(cx, cy), glm::vec2(1.0f));
+	return cx + 2 * cy;
+}
+
+static void atomicAdd(std::atomic<float> &a, float v) {
+	float current = a.load(std::memory_order_relaxed);
+	while (!a.compare_exchange_weak(current, current + v, std::memory_order_relaxed))
+		;
+}
+
+
+/*
+	DTree ==========================================================================================
+*/
+
+DTree::Node::Node() {
+	for (int i = 0; i < 4; i++) {
+		sum[i].store(0.0f, std::memory_order_relaxed);
+		child[i] = -1;
+	}
+}
+
+DTree::Node::Node(const Node &other) {
+	*this = other;
+}
+
+DTree::Node &DTree::Node::operator=(const Node &other) {
+	for (int i = 0; i < 4; i++) {
+		sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		child[i] = other.child[i];
+	}
+	return *this;
+}
+
+
+DTree::DTree() : samples(0) {
+	nodes.emplace_back();
+}
+
+DTree::DTree(const DTree &other) : nodes(other.nodes), samples(other.samples.load()) {}
+
+DTree &DTree::operator=(const DTree &other) {
+	nodes = other.nodes;
+	samples = other.samples.load();
+	return *this;
+}
+
+
+float DTree::total() const {
+	const Node &root = nodes[0];
+	return root.sum[0].load(std::memory_order_relaxed) + root.sum[1].load(std::memory_order_relaxed)
+		+ root.sum[2].load(std::memory_order_relaxed) + root.sum[3].load(std::memory_order_relaxed);
+}
+
+
+void DTree::record(const glm::vec3 &dir, float value) {
+	glm::vec2 q = dirToSquare(dir);
+	int node = 0;
+	for (;;) {
+		int c = descend(q);
+		atomicAdd(nodes[node].sum[c], value);
+		if (nodes[node].child[c] < 0)
+			break;
+		node = nodes[node].child[c];
+	}
+	samples++;
+} // end record
+
+
+//---Draw a direction by descending the quadrants by their energy------------
+// The quadrant is picked as a column then a row, and each pick rescales its
+// coordinate of u so the same two numbers carry on down the tree
+glm::vec3 DTree::sample(glm::vec2 u) const {
+	glm::vec2 origin(0.0f);
+	float size = 1.0f;
+	int node = 0;
+
+	for (;;) {
+		const Node &n = nodes[node];
+		float s[4];
+		for (int i = 0; i < 4; i++)
+			s[i] = n.sum[i].load(std::memory_order_relaxed);
+		float total = s[0] + s[1] + s[2] + s[3];
+		if (total <= 0.0f)
+			break;
+
+		float p_left = (s[0] + s[2]) / total;
+		int cx = u.x < p_left ? 0 : 1;
+		u.x = cx == 0 ? u.x / p_left : (u.x - p_left) / (1.0f - p_left);
+
+		float column = s[cx] + s[cx + 2];
+		float p_low = s[cx] / column;
+		int cy = u.y < p_low ? 0 : 1;
+		u.y = cy == 0 ? u.y / p_low : (u.y - p_low) / (1.0f - p_low);
+		u = glm::clamp(u, glm::vec2(0.0f), glm::vec2(0.99999994f));
+
+		size *= 0.5f;
+		origin += glm::vec2(cx, cy) * size;
+		int c = cx + 2 * cy;
+		if (n.child[c] < 0)
+			break;
+		node = n.child[c];
+	}
+
+	// Uniform within the quadrant reached
+	return squareToDir(origin + u * size);
+} // end sample
+
+
+float DTree::pdf(const glm::vec3 &dir) const {
+	glm::vec2 q = dirToSquare(dir);
+	float p = 1.0f;
+	int node = 0;
+	for (;;) {
+		const Node &n = nodes[node];
+		float total = n.sum[0].load(std::memory_order_relaxed) + n.sum[1].load(std::memory_order_relaxed)
+			+ n.sum[2].load(std::memory_order_relaxed) + n.sum[3].load(std::memory_order_relaxed);
+		if (total <= 0.0f)
+			break;
+		int c = descend(q);
+		p *= 4.0f * n.sum[c].load(std::memory_order_relaxed) / total;
+		if (n.child[c] < 0 || p <= 0.0f)
+			break;
+		node = n.child[c];
+	}
+
+	// The square has area 1 and the sphere 4 pi
+	return p / (4.0f * glm::pi<float>());
+} // end pdf
+
+
+//---New structure following the recorded energy-------------------------------
+// Built breadth first, so a node limit cuts off the finest levels
+void DTree::refine(const DTree &recorded, float fraction, size_t max_nodes) {
+	float limit = fraction * recorded.total();
+
+	struct Pending {
+		int node;           // node of this tree
+		int from;           // node of recorded over the same square, -1 past its leaves
+		float energy;       // recorded energy of the square
+		int depth;
+	};
+
+	nodes.clear();
+	nodes.emplace_back();
+	samples = 0;
+
+	vector<Pending> queue;
+	queue.push_back({ 0, 0, recorded.total(), 1 });
+	for (size_t head = 0; head < queue.size(); head++) {
+		Pending p = queue[head];
+		for (int c = 0; c < 4; c++) {
+			// Past the recorded leaves the energy is spread evenly
+			float e = p.from >= 0 ? recorded.nodes[p.from].sum[c].load(std::memory_order_relaxed) : p.energy * 0.25f;
+			int from = p.from >= 0 ? recorded.nodes[p.from].child[c] : -1;
+			if (p.depth >= max_depth || e <= limit || nodes.size() >= max_nodes)
+				continue;
+
+			int child = nodes.size();
+			nodes.emplace_back();
+			nodes[p.node].child[c] = child;
+			queue.push_back({ child, from, e, p.depth + 1 });
+		}
+	}
+} // end refine
+
+
+/*
+	PathGuide ======================================================================================
+*/
+
+void PathGuide::reset(const glm::vec3 &box_min, const glm::vec3 &box_max) {
+	bmin = box_min;
+	bmax = glm::max(box_max, box_min + glm::vec3(1e-3f));
+	nodes.clear();
+	leaves.clear();
+	nodes.push_back({ 0, -1, 0 });
+	leaves.emplace_back();
+}
+
+
+GuideLeaf *PathGuide::leaf(const glm::vec3 &p) {
+	if (nodes.empty())
+		return nullptr;
+
+	glm::vec3 q = (glm::clamp(p, bmin, bmax) - bmin) / (bmax - bmin);
+	int node = 0;
+	while (nodes[node].child >= 0) {
+		int axis = nodes[node].axis;
+		if (q[axis] < 0.5f) {
+			q[axis] *= 2.0f;
+			node = nodes[node].child;
+		}
+		else {
+			q[axis] = q[axis] * 2.0f - 1.0f;
+			node = nodes[node].child + 1;
+		}
+	}
+	return &leaves[nodes[node].leaf];
+}
+
+
+size_t PathGuide::memoryUsage() const {
+	size_t n = 0;
+	for (const auto &leaf : leaves)
+		n += leaf.sampling.numNodes() + leaf.building.numNodes();
+	return n * sizeof(DTree::Node) + nodes.size() * sizeof(Node) + leaves.size() * sizeof(GuideLeaf);
+}
+
+
+//---Learn from the pass that just finished------------------------------------
+void PathGuide::refine(uint32_t pass) {
+	// Sample next from what this pass recorded
+	for (auto &leaf : leaves)
+		leaf.sampling = leaf.building;
+
+	// Split leaves with enough samples, the halves share their parent's trees and samples
+	float threshold = split_count * std::sqrt(std::pow(2.0f, static_cast<float>(pass)));
+	vector<int> stack;
+	for (int i = 0; i < nodes.size(); i++) {
+		if (nodes[i].child < 0)
+			stack.push_back(i);
+	}
+	while (!stack.empty() && memoryUsage() < memory_budget) {
+		int node = stack.back();
+		stack.pop_back();
+		int l = nodes[node].leaf;
+		if (leaves[l].building.numSamples() <= threshold)
+			continue;
+
+		leaves[l].building.setNumSamples(leaves[l].building.numSamples() / 2);
+		GuideLeaf half = leaves[l];
+		leaves.push_back(half);
+
+		int axis = (nodes[node].axis + 1) % 3;
+		int child = nodes.size();
+		nodes.push_back({ axis, -1, l });
+		nodes.push_back({ axis, -1, static_cast<int>(leaves.size()) - 1 });
+		nodes[node].child = child;
+		stack.push_back(child);
+		stack.push_back(child + 1);
+	}
+
+	// Recording trees follow the recorded energy, sharing what the budget leaves
+	size_t fixed = nodes.size() * sizeof(Node) + leaves.size() * sizeof(GuideLeaf);
+	size_t sampling_nodes = 0;
+	for (const auto &leaf : leaves)
+		sampling_nodes += leaf.sampling.numNodes();
+	size_t spare = memory_budget > fixed + sampling_nodes * sizeof(DTree::Node) ? memory_budget - fixed - sampling_nodes * sizeof(DTree::Node) : 0;
+	size_t max_nodes = std::max<size_t>(1, spare / (sizeof(DTree::Node) * leaves.size()));
+	for (auto &leaf : leaves)
+		leaf.building.refine(leaf.sampling, subdivide_fraction, max_nodes);
+} // end refine
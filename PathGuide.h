@@ -0,0 +1,103 @@
+#pragma once
+
+#include "ofApp.h"
+#include <atomic>
+
+
+/*
+	Directional Quadtree
+	- Distribution over the sphere of directions, a quadtree over the square of
+	  (cos theta, phi), which maps equal areas to equal solid angles
+	- Nodes hold the energy recorded in each of their four quadrants, directions are
+	  drawn in proportion to it
+	- Recording is lock free, the render threads add to the sums atomically
+*/
+class DTree {
+public:
+	DTree();
+	DTree(const DTree &other);
+	DTree &operator=(const DTree &other);
+
+	// Add value to the quadrants containing the unit direction dir
+	void record(const glm::vec3 &dir, float value);
+
+	// Direction drawn in proportion to the energy, u is uniform in [0, 1)^2
+	glm::vec3 sample(glm::vec2 u) const;
+
+	// Solid angle pdf of sample
+	float pdf(const glm::vec3 &dir) const;
+
+	float total() const;
+	uint32_t numSamples() const { return samples; }
+	void setNumSamples(uint32_t n) { samples = n; }
+	size_t numNodes() const { return nodes.size(); }
+
+	// Rebuild the structure from the energy of recorded with its sums cleared, quadrants
+	// holding more than fraction of the energy are subdivided, up to max_nodes nodes
+	void refine(const DTree &recorded, float fraction, size_t max_nodes);
+
+	static const int max_depth = 20;
+
+	struct Node {
+		Node();
+		Node(const Node &other);
+		Node &operator=(const Node &other);
+
+		std::atomic<float> sum[4];
+		int32_t child[4];       // -1 for a leaf quadrant
+	};
+
+private:
+	vector<Node> nodes;
+	std::atomic<uint32_t> samples;
+};
+
+
+/*
+	Guide Leaf
+	- Directional distributions of one region of space
+*/
+struct GuideLeaf {
+	DTree sampling;     // what the passes before learned, directions are drawn from it
+	DTree building;     // records the current pass
+};
+
+
+/*
+	Path Guide
+	- Spatial-directional tree of incident radiance (Mueller, Gross and Novak 2017,
+	  "Practical Path Guiding for Efficient Light-Transport Simulation")
+	- A binary tree splits space at the middle of alternating axes, every leaf has its
+	  own directional quadtrees
+	- After each training pass the recorded trees become the sampling trees, leaves with
+	  many samples are split and the new recording trees follow the recorded energy
+*/
+class PathGuide {
+public:
+	void reset(const glm::vec3 &bmin, const glm::vec3 &bmax);
+	bool empty() const { return nodes.empty(); }
+
+	// Leaf of the region containing p, points outside the bounds use the nearest region
+	GuideLeaf *leaf(const glm::vec3 &p);
+
+	// End of training pass pass, which took 2^pass samples per pixel
+	void refine(uint32_t pass);
+
+	size_t numLeaves() const { return leaves.size(); }
+	size_t memoryUsage() const;
+
+	float split_count = 12000.0f;       // leaves split after split_count * sqrt(2^pass) samples
+	float subdivide_fraction = 0.01f;   // quadrants with more of the energy are subdivided
+	size_t memory_budget = 64 << 20;    // bytes of the quadtrees
+
+private:
+	struct Node {
+		int axis;
+		int child;          // children are child and child + 1, -1 for a leaf
+		int leaf;           // leaf index of a leaf node
+	};
+
+	vector<Node> nodes;
+	vector<GuideLeaf> leaves;
+	glm::vec3 bmin, bmax;
+};
@@ -0,0 +1,134 @@
+#include "ofApp.h"
+#include "PhotonMap.h"
+#include <algorithm>
+#include <chrono>
+
+
+void PhotonMap::clear() {
+	photons.clear();
+	queries = 0;
+	query_ns = 0;
+}
+
+
+void PhotonMap::add(const glm::vec3 &p, const glm::vec3 &power, const glm::vec3 &dir, uint8_t flags) {
+	Photon photon;
+	for (int i = 0; i < 3; i++) {
+		photon.p[i] = p[i];
+		photon.power[i] = power[i];
+		photon.dir[i] = static_cast<int8_t>(std::round(glm::clamp(dir[i], -1.0f, 1.0f) * 127.0f));
+	}
+	photon.axis_flags = flags;
+	photons.push_back(photon);
+}
+
+
+void PhotonMap::append(const PhotonMap &other) {
+	photons.insert(photons.end(), other.photons.begin(), other.photons.end());
+}
+
+
+//---Median split kd-tree in place------------------------------------------
+void PhotonMap::build() {
+	build(0, photons.size());
+}
+
+void PhotonMap::build(int begin, int end) {
+	if (end - begin <= 1) {
+		if (begin < end)
+			photons[begin].axis_flags &= ~3;
+		return;
+	}
+
+	// Split the longest side of the range's bounds at its median photon
+	glm::vec3 bmin(std::numeric_limits<float>::infinity());
+	glm::vec3 bmax = -bmin;
+	for (int i = begin; i < end; i++) {
+		bmin = glm::min(bmin, photons[i].position());
+		bmax = glm::max(bmax, photons[i].position());
+	}
+	glm::vec3 extent = bmax - bmin;
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+	int mid = (begin + end) / 2;
+	std::nth_element(photons.begin() + begin, photons.begin() + mid, photons.begin() + end,
+		[axis](const Photon &a, const Photon &b) { return a.p[axis] < b.p[axis]; });
+	photons[mid].axis_flags = (photons[mid].axis_flags & ~3) | axis;
+
+	build(begin, mid);
+	build(mid + 1, end);
+} // end build
+
+
+//---k nearest photons, heap is a max heap on the squared distance-----------
+// r2 shrinks to the kth distance once k photons are found
+void PhotonMap::gather(const glm::vec3 &p, int begin, int end, int k, uint8_t mask, float &r2, vector<std::pair<float, int>> &heap) const {
+	if (begin >= end)
+		return;
+
+	int mid = (begin + end) / 2;
+	const Photon &photon = photons[mid];
+	int axis = photon.axis();
+	float d = p[axis] - photon.p[axis];
+
+	// Near side first, the far side only if the split plane is within range
+	if (d < 0.0f) {
+		gather(p, begin, mid, k, mask, r2, heap);
+		if (d * d < r2)
+			gather(p, mid + 1, end, k, mask, r2, heap);
+	}
+	else {
+		gather(p, mid + 1, end, k, mask, r2, heap);
+		if (d * d < r2)
+			gather(p, begin, mid, k, mask, r2, heap);
+	}
+
+	if (!(photon.flags() & mask))
+		return;
+	glm::vec3 v = photon.position() - p;
+	float dist2 = glm::dot(v, v);
+	if (dist2 >= r2)
+		return;
+
+	heap.push_back(std::make_pair(dist2, mid));
+	std::push_heap(heap.begin(), heap.end());
+	if (heap.size() > k) {
+		std::pop_heap(heap.begin(), heap.end());
+		heap.pop_back();
+	}
+	if (heap.size() == k)
+		r2 = heap.front().first;
+} // end gather
+
+
+//---Density estimate of the irradiance--------------------------------------
+// Photons are cone filtered (Jensen), weight 1 - d / r normalized by 1 - 2 / 3,
+// photons arriving at the back of the surface don't count
+glm::vec3 PhotonMap::irradiance(const glm::vec3 &p, const glm::vec3 &n, int k, float max_radius, uint8_t mask) const {
+	if (photons.empty() || k <= 0)
+		return glm::vec3(0.0f);
+
+	auto start = std::chrono::steady_clock::now();
+
+	static thread_local vector<std::pair<float, int>> heap;
+	heap.clear();
+	float r2 = max_radius * max_radius;
+	gather(p, 0, photons.size(), k, mask, r2, heap);
+
+	glm::vec3 E(0.0f);
+	if (!heap.empty()) {
+		float r = std::sqrt(r2);
+		for (const auto &entry : heap) {
+			const Photon &photon = photons[entry.second];
+			if (glm::dot(photon.direction(), n) >= 0.0f)
+				continue;
+			float w = 1.0f - std::sqrt(entry.first) / r;
+			E += w * glm::vec3(photon.power[0], photon.power[1], photon.power[2]);
+		}
+		E /= (1.0f - 2.0f / 3.0f) * glm::pi<float>() * r2;
+	}
+
+	queries++;
+	query_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	return E;
+} // end irradiance
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ofApp.h"
+#include <atomic>
+
+
+/*
+	Photon
+	- 28 byte record of a photon stored on a diffuse surface
+	- The low two bits of axis_flags are the kd-tree split axis, the rest are PhotonMap flags
+*/
+struct Photon {
+	float p[3];
+	float power[3];
+	int8_t dir[3];          // incoming direction in 1/127 steps
+	uint8_t axis_flags;
+
+	glm::vec3 position() const { return glm::vec3(p[0], p[1], p[2]); }
+	glm::vec3 direction() const { return glm::vec3(dir[0], dir[1], dir[2]) / 127.0f; }
+	int axis() const { return axis_flags & 3; }
+	uint8_t flags() const { return axis_flags & ~3; }
+};
+
+
+/*
+	Photon Map
+	- Photons in one flat array ordered as a kd-tree: the photon at the middle of a range
+	  splits it, the halves before and after it are its subtrees
+	- Density estimates gather the k nearest photons within a radius with a cone filter
+*/
+class PhotonMap {
+public:
+	// How a stored photon got to its surface
+	static const uint8_t direct = 4;      // straight from a light
+	static const uint8_t caustic = 8;     // through mirrors and glass only
+	static const uint8_t indirect = 16;   // after a diffuse bounce
+	static const uint8_t all = direct | caustic | indirect;
+
+	void clear();
+	void add(const glm::vec3 &p, const glm::vec3 &power, const glm::vec3 &dir, uint8_t flags);
+	void append(const PhotonMap &other);
+
+	// Order the photons into the kd-tree, call after the last add
+	void build();
+
+	size_t size() const { return photons.size(); }
+
+	// Irradiance at p on the side n faces, from the k nearest photons within max_radius
+	// whose flags are in mask
+	glm::vec3 irradiance(const glm::vec3 &p, const glm::vec3 &n, int k, float max_radius, uint8_t mask) const;
+
+	// Query statistics since the last clear
+	uint64_t numQueries() const { return queries; }
+	double queryMillis() const { return query_ns * 1e-6; }
+
+private:
+	void build(int begin, int end);
+	void gather(const glm::vec3 &p, int begin, int end, int k, uint8_t mask, float &r2, vector<std::pair<float, int>> &heap) const;
+
+	vector<Photon> photons;
+
+	mutable std::atomic<uint64_t> queries{0};
+	mutable std::atomic<uint64_t> query_ns{0};
+};
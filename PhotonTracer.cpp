@@ -0,0 +1,176 @@
+#include "ofApp.h"
+#include "PhotonTracer.h"
+#include <thread>
+#include <atomic>
+
+
+// Sampler stream of the photon pass, photon i is sample i
+static const uint32_t photon_stream = 0xfffffff0u;
+
+
+//---Lights that emit photons and their power----------------------------
+// Powers are in the radiance units of the path tracer. Phong lights a point with
+// intensity / d^2, the same as a radiant intensity of pi * intensity
+void PhotonTracer::buildEmitters() {
+	emitters.clear();
+	cdf.clear();
+	total_power = 0.0f;
+
+	const float pi = glm::pi<float>();
+	for (int i = 0; i < rt.light_refs.size(); i++)
+		emitters.push_back({ 0, i, 4.0f * pi * pi * rt.light_refs[i]->intensity });
+	for (int i = 0; i < rt.cone_refs.size(); i++) {
+		float cos_max = glm::radians(rt.cone_refs[i]->angle_cutoff);
+		if (cos_max < 1.0f)
+			emitters.push_back({ 1, i, pi * rt.cone_refs[i]->intensity * glm::two_pi<float>() * (1.0f - std::max(cos_max, 0.0f)) });
+	}
+	for (int i = 0; i < rt.scene.numLuminaires(); i++) {
+		glm::vec3 center;
+		float radius;
+		int id;
+		rt.scene.getLuminaire(i, center, radius, id);
+		emitters.push_back({ 2, i, 4.0f * pi * pi * radius * radius * rt.scene.materials[id].emission });
+	}
+
+	for (const auto &e : emitters) {
+		total_power += std::max(e.power, 0.0f);
+		cdf.push_back(total_power);
+	}
+} // end buildEmitters
+
+
+//---Emit photon i and store its diffuse hits------------------------------
+void PhotonTracer::emit(uint32_t i, Sampler &sampler, PhotonMap &global, PhotonMap &caustic) {
+	sampler.startSample(i);
+
+	// Emitter in proportion to its power
+	float u = sampler.get1D() * total_power;
+	int e = std::min(static_cast<int>(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), static_cast<int>(emitters.size()) - 1);
+	const Emitter &emitter = emitters[e];
+	float pick_pdf = emitter.power / total_power;
+	float count = rt.photon_count;
+
+	Ray r(glm::vec3(0), glm::vec3(0, 0, 1));
+	glm::vec3 power;
+	glm::vec2 v = sampler.get2D();
+	if (emitter.type == 0) { // point light, uniform over the sphere
+		const Light *light = rt.light_refs[emitter.index];
+		r = Ray(light->position, uniformSampleCone(glm::vec3(0, 0, 1), -1.0f, v.x, v.y));
+		power = glm::vec3(4.0f * glm::pi<float>() * glm::pi<float>() * light->intensity / (pick_pdf * count));
+	}
+	else if (emitter.type == 1) { // cone light, uniform in the cone, dimmed by the spot falloff
+		const ConeLight *cone = rt.cone_refs[emitter.index];
+		glm::vec3 axis = glm::normalize(glm::vec3(-cone->dir_vec.x, cone->dir_vec.y, -cone->dir_vec.z));
+		float cos_max = std::max(glm::radians(cone->angle_cutoff), 0.0f);
+		glm::vec3 d = uniformSampleCone(axis, cos_max, v.x, v.y);
+		float spot = std::pow(glm::dot(d, axis), cone->falloff_radius);
+		r = Ray(cone->position, d);
+		power = glm::vec3(glm::pi<float>() * cone->intensity * spot / (uniformConePdf(cos_max) * pick_pdf * count));
+	}
+	else { // luminaire, uniform over its surface, cosine weighted around the normal
+		glm::vec3 center;
+		float radius;
+		int id;
+		rt.scene.getLuminaire(emitter.index, center, radius, id);
+		glm::vec3 normal = uniformSampleCone(glm::vec3(0, 0, 1), -1.0f, v.x, v.y);
+		glm::vec2 w = sampler.get2D();
+		r = Ray(center + normal * (radius + 0.001f), cosineSampleHemisphere(normal, w.x, w.y));
+		power = glm::vec3(emitter.power / (pick_pdf * count));
+	}
+
+	bool specular = false;
+	bool diffuse = false;
+	for (uint32_t bounce = 0; bounce < rt.photon_bounces; bounce++) {
+		Hit hit;
+		if (!rt.scene.intersect(r, hit))
+			break;
+		const Material &m = rt.scene.materials[hit.id];
+		if (m.isLuminaire)
+			break;
+
+		// Same Fresnel split as RayTracer::specularColor
+		bool entering = glm::dot(r.d, hit.normal) < 0;
+		glm::vec3 n = entering ? hit.normal : -hit.normal;
+		FresnelSplit split = fresnelSplit(r.d, n, entering, m.reflectivity, m.transparency, m.ior);
+		float k_local = split.k_local;
+		float k_reflect = split.k_reflect;
+
+		// The incoming photon is stored on any surface with a diffuse part
+		if (k_local > 0.0f) {
+			uint8_t flags = diffuse ? PhotonMap::indirect : (specular ? PhotonMap::caustic : PhotonMap::direct);
+			global.add(hit.point, power, r.d, flags);
+			if (flags == PhotonMap::caustic)
+				caustic.add(hit.point, power, r.d, flags);
+		}
+
+		// Diffuse bounce, mirror or glass picked by their share, the diffuse bounce
+		// survives by the largest albedo channel
+		float pick = sampler.get1D();
+		if (pick < k_local) {
+			glm::vec3 albedo = rt.hitAlbedo(hit);
+			float survive = std::max(albedo.x, std::max(albedo.y, albedo.z));
+			if (sampler.get1D() >= survive)
+				break;
+			power *= albedo / survive;
+			glm::vec2 w = sampler.get2D();
+			r = Ray(hit.point + n * 0.001f, cosineSampleHemisphere(n, w.x, w.y));
+			diffuse = true;
+		}
+		else if (pick < k_local + k_reflect) {
+			r = Ray(hit.point + n * 0.01f, glm::reflect(r.d, n));
+			specular = true;
+		}
+		else {
+			r = Ray(hit.point - n * 0.01f, split.refracted);
+			specular = true;
+		}
+	}
+} // end emit
+
+
+//---Emit the photons on the render threads and build the maps----------------
+void PhotonTracer::trace() {
+	float before_time = ofGetElapsedTimeMillis();
+
+	rt.global_photons.clear();
+	rt.caustic_photons.clear();
+	buildEmitters();
+	if (total_power <= 0.0f || rt.photon_count == 0)
+		return;
+
+	// Chunks of photons are traced into their own maps, joined in order afterwards
+	const uint32_t chunk = 4096;
+	uint32_t num_chunks = (rt.photon_count + chunk - 1) / chunk;
+	vector<PhotonMap> global(num_chunks);
+	vector<PhotonMap> caustic(num_chunks);
+
+	std::atomic<uint32_t> next(0);
+	auto worker = [&]() {
+		Sampler sampler(photon_stream, rt.sampler_seed);
+		for (uint32_t c = next++; c < num_chunks; c = next++) {
+			uint32_t end = std::min(rt.photon_count, (c + 1) * chunk);
+			for (uint32_t i = c * chunk; i < end; i++)
+				emit(i, sampler, global[c], caustic[c]);
+		}
+	};
+
+	vector<std::thread> threads;
+	for (uint32_t t = 0; t < std::max(1u, rt.num_threads); t++)
+		threads.push_back(std::thread(worker));
+	for (auto &thread : threads)
+		thread.join();
+
+	for (uint32_t c = 0; c < num_chunks; c++) {
+		rt.global_photons.append(global[c]);
+		rt.caustic_photons.append(caustic[c]);
+	}
+	float emit_time = ofGetElapsedTimeMillis();
+
+	rt.global_photons.build();
+	rt.caustic_photons.build();
+	float build_time = ofGetElapsedTimeMillis();
+
+	cout << "Photons: " << rt.global_photons.size() << " stored, " << rt.caustic_photons.size() << " caustic, from "
+		<< rt.photon_count << " emitted" << endl;
+	cout << "Photon trace time: " << emit_time - before_time << "ms, kd-tree build time: " << build_time - emit_time << "ms" << endl;
+} // end trace
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ofApp.h"
+#include "RayTracer.h"
+
+
+/*
+	Photon Tracer
+	- Emits photons from the point, cone and luminaire lights in proportion to their
+	  power and follows them through the scene on the render threads
+	- Photon i is sample i of one sampler stream, so the maps don't depend on the
+	  thread count
+	- Every diffuse hit is stored in the global map, hits reached through mirrors and
+	  glass only also go in the caustic map
+*/
+class PhotonTracer {
+public:
+	PhotonTracer(RayTracer &tracer) : rt(tracer) {}
+
+	void trace();
+
+private:
+	struct Emitter {
+		int type;           // 0 point light, 1 cone light, 2 luminaire
+		int index;
+		float power;        // estimated radiant power, picks the emitter
+	};
+
+	void buildEmitters();
+	void emit(uint32_t i, Sampler &sampler, PhotonMap &global, PhotonMap &caustic);
+
+	RayTracer &rt;
+	vector<Emitter> emitters;
+	vector<float> cdf;
+	float total_power = 0.0f;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ofApp.h"
+#include "SceneData.h"
+
+
+/*
+	Pixel Records
+	- What the last render found at every pixel, kept for incremental re-rendering:
+	  the primary hit and a mask of the objects the pixel's rays hit
+	- Object id o is bit o % 64 of the mask, ids sharing a bit only make edits mark
+	  more pixels than they need to
+	- Edits set dirty, RayTracer::renderDirty shades the dirty pixels again
+*/
+struct PixelRecords {
+	void allocate(int w, int h) {
+		width = w;
+		height = h;
+		hits.assign(w * h, Hit());
+		for (auto &hit : hits)
+			hit.id = -1;
+		deps.assign(w * h, 0);
+		traced.assign(w * h, 0);
+		dirty.assign(w * h, 0);
+		valid = false;
+	}
+
+	static uint64_t bit(int id) { return id < 0 ? 0 : 1ull << (id % 64); }
+
+	int width = 0;
+	int height = 0;
+	vector<Hit> hits;           // primary hit, id -1 for background
+	vector<uint64_t> deps;      // objects hit by the pixel's primary and secondary rays
+	vector<uint8_t> traced;     // the primary surface sent reflected or refracted rays
+	vector<uint8_t> dirty;
+
+	bool valid = false;         // the records match frame_key
+	string frame_key;           // algorithm, image size, camera and trace limits of the render
+};
@@ -0,0 +1,102 @@
+#include "ofApp.h"
+#include "PreparedLights.h"
+
+
+void PreparedLights::clear() {
+	px.clear(); py.clear(); pz.clear();
+	intensity.clear(); cone.clear();
+	dx.clear(); dy.clear(); dz.clear();
+	cutoff.clear(); falloff.clear();
+	num_points = 0;
+}
+
+
+//---Pack the lights for this frame---------------------------------
+void PreparedLights::build(const vector<Light*> &lights, const vector<ConeLight*> &cones) {
+	clear();
+
+	for (auto light : lights) {
+		px.push_back(light->position.x);
+		py.push_back(light->position.y);
+		pz.push_back(light->position.z);
+		intensity.push_back(light->intensity);
+		cone.push_back(0.0f);
+		dx.push_back(0.0f); dy.push_back(0.0f); dz.push_back(0.0f);
+		cutoff.push_back(0.0f);
+		falloff.push_back(0.0f);
+	}
+	num_points = lights.size();
+
+	for (auto c : cones) {
+		// Direction vector of light cone, flipped into the render frame
+		glm::vec3 dir = glm::normalize(glm::vec3(-c->dir_vec.x, c->dir_vec.y, -c->dir_vec.z));
+
+		px.push_back(c->position.x);
+		py.push_back(c->position.y);
+		pz.push_back(c->position.z);
+		intensity.push_back(c->intensity);
+		cone.push_back(1.0f);
+		dx.push_back(dir.x); dy.push_back(dir.y); dz.push_back(dir.z);
+
+		// The spotlight test has always compared the cosine against the cutoff in radians
+		cutoff.push_back(glm::radians(c->angle_cutoff));
+		falloff.push_back(c->falloff_radius);
+	}
+} // end build
+
+
+void PreparedLights::add(const PreparedLights &other, int i, float weight) {
+	px.push_back(other.px[i]);
+	py.push_back(other.py[i]);
+	pz.push_back(other.pz[i]);
+	intensity.push_back(other.intensity[i] * weight);
+	cone.push_back(other.cone[i]);
+	dx.push_back(other.dx[i]); dy.push_back(other.dy[i]); dz.push_back(other.dz[i]);
+	cutoff.push_back(other.cutoff[i]);
+	falloff.push_back(other.falloff[i]);
+	if (other.cone[i] == 0.0f)
+		num_points++;
+}
+
+
+//---Shading factors of every light at a point-----------------------
+template <bool Cones>
+void PreparedLights::evaluate(const glm::vec3 &p, const glm::vec3 &n, const glm::vec3 &view, float power, vector<float> &kd, vector<float> &ks) const {
+	int count = size();
+	kd.resize(count);
+	ks.resize(count);
+
+	for (int i = 0; i < count; i++) {
+		// Vector to the light and inverse square intensity
+		float lx = px[i] - p.x;
+		float ly = py[i] - p.y;
+		float lz = pz[i] - p.z;
+		float d2 = lx * lx + ly * ly + lz * lz;
+		float inv_d = 1.0f / std::sqrt(d2);
+		lx *= inv_d; ly *= inv_d; lz *= inv_d;
+		float I = intensity[i] / d2;
+
+		// Lambert and Blinn-Phong angles
+		float lamb = std::max(0.0f, n.x * lx + n.y * ly + n.z * lz);
+		float hx = view.x + lx;
+		float hy = view.y + ly;
+		float hz = view.z + lz;
+		float inv_h = 1.0f / std::sqrt(hx * hx + hy * hy + hz * hz);
+		float spec_cos = std::max(0.0f, (n.x * hx + n.y * hy + n.z * hz) * inv_h);
+
+		// Cone lights only light points inside the cone, falloff only dims the diffuse term
+		float lit = 1.0f;
+		float spot = 1.0f;
+		if (Cones) {
+			float spot_cos = std::abs(lx * dx[i] + ly * dy[i] + lz * dz[i]);
+			lit = cone[i] == 0.0f || spot_cos >= cutoff[i] ? 1.0f : 0.0f;
+			spot = cone[i] == 0.0f ? 1.0f : std::pow(spot_cos, falloff[i]);
+		}
+
+		kd[i] = lit * I * spot * lamb;
+		ks[i] = lit * I * std::pow(spec_cos, power);
+	}
+} // end evaluate
+
+template void PreparedLights::evaluate<true>(const glm::vec3 &, const glm::vec3 &, const glm::vec3 &, float, vector<float> &, vector<float> &) const;
+template void PreparedLights::evaluate<false>(const glm::vec3 &, const glm::vec3 &, const glm::vec3 &, float, vector<float> &, vector<float> &) const;
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ofApp.h"
+#include "LightObjects.h"
+
+
+/*
+	Prepared Lights
+	- Per frame copy of the point and cone lights as structure of arrays, with the
+	  constants phong used to rederive per light and per shading point
+	- Point light i is entry i, cone light j is entry num_points + j
+	- evaluate is written as plain loops over the arrays so the compiler can
+	  vectorize it over batches of lights
+*/
+class PreparedLights {
+public:
+	void build(const vector<Light*> &lights, const vector<ConeLight*> &cones);
+	void clear();
+
+	// Append entry i of other with its intensity scaled by weight
+	void add(const PreparedLights &other, int i, float weight);
+
+	int size() const { return intensity.size(); }
+	bool isCone(int i) const { return cone[i] != 0.0f; }
+	glm::vec3 position(int i) const { return glm::vec3(px[i], py[i], pz[i]); }
+
+	// Diffuse and specular factors of every light at p (intensity, falloff and angle terms),
+	// n and view are unit vectors, the factors are 0 for points outside a cone.
+	// Without Cones the spot terms are left out, only for lights with no cone among them
+	template <bool Cones>
+	void evaluate(const glm::vec3 &p, const glm::vec3 &n, const glm::vec3 &view, float power, vector<float> &kd, vector<float> &ks) const;
+
+	int num_points = 0;
+
+private:
+	vector<float> px, py, pz;
+	vector<float> intensity;
+	vector<float> cone;              // 1 for cone lights, 0 for point lights
+	vector<float> dx, dy, dz;        // unit cone axis, pointing away from the light
+	vector<float> cutoff;            // spot cosine below which a point is unlit
+	vector<float> falloff;           // exponent of the spot cosine
+};
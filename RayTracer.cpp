@@ -3,12 +3,19 @@
 
 #include "ofApp.h"
 #include "RayTracer.h"
+#include "Wavefront.h"
+#include "TileCoordinator.h"
+#include "PhotonTracer.h"
 #include <random>
+#include <thread>
+#include <atomic>
 
 /*
 	Ray tracer functions ===========================================================================
 */
 
+thread_local RayTracer::PixelTrace RayTracer::pixel_trace;
+
 //---Constructor----------------------------------------------------
 RayTracer::RayTracer() {
 	// Allocate image object resolution
@@ -18,10 +25,6 @@ RayTracer::RayTracer() {
 	render_cam = RenderCam();
 	ambient_light.intensity = .03;
 
-	// Initialize random numbers
-	std::random_device rd;
-	std::mt19937 e2(rd());
-
 	bshadow = true;
 }
 
@@ -49,497 +52,666 @@ vector<SceneObject*> RayTracer::getSceneObjects() {
 }
 
 //---Determine whether a ray to a light source hits other objects----
+template <class K>
 bool RayTracer::inShadow(Ray r) {
-	bool isBlocked = false;
-	// iterate through objects
-	for (auto obj : objects) {
-		// Skip pathtracing luminares
-		if (Luminaire *l = dynamic_cast<Luminaire*>(obj))
-			continue;
+	// Luminaires don't block light
+	if (!scene.hasOccluders())
+		return false;
+
+	if (K::algo(*this) == RenderAlgo::raymarch) { // Ray marching
+		glm::vec3 point;
+		int index;
+		return rayMarch<K>(r, point, index);
+	}
 
-		if (ra == RenderAlgo::raymarch) { // Ray marching
-			int index;
-			if (rayMarch(r, glm::vec3(), index)) {
-				isBlocked = true;
-				break;
-			}
-		}
-		else {
-			if (obj->intersect(r, glm::vec3(), glm::vec3())) { // Ray tracing
-				isBlocked = true;
-				break;
-			}
-		}
+	if (K::algo(*this) == RenderAlgo::hybrid) { // Exact occluders, then the marched ones
+		glm::vec3 point;
+		int index;
+		return scene.occluded(r) || (scene.hasMarchedOnly() && rayMarch<K>(r, point, index));
 	}
 
-	return isBlocked;
+	return scene.occluded(r); // Ray tracing
 }
 
 
-//---Phong shading calculation---------------------------------------
-ofColor RayTracer::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power) {
-	ofColor color = ambient_light.diffuseColor * ambient_light.intensity;
-
-	// Iterate through each light
-	if (!light_refs.empty()) {
-		for (const auto &light_ref : light_refs) {
-
-			glm::vec3 n = glm::normalize(norm);
-			glm::vec3 light_vec = glm::normalize(light_ref->position - p);
+//---Shadow test of prepared light i from p----------------------------
+template <class K>
+bool RayTracer::lightShadowed(const PreparedLights &lights, int i, const glm::vec3 &p, const glm::vec3 &norm) {
+	glm::vec3 light_vec = glm::normalize(lights.position(i) - p);
 
-			glm::vec3 view_vec = glm::normalize(render_cam.position - p);
-			glm::vec3 half_vec = glm::normalize(view_vec + light_vec);
+	// Cone lights always cast shadows, point lights when shadows are on
+	if (K::cones(*this) && lights.isCone(i))
+		return inShadow<K>(Ray(p + (norm * .001), light_vec));
+	if (!K::shadows(*this))
+		return false;
+	if (K::algo(*this) == RenderAlgo::raymarch || K::algo(*this) == RenderAlgo::hybrid)
+		return inShadow<K>(Ray(p + norm, light_vec));
+	return inShadow<K>(Ray(p + (norm * 0.01), light_vec));
+} // end lightShadowed
 
-			float lamb_angle = glm::max(0.0f, glm::dot(n, light_vec));
-			float phong_angle = pow(glm::max(0.0f, glm::dot(n, half_vec)), power);
 
-			float distance = glm::distance(light_vec, p);
-			float intensity = light_ref->intensity / (distance * distance);
-
-			// If not in shadow than calculate color of pixel
-			bool shadow = false;
-			if (bshadow) {
-				if (ra == RenderAlgo::raymarch)
-					shadow = inShadow(Ray(p + norm, light_vec));
-				else
-					shadow = inShadow(Ray(p + (norm * 0.01), light_vec));
-			}
-
-			if (!shadow) {
-				ofColor lambert = ofColor(
-					std::fmin(255.0, diffuse.r * intensity * lamb_angle),
-					std::fmin(255.0, diffuse.g * intensity * lamb_angle),
-					std::fmin(255.0, diffuse.b * intensity * lamb_angle),
-					255);
-				ofColor phong = ofColor(
-					std::fmin(255.0, specular.r * intensity * phong_angle),
-					std::fmin(255.0, specular.g * intensity * phong_angle),
-					std::fmin(255.0, specular.b * intensity * phong_angle),
-					255);
-				color += lambert + phong;
-			}
+//---Phong shading calculation---------------------------------------
+// The light factors come from PreparedLights::evaluate, every light's diffuse and
+// specular terms are clamped to 8 bits and summed with saturation as before
+template <class K>
+ofColor RayTracer::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power) {
+	glm::vec3 n = glm::normalize(norm);
+	glm::vec3 view_vec = glm::normalize(render_cam.position - p);
+
+	// Lights to shade, the weights of culled and sampled lights go into their intensity
+	static thread_local PreparedLights selected;
+	const PreparedLights *lights = &prepared_lights;
+
+	if (light_mode == LightMode::cull_lights) {
+		// Only lights whose inverse square intensity is above the threshold
+		static thread_local vector<LightTree::LightRef> visible;
+		light_tree.cull(p, light_cull_threshold, visible);
+		selected.clear();
+		for (const auto &ref : visible)
+			selected.add(prepared_lights, ref.isCone ? prepared_lights.num_points + ref.index : ref.index, 1.0f);
+		lights = &selected;
+	}
+	else if (light_mode == LightMode::sample_lights) {
+		// Importance sampled lights, weighted by their selection probability
+		// The selection numbers are stratified over the samples of this shading point
+		Sampler light_sampler(Sampler::pointStream(p), sampler_seed);
+		selected.clear();
+		for (uint32_t s = 0; s < light_samples; s++) {
+			LightTree::LightRef ref;
+			float pdf;
+			light_sampler.startSample(s);
+			if (light_tree.sample(p, light_sampler.get1D(), ref, pdf))
+				selected.add(prepared_lights, ref.isCone ? prepared_lights.num_points + ref.index : ref.index, 1.0f / (pdf * light_samples));
 		}
+		lights = &selected;
 	}
 
-	// Cone lights
-	if (!cone_refs.empty()) {
-		// Iterate through cone lights
-		for (const auto &cone_ref : cone_refs) {
-
-			// Vector pointing to light from point
-			glm::vec3 L = glm::normalize(cone_ref->position - p);
+	static thread_local vector<float> kd, ks;
+	if (K::cones(*this))
+		lights->evaluate<true>(p, n, view_vec, power, kd, ks);
+	else
+		lights->evaluate<false>(p, n, view_vec, power, kd, ks);
+
+	int r = ambient_color.r;
+	int g = ambient_color.g;
+	int b = ambient_color.b;
+	for (int i = 0; i < lights->size(); i++) {
+		// Unlit points need no shadow ray
+		if (kd[i] <= 0.0f && ks[i] <= 0.0f)
+			continue;
+		if (lightShadowed<K>(*lights, i, p, norm))
+			continue;
 
-			// Direction vector of light cone
-			//glm::vec3 dir = glm::normalize(cone_ref->dir_vec);
-			glm::vec3 dir = glm::normalize(glm::vec3(-cone_ref->dir_vec.x, cone_ref->dir_vec.y, -cone_ref->dir_vec.z));
+		r += static_cast<int>(std::fmin(255.0f, diffuse.r * kd[i])) + static_cast<int>(std::fmin(255.0f, specular.r * ks[i]));
+		g += static_cast<int>(std::fmin(255.0f, diffuse.g * kd[i])) + static_cast<int>(std::fmin(255.0f, specular.g * ks[i]));
+		b += static_cast<int>(std::fmin(255.0f, diffuse.b * kd[i])) + static_cast<int>(std::fmin(255.0f, specular.b * ks[i]));
+	}
 
-			// Angle between direction vector (lightpoint->norm) and light vector to point (lightpoint->point)  
-			float spotlight_cos = std::abs(glm::dot(-L, dir));
+	return ofColor(std::min(255, r), std::min(255, g), std::min(255, b), 255);
+} // end phong
 
-			// If angle of the position to light vector to the direction vector is greater than half cone angle,
-			// then the pixel is in the spotlight and needs to be shaded accordingly
-			float current_angle = glm::degrees(spotlight_cos);
-			if (spotlight_cos >= glm::radians(cone_ref->angle_cutoff) && !inShadow(Ray(p + (norm * .001), L))) {
 
-				// Fall off of cone light the farther away from the cone the point is
-				float falloff = std::pow(glm::max(0.0f, spotlight_cos), cone_ref->falloff_radius);
 
-				// Distance and intensity of the light
-				float distance = glm::distance(cone_ref->position, p);
-				float intensity = cone_ref->intensity / (distance * distance);
+//---Look up color of texture pixel given the (u, v) coordinates---------------
+// t is the ray distance to the texel, it picks the mip level
+ofColor RayTracer::texture_lookup(TiledTexture &texture, float u, float v, float t) {
+	// Texels covered by the pixel footprint, the texture repeats every 5 units
+	float footprint = t * pixel_spread * 0.2f * texture.getWidth();
 
-				// Normalized normal
-				glm::vec3 n = glm::normalize(norm);
+	// Return the color of the texture at translated texture coordinates
+	return texture.lookup(u, v, footprint);
+}
 
-				// Phone shading vectors
-				glm::vec3 view_vec = glm::normalize(render_cam.position - p);
-				glm::vec3 half_vec = glm::normalize(view_vec + L);
 
-				// Angles for lambert and phone calulcations
-				float lamb_angle = glm::max(0.0f, glm::dot(n, L));
-				float phong_angle = pow(glm::max(0.0f, glm::dot(n, half_vec)), power);
+//---Shade a hit with its material, textured planes look up their diffuse color
+template <class K>
+ofColor RayTracer::shadeHit(const Hit &hit) {
+	const Material &m = scene.materials[hit.id];
+	ofColor diffuse = m.diffuseColor;
 
-				ofColor lambert = ofColor(
-					std::fmin(255.0, diffuse.r * intensity * falloff * lamb_angle),
-					std::fmin(255.0, diffuse.g * intensity * falloff * lamb_angle),
-					std::fmin(255.0, diffuse.b * intensity * falloff * lamb_angle),
-					255);
-				ofColor phong = ofColor(
-					std::fmin(255.0, specular.r * intensity * phong_angle),
-					std::fmin(255.0, specular.g * intensity * phong_angle),
-					std::fmin(255.0, specular.b * intensity * phong_angle),
-					255);
-				color += lambert + phong;
+	if (K::textures(*this) && m.texture_ref) {
+		// Calculate (u,v) coordinates of intersection of plane
+		float up = glm::dot(m.u_vec, hit.point) * 0.2;
+		float vp = glm::dot(m.v_vec, hit.point) * 0.2;
 
-			}
-		}
+		// Lookup color of pixel of intersected texture
+		diffuse = texture_lookup(*m.texture_ref, up, vp, hit.t);
 	}
 
-	//color = glm::min(ofColor(255, 255, 255, 255), color);
-	color = ofColor(
-		std::fmin(255.0, color.r),
-		std::fmin(255.0, color.g),
-		std::fmin(255.0, color.b),
-		255);
-
-	return color;
-} // end phong
-
-
-
-//---Look up color of texture pixel given the (u, v) coordinates---------------
-ofColor RayTracer::texture_lookup(const ofImage &texture, float u, float v) {
-	// Height and width of texture
-	uint32_t text_w = texture.getWidth();
-	uint32_t text_h = texture.getHeight();
-
-	// Find the i j coordinates
-	uint32_t i = glm::round(u * text_w - 0.5);
-	uint32_t j = glm::round(v * text_h - 0.5);
-
-	// Return the color of the texture at translated texture coordinates
-	return texture.getPixelsRef().getColor(i % text_w, j % text_h);
+	return phong<K>(hit.point, hit.normal, diffuse, m.specularColor, m.power);
+} // end shadeHit
 
+// Shading of the path tracer stages, which aren't kernels
+ofColor RayTracer::shadeHit(const Hit &hit) {
+	return shadeHit<RuntimeKernel>(hit);
 }
 
 
 // Takes a pixel and finds that color of that pixel.
 // This is a necessary abstraction from render in order to create a blue effect
-ofColor RayTracer::rayColor(float u, float v) {
+template <class K>
+ofColor RayTracer::rayColor(const Ray &ray, uint32_t depth, float weight) {
+
+	// Closest hit, luminaires are only visible to the path tracer
+	Hit hit;
+	if (scene.intersect(ray, hit, true)) {
+		notePixelHit(hit, depth);
+		const Material &m = scene.materials[hit.id];
+		ofColor local = shadeHit<K>(hit);
+		if (m.reflectivity <= 0.0f && m.transparency <= 0.0f)
+			return local;
+		return specularColor<K>(ray, hit.point, hit.normal, m, local, depth, weight);
+	}
 
-	ofColor c;
+	// draw background color of no ray was hit
+	return background_color;
+} // end rayColor
 
-	// calculate ray through pixel
-	Ray ray = render_cam.getRay(u, v);
 
-	// hit boolean to detect the hitting of an object
-	bool hit = false;
+//---Mix the local shading with reflected and refracted rays---------------
+// The split is Fresnel weighted, and rays whose share of the pixel (weight times
+// their split) falls under min_ray_weight are not traced, which bounds the ray tree
+template <class K>
+ofColor RayTracer::specularColor(const Ray &ray, const glm::vec3 &p, const glm::vec3 &normal, const Material &m, const ofColor &local, uint32_t depth, float weight) {
+	// Normal facing the incoming ray, the ray is leaving the object if the surface faces away
+	bool entering = glm::dot(ray.d, normal) < 0;
+	glm::vec3 n = entering ? normal : -normal;
+
+	FresnelSplit split = fresnelSplit(ray.d, n, entering, m.reflectivity, m.transparency, m.ior);
+	float k_local = split.k_local;
+	float k_reflect = split.k_reflect;
+	float k_refract = split.k_refract;
+	const glm::vec3 &refracted = split.refracted;
+
+	glm::vec3 color = k_local * glm::vec3(local.r, local.g, local.b);
+
+	// Secondary rays start just off the surface on their own side
+	const float offset = 0.01f;
+	if (depth < max_trace_depth && weight * k_reflect >= min_ray_weight) {
+		glm::vec3 d = glm::reflect(ray.d, n);
+		ofColor c = traceColor<K>(Ray(p + n * offset, d), depth + 1, weight * k_reflect, !entering);
+		color += k_reflect * glm::vec3(c.r, c.g, c.b);
+	}
+	if (depth < max_trace_depth && weight * k_refract >= min_ray_weight) {
+		ofColor c = traceColor<K>(Ray(p - n * offset, refracted), depth + 1, weight * k_refract, entering);
+		color += k_refract * glm::vec3(c.r, c.g, c.b);
+	}
 
-	// distance variable to calculate distance
-	float distance = std::numeric_limits<float>::infinity();
+	return ofColor(std::fmin(255.0f, color.x), std::fmin(255.0f, color.y), std::fmin(255.0f, color.z));
+} // end specularColor
+
+// Color of a secondary ray with the current algorithm, inside is set when
+// the ray travels through a transparent object
+template <class K>
+ofColor RayTracer::traceColor(const Ray &ray, uint32_t depth, float weight, bool inside) {
+	if (K::algo(*this) == RenderAlgo::raymarch)
+		return rayMarchLoop<K>(ray, depth, weight, inside);
+	if (K::algo(*this) == RenderAlgo::hybrid)
+		return hybridColor<K>(ray, depth, weight, inside);
+	if (K::algo(*this) == RenderAlgo::photonmap)
+		return photonColor<K>(ray, depth, weight);
+	return rayColor<K>(ray, depth, weight);
+}
 
-	// pointer to keep a reference to the closest object to determine which color to draw pixel
-	SceneObject *closest_object = nullptr;
 
-	// Iterate through each object
-	glm::vec3 closest_intersect, closest_normal;
-	for (auto obj_ptr : objects) {
-		if (dynamic_cast<Luminaire*>(obj_ptr)) continue;
-		glm::vec3 point, normal;
+//---Closest hit of the hybrid renderer------------------------------------
+// Objects with exact intersections are hit analytically, then the ray is marched
+// through the distance only objects no further than that hit
+template <class K>
+bool RayTracer::hybridHit(const Ray &ray, Hit &hit, bool inside) {
+	bool found = scene.intersect(ray, hit, true);
+	if (!scene.hasMarchedOnly())
+		return found;
 
-		// Detect intersection with scene object
-		if (obj_ptr->intersect(ray, point, normal)) {
+	glm::vec3 p;
+	int obj_index;
+	if (!rayMarch<K>(ray, p, obj_index, inside, found ? hit.t : max_distance))
+		return found;
+
+	hit.t = glm::distance(ray.p, p);
+	hit.point = p;
+	hit.normal = getNormalRM<K>(p);
+	hit.id = obj_index;
+	return true;
+} // end hybridHit
+
+
+template <class K>
+ofColor RayTracer::hybridColor(const Ray &ray, uint32_t depth, float weight, bool inside) {
+	Hit hit;
+	if (!hybridHit<K>(ray, hit, inside))
+		return background_color;
+	notePixelHit(hit, depth);
+
+	const Material &m = scene.materials[hit.id];
+	ofColor local = shadeHit<K>(hit);
+	if (m.reflectivity <= 0.0f && m.transparency <= 0.0f)
+		return local;
+	return specularColor<K>(ray, hit.point, hit.normal, m, local, depth, weight);
+} // end hybridColor
+
+
+//---Color of a ray in the photon mapping mode-----------------------------
+// Luminaires are visible as in the path tracer, mirrors and glass are ray traced
+template <class K>
+ofColor RayTracer::photonColor(const Ray &ray, uint32_t depth, float weight) {
+	Hit hit;
+	if (!scene.intersect(ray, hit))
+		return background_color;
+	notePixelHit(hit, depth);
+
+	const Material &m = scene.materials[hit.id];
+	if (m.isLuminaire) {
+		float e = std::fmin(255.0f, m.emission * 255.0f);
+		return ofColor(e, e, e);
+	}
 
-			// Set hit pointer to true
-			hit = true;
+	ofColor local = photonShade<K>(ray, hit);
+	if (m.reflectivity <= 0.0f && m.transparency <= 0.0f)
+		return local;
+	return specularColor<K>(ray, hit.point, hit.normal, m, local, depth, weight);
+} // end photonColor
+
+
+// Diffuse shading of a hit: phong for the point and cone lights, sampled luminaires,
+// the caustic map, and the global map either at the hit or through a final gather
+template <class K>
+ofColor RayTracer::photonShade(const Ray &ray, const Hit &hit) {
+	glm::vec3 n = glm::dot(hit.normal, ray.d) > 0 ? -hit.normal : hit.normal;
+	Sampler sampler(Sampler::pointStream(hit.point), sampler_seed);
+
+	glm::vec3 E = luminaireIrradiance(hit.point, n, sampler);
+	E += caustic_photons.irradiance(hit.point, n, photon_gather_count, photon_gather_radius, PhotonMap::all);
+	if (photon_final_gather > 0)
+		E += finalGather(hit.point, n, sampler);
+	else
+		E += global_photons.irradiance(hit.point, n, photon_gather_count, photon_gather_radius, PhotonMap::indirect);
+
+	glm::vec3 radiance = hitAlbedo(hit) * E * glm::one_over_pi<float>() * 255.0f;
+	ofColor direct = shadeHit<K>(hit);
+	return ofColor(
+		std::fmin(255.0f, direct.r + radiance.x),
+		std::fmin(255.0f, direct.g + radiance.y),
+		std::fmin(255.0f, direct.b + radiance.z));
+} // end photonShade
+
+
+// Irradiance at p from the luminaires, each sampled photon_light_samples times by the
+// solid angle it subtends
+glm::vec3 RayTracer::luminaireIrradiance(const glm::vec3 &p, const glm::vec3 &n, Sampler &sampler) {
+	glm::vec3 E(0.0f);
+	for (int l = 0; l < scene.numLuminaires(); l++) {
+		glm::vec3 center;
+		float radius, cos_max;
+		int lum_id;
+		scene.getLuminaire(l, center, radius, lum_id);
+		if (!sphereConeCos(p, center, radius, cos_max))
+			continue;
 
-			// determine whether object is closer than the closest_object reference, if so replace
-			if (glm::distance(glm::vec3(u, v, 0), point) < distance) {
-				distance = glm::distance(glm::vec3(u, v, 0), point);
-				closest_object = obj_ptr;
-				closest_intersect = point;
-				closest_normal = glm::normalize(normal);
-			}
+		float sum = 0.0f;
+		for (uint32_t s = 0; s < photon_light_samples; s++) {
+			sampler.startSample(s);
+			glm::vec2 u = sampler.get2D();
+			glm::vec3 wi = uniformSampleCone(glm::normalize(center - p), cos_max, u.x, u.y);
+			float cos_theta = glm::dot(n, wi);
+
+			Hit light_hit;
+			if (cos_theta > 0 && scene.intersect(Ray(p + n * 0.001f, wi), light_hit) && light_hit.id == lum_id)
+				sum += cos_theta / uniformConePdf(cos_max);
 		}
+		E += glm::vec3(scene.materials[lum_id].emission * sum / std::max(1u, photon_light_samples));
 	}
-	if (hit) { // Draw color of nearest object if ray hit it
-		
-		ofColor color;
-		if (closest_object->texture_ref) { // For plane objects with textures
-			 // Dynamically cast object to plane
-			if (Plane *p = dynamic_cast<Plane*>(closest_object)) {
-				if (p->isTextured == true) {
-					// Calculate the u and v normal vector directions
-
-				// Orthogonal unit vectors
-					glm::vec3 x = glm::cross(p->normal, glm::vec3(1, 0, 0));
-					glm::vec3 y = glm::cross(p->normal, glm::vec3(0, 1, 0));
-					glm::vec3 z = glm::cross(p->normal, glm::vec3(0, 0, 1));
-
-					// Determine the unit vector whose magnitude is lesser and set that for the u direction vector
-					glm::vec3 max_xy = glm::dot(x, x) < glm::dot(y, y) ? y : x;
-					glm::vec3 u_vec = glm::normalize(glm::dot(max_xy, max_xy) < glm::dot(z, z) ? max_xy : z);
-					// Cross for the v direction vector
-					glm::vec3 v_vec = glm::cross(p->normal, u_vec);
-
-					// Calculate (u,v) coordinates of intersection of plane
-					float up = glm::dot(u_vec, closest_intersect) * 0.2;
-					float vp = glm::dot(v_vec, closest_intersect) * 0.2;
-
-					// Lookup color of pixel of intersected texture
-					ofColor diffuse = texture_lookup(*p->texture_ref, up, vp);
-
-					// Calculate shading with texture color
-					c = phong(closest_intersect, closest_normal, diffuse, closest_object->specularColor, closest_object->power);
-				}
-				else {
-					c = phong(closest_intersect, closest_normal, closest_object->diffuseColor, closest_object->specularColor, closest_object->power);
-				}
-			}
-			else {
-				cerr << "Could not cast object to plane" << endl;
-			}
-		}
-		else { // Calculate non textured shading
-			c = phong(closest_intersect, closest_normal, closest_object->diffuseColor, closest_object->specularColor, closest_object->power);
+	return E;
+} // end luminaireIrradiance
+
+
+// Irradiance at p from the global map seen by cosine weighted gather rays. Luminaires
+// are left out, luminaireIrradiance has them
+glm::vec3 RayTracer::finalGather(const glm::vec3 &p, const glm::vec3 &n, Sampler &sampler) {
+	glm::vec3 sum(0.0f);
+	for (uint32_t s = 0; s < photon_final_gather; s++) {
+		sampler.startSample(s);
+		sampler.get2D();        // dimension 0 went to the luminaire samples
+		glm::vec2 u = sampler.get2D();
+		glm::vec3 wi = cosineSampleHemisphere(n, u.x, u.y);
+
+		Hit hit;
+		if (!scene.intersect(Ray(p + n * 0.001f, wi), hit)) {
+			sum += glm::vec3(background_color.r, background_color.g, background_color.b) / 255.0f;
+			continue;
 		}
-	}
-	else { // draw background color of no ray was hit
-		c = background_color;
+		const Material &m = scene.materials[hit.id];
+		if (m.isLuminaire)
+			continue;
+
+		// Radiance leaving the gathered point towards p, only its diffuse share as
+		// specularColor gives the local term at a primary hit
+		bool entering = glm::dot(wi, hit.normal) < 0;
+		glm::vec3 hn = entering ? hit.normal : -hit.normal;
+		float k_local = fresnelSplit(wi, hn, entering, m.reflectivity, m.transparency, m.ior).k_local;
+		if (k_local <= 0.0f)
+			continue;
+		glm::vec3 E = global_photons.irradiance(hit.point, hn, photon_gather_count, photon_gather_radius, PhotonMap::all);
+		sum += k_local * hitAlbedo(hit) * E * glm::one_over_pi<float>();
 	}
 
-	return c;
-} // end rayColor
+	// Cosine weighted rays, the irradiance is pi times their mean radiance
+	return sum * glm::pi<float>() / static_cast<float>(photon_final_gather);
+} // end finalGather
 
 
-void RayTracer::colorToRgb(Rgb &r, ofColor &c) {
-	r.r += c.r;
-	r.g += c.g;
-	r.b += c.b;
-	return;
+// Diffuse albedo of a hit, textured planes look up their texture
+glm::vec3 RayTracer::hitAlbedo(const Hit &hit) {
+	const Material &m = scene.materials[hit.id];
+	ofColor diffuse = m.diffuseColor;
+	if (m.texture_ref) {
+		float up = glm::dot(m.u_vec, hit.point) * 0.2;
+		float vp = glm::dot(m.v_vec, hit.point) * 0.2;
+		diffuse = texture_lookup(*m.texture_ref, up, vp, hit.t);
+	}
+	return glm::vec3(diffuse.r, diffuse.g, diffuse.b) / 255.0f;
+}
+
+// Solid angle pdf of next event estimation picking the direction towards luminaire id from p
+float RayTracer::luminairePdf(const glm::vec3 &p, int id) {
+	glm::vec3 center;
+	float radius, cos_max;
+	int lum_id;
+	scene.getLuminaire(scene.materials[id].luminaire, center, radius, lum_id);
+	if (!sphereConeCos(p, center, radius, cos_max))
+		return 0.0f;
+	return uniformConePdf(cos_max) / scene.numLuminaires();
 }
 
 // --- PathTrace implementation
 // --- Based off of psuedocode located in "Fundamentals of Computer Graphics 4th ed." pg. 619
-void RayTracer::pathTrace(Rgb &clr, Ray r, uint32_t depth, std::mt19937 &e2, std::uniform_real_distribution<> &dist) {
-	if (depth == max_depth) {
-		clr.r = 0; clr.g = 0; clr.b = 0;
-		return;
-	}
-
-	bool hit = false;
-	float distance = std::numeric_limits<float>::infinity();
-	SceneObject *closest_object = nullptr;
-
-	// Iterate through each object
-	glm::vec3 closest_intersect, closest_normal;
-	for (auto obj_ptr : objects) {
-		glm::vec3 point, normal;
-
-		// Detect intersection with scene object
-		if (obj_ptr->intersect(r, point, normal)) {
-
-			// Set hit pointer to true
-			hit = true;
-
-			// determine whether object is closer than the closest_object reference, if so replace
-			if (glm::distance(r.p, point) < distance) {
-				distance = glm::distance(r.p, point);
-				closest_object = obj_ptr;
-				closest_intersect = point;
-				closest_normal = glm::normalize(normal);
-			}
+// --- Diffuse bounces are cosine weighted and luminaires are sampled explicitly (next event estimation),
+// --- both strategies are combined with multiple importance sampling (power heuristic)
+// --- Radiance is returned in [0, 1] color units
+// --- An indirect ray is a bounce off an irradiance cache point, it starts at depth 1 and
+// --- skips the luminaire it may hit first, that point's light sample has it
+// --- first_t receives the distance to the first hit, infinity on a miss
+template <class K>
+glm::vec3 RayTracer::pathTrace(Ray r, Sampler &sampler, bool indirect, float *first_t) {
+	glm::vec3 radiance(0.0f);
+	glm::vec3 throughput(1.0f);
+	float bsdf_pdf = 0.0f;      // pdf of the bounce that produced r, 0 for camera rays
+	glm::vec3 origin = r.p;
+	uint32_t first_depth = indirect ? 1 : 0;
+	if (first_t)
+		*first_t = std::numeric_limits<float>::infinity();
+
+	// Bounces recorded into the path guide when the path ends, irradiance cache rays
+	// trace their paths in the middle of another's
+	struct GuideVertex {
+		GuideLeaf *leaf;
+		glm::vec3 wi;
+		glm::vec3 radiance;     // radiance of the path before the bounce
+		glm::vec3 throughput;   // throughput after the bounce
+		float pdf;
+	};
+	static thread_local vector<GuideVertex> vertices;
+	size_t first_vertex = vertices.size();
+
+	for (uint32_t depth = first_depth; depth < max_depth; depth++) {
+		Hit hit;
+		if (!scene.intersect(r, hit)) { // background color if no object was hit
+			radiance += throughput * glm::vec3(background_color.r, background_color.g, background_color.b) / 255.0f;
+			break;
 		}
-	}
-	if (hit) { // Draw color of nearest object if ray hit it
-
-		ofColor color;
-		if (closest_object->texture_ref) { // For plane objects with textures
-			 // Dynamically cast object to plane
-			if (Plane *p = dynamic_cast<Plane*>(closest_object)) {
-				if (p->isTextured) {
-					// Calculate the u and v normal vector directions
-
-				// Orthogonal unit vectors
-					glm::vec3 x = glm::cross(p->normal, glm::vec3(1, 0, 0));
-					glm::vec3 y = glm::cross(p->normal, glm::vec3(0, 1, 0));
-					glm::vec3 z = glm::cross(p->normal, glm::vec3(0, 0, 1));
-
-					// Determine the unit vector whose magnitude is lesser and set that for the u direction vector
-					glm::vec3 max_xy = glm::dot(x, x) < glm::dot(y, y) ? y : x;
-					glm::vec3 u_vec = glm::normalize(glm::dot(max_xy, max_xy) < glm::dot(z, z) ? max_xy : z);
-					// Cross for the v direction vector
-					glm::vec3 v_vec = glm::cross(p->normal, u_vec);
+		if (first_t && depth == first_depth)
+			*first_t = hit.t;
 
-					// Calculate (u,v) coordinates of intersection of plane
-					float up = glm::dot(u_vec, closest_intersect) * 0.2;
-					float vp = glm::dot(v_vec, closest_intersect) * 0.2;
+		const Material &m = scene.materials[hit.id];
 
-					// Lookup color of pixel of intersected texture
-					ofColor diffuse = texture_lookup(*p->texture_ref, up, vp);
+		// Luminaire hit by the camera or by a bounce, weighted against the explicit light sample
+		if (m.isLuminaire) {
+			if (indirect && depth == first_depth)
+				break;
+			float weight = depth == 0 ? 1.0f : powerHeuristic(bsdf_pdf, luminairePdf(origin, hit.id));
+			radiance += throughput * m.emission * weight;
+			break;
+		}
 
-					// Calculate shading with texture color
-					ofColor c = phong(closest_intersect, closest_normal, diffuse, closest_object->specularColor, closest_object->power);
-					colorToRgb(clr, c);
-				}
-				else {
-					ofColor c = phong(closest_intersect, closest_normal, closest_object->diffuseColor, closest_object->specularColor, closest_object->power);
-					colorToRgb(clr, c);
+		// Shading normal facing the incoming ray
+		glm::vec3 n = glm::dot(hit.normal, r.d) > 0 ? -hit.normal : hit.normal;
+		glm::vec3 albedo = hitAlbedo(hit);
+
+		// Point and cone lights are shaded directly
+		ofColor direct = shadeHit<K>(hit);
+		radiance += throughput * glm::vec3(direct.r, direct.g, direct.b) / 255.0f;
+
+		// Camera hits take their indirect light from the irradiance cache, the walk ends
+		// here and the luminaires are only reached by the light sample
+		bool cached = irradiance_caching && depth == 0;
+
+		// Incident light learned in this region, once a training pass has filled it
+		GuideLeaf *guide_leaf = path_guiding && !cached ? path_guide.leaf(hit.point) : nullptr;
+		const DTree *guide = guide_leaf && guide_leaf->sampling.total() > 0.0f ? &guide_leaf->sampling : nullptr;
+		auto bouncePdf = [&](const glm::vec3 &w) {
+			float cos_pdf = std::max(0.0f, glm::dot(n, w)) * glm::one_over_pi<float>();
+			return guide ? guide_fraction * guide->pdf(w) + (1.0f - guide_fraction) * cos_pdf : cos_pdf;
+		};
+
+		// Next event estimation, sample a luminaire by the solid angle it subtends
+		int num_lum = scene.numLuminaires();
+		if (num_lum > 0) {
+			int l = std::min(static_cast<int>(sampler.get1D() * num_lum), num_lum - 1);
+			glm::vec3 center;
+			float radius, cos_max;
+			int lum_id;
+			scene.getLuminaire(l, center, radius, lum_id);
+			if (sphereConeCos(hit.point, center, radius, cos_max)) {
+				glm::vec2 u = sampler.get2D();
+				glm::vec3 wi = uniformSampleCone(glm::normalize(center - hit.point), cos_max, u.x, u.y);
+				float cos_theta = glm::dot(n, wi);
+
+				Hit light_hit;
+				if (cos_theta > 0 && scene.intersect(Ray(hit.point + n * 0.001f, wi), light_hit) && light_hit.id == lum_id) {
+					float light_pdf = uniformConePdf(cos_max) / num_lum;
+					float weight = cached ? 1.0f : powerHeuristic(light_pdf, bouncePdf(wi));
+
+					// Lambertian brdf albedo / pi
+					radiance += throughput * albedo * glm::one_over_pi<float>() * cos_theta * scene.materials[lum_id].emission * weight / light_pdf;
 				}
-
-			}
-			else {
-				cerr << "Could not cast object to plane" << endl;
-				return;
 			}
 		}
-		else { // Calculate non textured shading
-			if (dynamic_cast<Luminaire*>(closest_object)) {
-				if (depth == 0) {
-					colorToRgb(clr, ofColor(255, 255, 255));
-					return;
-				}
-				return;
-			}
-			// non textured color
-			ofColor c = phong(closest_intersect, closest_normal, closest_object->diffuseColor, closest_object->specularColor, closest_object->power);
-			colorToRgb(clr, c);
 
+		if (cached) {
+			radiance += throughput * albedo * cachedIrradiance<K>(hit.point, n) * glm::one_over_pi<float>();
+			break;
 		}
-	
 
+		glm::vec3 wi;
+		if (guide) {
+			// Cosine weighted or drawn from the guide, weighted by the pdf of the mix
+			bool guided = sampler.get1D() < guide_fraction;
+			glm::vec2 u = sampler.get2D();
+			wi = guided ? guide->sample(u) : cosineSampleHemisphere(n, u.x, u.y);
+			float cos_wi = glm::dot(n, wi);
+			if (cos_wi <= 0.0f)
+				break;
+			bsdf_pdf = bouncePdf(wi);
+			throughput *= albedo * (cos_wi * glm::one_over_pi<float>() / bsdf_pdf);
+		}
+		else {
+			// Cosine weighted diffuse bounce, brdf * cos / pdf reduces to the albedo
+			glm::vec2 u = sampler.get2D();
+			wi = cosineSampleHemisphere(n, u.x, u.y);
+			bsdf_pdf = glm::dot(n, wi) * glm::one_over_pi<float>();
+			throughput *= albedo;
+		}
 
-		// Compute random direction to cast new ray
-			
-		// Produce random direction vector
-		float rand_x = dist(e2) - 1;
-		float rand_y = dist(e2) - 1;
-		float rand_z = dist(e2) - 1;
-		glm::vec3 new_dir = glm::vec3(rand_x, rand_y, rand_z);
+		if (throughput.x + throughput.y + throughput.z <= 0.0f)
+			break;
+		if (guide_recording && guide_leaf)
+			vertices.push_back({ guide_leaf, wi, radiance, throughput, bsdf_pdf });
 
-		// Compute new direction
 		// Cast ray not from the point of intersection but from a point just above to disallow self intersection
-		Ray new_ray = Ray(closest_intersect + (new_dir * .01), glm::vec3(rand_x, rand_y, rand_z));
-
-		float choose = static_cast<float>(rand() / static_cast<float>(RAND_MAX));
-			
-
-		// Recursively follow new ray
-		pathTrace(clr, new_ray, ++depth, e2, dist); 
-		
+		origin = hit.point;
+		r = Ray(hit.point + n * 0.001f, wi);
 	}
-	else { // draw background color of no ray was hit
-		//if (depth == 0)
-		colorToRgb(clr, background_color);
-		return;
+
+	// Each bounce saw the radiance the path gained after it, divided by the throughput
+	// up to it. The guide learns it over the pdf the direction was drawn with
+	for (size_t v = first_vertex; v < vertices.size(); v++) {
+		const GuideVertex &vertex = vertices[v];
+		glm::vec3 incident = (radiance - vertex.radiance) / glm::max(vertex.throughput, glm::vec3(1e-8f));
+		vertex.leaf->building.record(vertex.wi, (incident.x + incident.y + incident.z) / (3.0f * vertex.pdf));
 	}
+	vertices.resize(first_vertex);
 
+	return radiance;
 } // end pathTrace
 
 
-// Find color from any given ray
-// Used for noise in dof function
-ofColor RayTracer::rayColorFromRay(Ray r) {
-	ofColor c;
-
-	// hit boolean to detect the hitting of an object
-	bool hit = false;
-
-	// distance variable to calculate distance
-	float distance = std::numeric_limits<float>::infinity();
-
-	// pointer to keep a reference to the closest object to determine which color to draw pixel
-	SceneObject *closest_object = nullptr;
-
-	// Iterate through each object
-	glm::vec3 closest_intersect, closest_normal;
-	for (auto obj_ptr : objects) {
-		glm::vec3 point, normal;
-
-		// Detect intersection with scene object
-		if (obj_ptr->intersect(r, point, normal)) {
-
-			// Set hit pointer to true
-			hit = true;
-			
-			// determine whether object is closer than the closest_object reference, if so replace
-			if (glm::distance(r.p , point) < distance) {
-				distance = glm::distance(r.p, point);
-				closest_object = obj_ptr;
-				closest_intersect = point;
-				closest_normal = glm::normalize(normal);
-			}
+//---Indirect irradiance at p from the irradiance cache-------------------------
+// When no record is valid at p a new one is traced: a stratified cosine weighted
+// hemisphere of M rings by N sectors, N about pi M, gives the irradiance, the
+// harmonic mean distance and the gradients of Ward and Heckbert
+template <class K>
+glm::vec3 RayTracer::cachedIrradiance(const glm::vec3 &p, const glm::vec3 &n) {
+	glm::vec3 E;
+	if (irradiance_cache.lookup(p, n, E))
+		return E;
+
+	int M = std::max(2, static_cast<int>(std::round(std::sqrt(irradiance_samples * glm::one_over_pi<float>()))));
+	int N = std::max(3, static_cast<int>(irradiance_samples) / M);
+	glm::vec3 t, b;
+	orthonormalBasis(n, t, b);
+
+	static thread_local vector<glm::vec3> L;
+	static thread_local vector<float> dist;
+	L.resize(M * N);
+	dist.resize(M * N);
+
+	IrradianceCache::Record rec;
+	rec.p = p;
+	rec.n = n;
+	rec.E = glm::vec3(0.0f);
+	for (int c = 0; c < 3; c++)
+		rec.rot_grad[c] = rec.trans_grad[c] = glm::vec3(0.0f);
+
+	Sampler sampler(Sampler::pointStream(p), sampler_seed);
+	float inv_dist = 0.0f;
+	for (int j = 0; j < M; j++) {
+		for (int k = 0; k < N; k++) {
+			int s = j * N + k;
+			sampler.startSample(s);
+			glm::vec2 u = sampler.get2D();
+			float sin_theta = std::sqrt((j + u.x) / M);
+			float cos_theta = std::sqrt(std::max(0.0f, 1.0f - sin_theta * sin_theta));
+			float phi = glm::two_pi<float>() * (k + u.y) / N;
+			glm::vec3 wi = sin_theta * std::cos(phi) * t + sin_theta * std::sin(phi) * b + cos_theta * n;
+
+			L[s] = pathTrace<K>(Ray(p + n * 0.001f, wi), sampler, true, &dist[s]);
+			dist[s] = std::max(dist[s], 1e-4f);
+			inv_dist += 1.0f / dist[s];
+
+			// Rotational gradient from the sample's own angles
+			glm::vec3 v = -std::sin(phi) * t + std::cos(phi) * b;
+			float tan_theta = sin_theta / std::max(cos_theta, 1e-3f);
+			for (int c = 0; c < 3; c++)
+				rec.rot_grad[c] += v * (tan_theta * L[s][c]);
 		}
 	}
-	if (hit) { // Draw color of nearest object if ray hit it
-
-		ofColor color;
-		if (closest_object->texture_ref) { // For plane objects with textures
-			 // Dynamically cast object to plane
-			if (Plane *p = dynamic_cast<Plane*>(closest_object)) {
 
-				// Calculate the u and v normal vector directions
+	for (int k = 0; k < N; k++) {
+		// Sector center direction, and the perpendicular of the sector's first edge
+		float phi = glm::two_pi<float>() * (k + 0.5f) / N;
+		float phi_edge = glm::two_pi<float>() * k / N;
+		glm::vec3 u_k = std::cos(phi) * t + std::sin(phi) * b;
+		glm::vec3 v_edge = -std::sin(phi_edge) * t + std::cos(phi_edge) * b;
+		int k_prev = (k + N - 1) % N;
+
+		for (int j = 0; j < M; j++) {
+			const glm::vec3 &l = L[j * N + k];
+			float sin_c = std::sqrt((j + 0.5f) / M);
+			float cos_lo = std::sqrt(1.0f - static_cast<float>(j) / M);
+			float cos_hi = std::sqrt(1.0f - static_cast<float>(j + 1) / M);
+
+			rec.E += l;
+
+			// Change across the sector's edge with the previous sector
+			glm::vec3 dl_phi = l - L[j * N + k_prev];
+			float w_phi = (cos_lo - cos_hi) / (sin_c * std::min(dist[j * N + k], dist[j * N + k_prev]));
+
+			// Change across the ring's inner edge
+			glm::vec3 dl_theta(0.0f);
+			float w_theta = 0.0f;
+			if (j > 0) {
+				float sin_lo = std::sqrt(static_cast<float>(j) / M);
+				dl_theta = l - L[(j - 1) * N + k];
+				w_theta = glm::two_pi<float>() / N * sin_lo * cos_lo * cos_lo / std::min(dist[j * N + k], dist[(j - 1) * N + k]);
+			}
 
-				// Orthogonal unit vectors
-				glm::vec3 x = glm::cross(p->normal, glm::vec3(1, 0, 0));
-				glm::vec3 y = glm::cross(p->normal, glm::vec3(0, 1, 0));
-				glm::vec3 z = glm::cross(p->normal, glm::vec3(0, 0, 1));
+			for (int c = 0; c < 3; c++)
+				rec.trans_grad[c] += u_k * (w_theta * dl_theta[c]) + v_edge * (w_phi * dl_phi[c]);
+		}
+	}
 
-				// Determine the unit vector whose magnitude is lesser and set that for the u direction vector
-				glm::vec3 max_xy = glm::dot(x, x) < glm::dot(y, y) ? y : x;
-				glm::vec3 u_vec = glm::normalize(glm::dot(max_xy, max_xy) < glm::dot(z, z) ? max_xy : z);
-				// Cross for the v direction vector
-				glm::vec3 v_vec = glm::cross(p->normal, u_vec);
+	float scale = glm::pi<float>() / (M * N);
+	rec.E *= scale;
+	for (int c = 0; c < 3; c++)
+		rec.rot_grad[c] *= scale;
+
+	// Harmonic mean distance, kept under the distance over which the translational
+	// gradient would change the irradiance by all of it, and between the pixel limits
+	rec.R = inv_dist > 0.0f ? M * N / inv_dist : std::numeric_limits<float>::max();
+	for (int c = 0; c < 3; c++) {
+		float g = glm::length(rec.trans_grad[c]);
+		if (g > 0.0f)
+			rec.R = std::min(rec.R, rec.E[c] / g);
+	}
+	float footprint = pixel_spread * glm::distance(render_cam.position, p);
+	rec.R = glm::clamp(rec.R, irradiance_min_pixels * footprint, irradiance_max_pixels * footprint);
 
-				// Calculate (u,v) coordinates of intersection of plane
-				float up = glm::dot(u_vec, closest_intersect) * 0.2;
-				float vp = glm::dot(v_vec, closest_intersect) * 0.2;
+	irradiance_cache.insert(rec);
+	return rec.E;
+} // end cachedIrradiance
 
-				// Lookup color of pixel of intersected texture
-				ofColor diffuse = texture_lookup(*p->texture_ref, up, vp);
 
-				// Calculate shading with texture color
-				c = phong(closest_intersect, closest_normal, diffuse, closest_object->specularColor, closest_object->power);
-			}
-			else {
-				cerr << "Could not cast object to plane" << endl;
-			}
-		}
-		else { // Calculate non textured shading
-			c = phong(closest_intersect, closest_normal, closest_object->diffuseColor, closest_object->specularColor, closest_object->power);
-		}
-	}
-	else { // draw background color of no ray was hit
-		c = background_color;
+// Find color from any given ray
+// Used for noise in dof function
+template <class K>
+ofColor RayTracer::rayColorFromRay(Ray r) {
+	Hit hit;
+	if (scene.intersect(r, hit)) {
+		const Material &m = scene.materials[hit.id];
+		ofColor local = shadeHit<K>(hit);
+		if (m.reflectivity <= 0.0f && m.transparency <= 0.0f)
+			return local;
+		return specularColor<K>(r, hit.point, hit.normal, m, local, 0, 1.0f);
 	}
 
-	return c;
+	// draw background color of no ray was hit
+	return background_color;
 } // end rayColorFromRay
 
 
 //--- Render image with depth of field
 //--- Implementation developed by Ben Foley
-ofColor RayTracer::blurRayColor(float u, float v, float eye_radius, uint32_t num_sample) {
-
-	// Ray casted to find focla length
-	Ray focal_ray = render_cam.getRay(u, v);
-	glm::vec3 focal_point = focal_ray.evalPoint(focal_dist);
-	
-
-	// Cast random point from the circular apeture (i.e. render cam in this case)
-
-	// Seed random number generator
-	srand(static_cast<unsigned> (time(0)));
+template <class K>
+ofColor RayTracer::blurRayColor(float u, float v, uint32_t num_sample, Sampler &sampler, SampleStats *stats) {
 
 	float c_r = 0.0f;
 	float c_g = 0.0f;
 	float c_b = 0.0f;
 
-	int apeture_radius = 2;
-	for (int p = 0; p < num_sample; p++) {
-
-		// Box apeture implementation
-		//float rand_x = fmin(final_image.getWidth(), fmax(0.0, static_cast<float>(rand() / static_cast<float>(RAND_MAX / (apeture_radius - (-apeture_radius))))));
-		//float rand_y = fmin(final_image.getHeight(), fmax(0.0, static_cast<float>(rand() / static_cast<float>(RAND_MAX / (apeture_radius - (-apeture_radius))))));
-
-		//glm::vec3 rand_apeture_pt = glm::vec3(rand_x, rand_y, 0.0) + render_cam.position;
-
-		// Circular apeture implementation
-		// Random radius
-		float rand_radius = static_cast<float>(rand() / static_cast<float>(RAND_MAX / apeture_radius));
-		// Random angle
-		float rand_angle = static_cast<float>(rand() / static_cast<float>(RAND_MAX / 360));
+	float pixel_w = 1.0f / final_image.getWidth();
+	float pixel_h = 1.0f / final_image.getHeight();
 
-		// x and y axis values
-		float rand_x = eye_radius * glm::cos(glm::radians(rand_angle));
-		float rand_y = eye_radius * glm::sin(glm::radians(rand_angle));
-
-		glm::vec3 rand_apeture_pt = glm::vec3(rand_x, rand_y, 0.0) + render_cam.position;
+	for (int p = 0; p < num_sample; p++) {
+		sampler.startSample(p);
 
-		Ray sample_ray = Ray(rand_apeture_pt, glm::normalize(focal_point - rand_apeture_pt));
+		// Jitter within the pixel, then sample the camera's thin lens
+		glm::vec2 jitter = sampler.get2D() - glm::vec2(0.5f, 0.5f);
+		Ray sample_ray = render_cam.getLensRay(u + jitter.x * pixel_w, v + jitter.y * pixel_h, sampler.get2D());
 		
 		// find the color that the ray finds
-		ofColor current_color = rayColorFromRay(sample_ray);
+		ofColor current_color = rayColorFromRay<K>(sample_ray);
+		if (stats)
+			stats->add(glm::vec3(current_color.r, current_color.g, current_color.b));
 		
 		c_r += current_color.r;
 		c_g += current_color.g;
@@ -557,30 +729,80 @@ ofColor RayTracer::blurRayColor(float u, float v, float eye_radius, uint32_t num
 // --- MARCH -----------------------------------------------------------------
 // --- FUNCTIONS -------------------------------------------------------------
 
-float RayTracer::sceneSDF(const glm::vec3 &p, int &obj_index) {
-	float distance = std::numeric_limits<float>::infinity();
-	obj_index = -1;
+//---Bake distance fields of expensive sdf objects, or load them from the cache
+void RayTracer::bakeDistanceFields() {
+	for (auto field : baked_sdfs)
+		delete field;
+	baked_sdfs.assign(objects.size(), nullptr);
+
+	if (!bake_sdf || (ra != RenderAlgo::raymarch && ra != RenderAlgo::hybrid))
+		return;
+
+	float before_time = ofGetElapsedTimeMillis();
+	ofDirectory::createDirectory(cache_dir, false, true);
 
-	// For each object, calculate the distance and give the shortest distance away
 	for (int i = 0; i < objects.size(); i++) {
-		float obj_dist = objects[i]->sdf(p);
-		if (distance > obj_dist) {
-			distance = obj_dist;
-			obj_index = i;
+		// Only objects that describe their parameters can be keyed in the cache
+		if (objects[i]->getParamKey().empty())
+			continue;
+
+		// Bounded objects are baked with a cell of padding, unbounded ones over the bake region
+		glm::vec3 bmin = bake_min;
+		glm::vec3 bmax = bake_max;
+		if (objects[i]->getBounds(bmin, bmax)) {
+			float pad = 8 * bake_voxel_size;
+			bmin -= glm::vec3(pad);
+			bmax += glm::vec3(pad);
+		}
+
+		BrickMap *field = new BrickMap(objects[i], bmin, bmax, bake_voxel_size);
+		string path = cache_dir + "sdf_" + field->cacheKey() + ".brk";
+		if (!field->load(path)) {
+			field->bake(std::thread::hardware_concurrency());
+			field->save(path);
 		}
+		baked_sdfs[i] = field;
 	}
 
-	return distance;
+	float after_time = ofGetElapsedTimeMillis();
+	cout << "SDF bake time: " << after_time - before_time << "ms" << endl;
+} // end bakeDistanceFields
+
+template <class K>
+float RayTracer::sceneSDF(const glm::vec3 &p, int &obj_index) {
+	if (compiled_sdf)
+		return compiled_sdf(p.x, p.y, p.z, &obj_index);
+
+	// The hybrid renderer only marches objects without exact hits
+	return scene.sdf(p, obj_index, K::algo(*this) == RenderAlgo::hybrid);
 } // end sceneSDF
 
-bool RayTracer::rayMarch(const Ray &r, glm::vec3 &p, int &obj_index) {
+// Steps come from SceneData::marchDistance, which skips empty cells of repeated tori.
+// Rays inside an object march the negated distance to find where they leave it
+// The march gives up once t reaches t_limit
+template <class K>
+bool RayTracer::rayMarch(const Ray &r, glm::vec3 &p, int &obj_index, bool inside, float t_limit) {
+	bool marched_only = K::algo(*this) == RenderAlgo::hybrid;
 	bool hit = false;
 	float dist;
+	float t = 0.0f;
 	obj_index = -1;
 
-	p = r.p;
+	MarchCache cache;
+	if (!inside)
+		scene.prepareMarch(r, cache);
+
 	for (int i = 0; i < max_ray_steps; i++) {
-		dist = sceneSDF(p, obj_index);
+		// A hybrid ray inside may be inside an object that isn't marched, where
+		// the marched distance is positive, so it marches the unsigned distance
+		if (inside && marched_only)
+			dist = std::abs(sceneSDF<K>(r.p + r.d * t, obj_index));
+		else if (inside)
+			dist = -sceneSDF<K>(r.p + r.d * t, obj_index);
+		else if (compiled_march)
+			dist = sceneSDF<K>(r.p + r.d * t, obj_index);
+		else
+			dist = scene.marchDistance(r, cache, t, obj_index, marched_only);
 
 		if (dist < distance_threshold) {
 			hit = true;
@@ -590,23 +812,32 @@ bool RayTracer::rayMarch(const Ray &r, glm::vec3 &p, int &obj_index) {
 			break;
 		}
 		else {
-			p = p + r.d * dist; // move along the ray
+			t += dist; // move along the ray
+			if (t >= t_limit)
+				break;
 		}
 	}
 
+	p = r.p + r.d * t;
 	return hit;
 } // end rayMarch
 
-ofColor RayTracer::rayMarchLoop(const Ray &r) {
+template <class K>
+ofColor RayTracer::rayMarchLoop(const Ray &r, uint32_t depth, float weight, bool inside) {
 	glm::vec3 point;
 	ofColor c;
 	int obj_index;
 
-	bool hit = rayMarch(r, point, obj_index);
+	bool hit = rayMarch<K>(r, point, obj_index, inside);
 
 	if (hit) { // Shade point
 		//c = ofColor::white;
-		c = phong(point, getNormalRM(point), objects[obj_index]->diffuseColor, objects[obj_index]->specularColor, objects[obj_index]->power);
+		const Material &m = scene.materials[obj_index];
+		glm::vec3 normal = getNormalRM<K>(point);
+		notePixelHit({ glm::distance(r.p, point), point, normal, obj_index }, depth);
+		c = phong<K>(point, normal, m.diffuseColor, m.specularColor, m.power);
+		if (m.reflectivity > 0.0f || m.transparency > 0.0f)
+			c = specularColor<K>(r, point, normal, m, c, depth, weight);
 	}
 	else { // Draw background color of no ray was hit
 		c = background_color;
@@ -617,77 +848,333 @@ ofColor RayTracer::rayMarchLoop(const Ray &r) {
 } // end rayMarchLooop
 
 
+template <class K>
 glm::vec3 RayTracer::getNormalRM(const glm::vec3 &p) {
 	int obj_index;
 	float eps = 0.01f;
-	float dp = sceneSDF(p, obj_index);
+	float dp = sceneSDF<K>(p, obj_index);
 
-	glm::vec3 n(dp - sceneSDF(glm::vec3(p.x - eps, p.y, p.z), obj_index),
-		dp - sceneSDF(glm::vec3(p.x, p.y - eps, p.z), obj_index),
-		dp - sceneSDF(glm::vec3(p.x , p.y, p.z - eps), obj_index));
+	glm::vec3 n(dp - sceneSDF<K>(glm::vec3(p.x - eps, p.y, p.z), obj_index),
+		dp - sceneSDF<K>(glm::vec3(p.x, p.y - eps, p.z), obj_index),
+		dp - sceneSDF<K>(glm::vec3(p.x , p.y, p.z - eps), obj_index));
 
 	return glm::normalize(n);
 } // end getNormalRM
 
 
 
-//---Render ray traced scene--------------------------------------------------
-void RayTracer::render() {
-	cout << "Render Started" << endl;
+//---Color of pixel (i, j)--------------------------------------------
+template <class K>
+ofColor RayTracer::pixelColor(int i, int j, Sampler &sampler, SampleStats *stats) {
+	float width = final_image.getWidth();
+	float height = final_image.getHeight();
 
-	float before_time = ofGetElapsedTimeMillis();
+	// Convert each (i,j) into (u,v) (pixels in the rendercam image)
+	float u = (i + 0.5) / width;
+	float v = (j + 0.5) / height;
+
+	if (K::algo(*this) == RenderAlgo::pathtrace) { // path trace
+		glm::vec3 radiance(0.0f);
+		for (uint32_t s = 0; s < path_samples; s++) {
+			sampler.startSample(s);
+
+			// Jittered ray through the pixel
+			glm::vec2 jitter = sampler.get2D();
+			Ray ray = render_cam.getRay((i + jitter.x) / width, (j + jitter.y) / height);
+			glm::vec3 sample = pathTrace<K>(ray, sampler);
+			if (stats)
+				stats->add(sample * 255.0f);
+			radiance += sample;
+		}
+		radiance *= 255.0f / path_samples;
+
+		return ofColor(
+			std::fmin(255.0, radiance.x),
+			std::fmin(255.0, radiance.y),
+			std::fmin(255.0, radiance.z));
+	}
+
+	if (K::algo(*this) == RenderAlgo::raytrace && depth_of_field) // dof
+		return blurRayColor<K>(u, v, dof_samples, sampler, stats);
 
-	// For each pixel row
-	for (int j = 0; j < final_image.getHeight(); j++) {
-		// For each pixel in column
-		for (int i = 0; i < final_image.getWidth(); i++) {
+	// Single ray through the pixel center, or jittered rays when anti-aliasing
+	float c_r = 0.0f;
+	float c_g = 0.0f;
+	float c_b = 0.0f;
+	for (uint32_t s = 0; s < aa_samples; s++) {
+		if (aa_samples > 1) {
+			sampler.startSample(s);
+			glm::vec2 jitter = sampler.get2D();
+			u = (i + jitter.x) / width;
+			v = (j + jitter.y) / height;
+		}
 
-			// Convert each (i,j) into (u,v) (pixels in the rendercam image)
-			float u = (i + 0.5) / final_image.getWidth();
-			float v = (j + 0.5) / final_image.getHeight();
+		ofColor color = traceColor<K>(render_cam.getRay(u, v), 0, 1.0f, false);
+		if (stats)
+			stats->add(glm::vec3(color.r, color.g, color.b));
 
-			ofColor color;
+		c_r += color.r;
+		c_g += color.g;
+		c_b += color.b;
+	}
 
+	return ofColor(c_r / aa_samples, c_g / aa_samples, c_b / aa_samples);
+} // end pixelColor
 
-			if (ra == RenderAlgo::pathtrace) { // path trace
 
-				// Random number generator
-				// Uses Mersenne Twister number generator because rand() was much too slow
-				std::random_device rd;
-				std::mt19937 e2(rd());
-				std::uniform_real_distribution<> dist(0, 2);
+//---Feature buffers of pixel (i, j) from its center ray----------------
+void RayTracer::writeFeatures(int i, int j, const ofColor &color, const SampleStats &stats) {
+	int k = j * aux_buffers.width + i;
+	Ray ray = render_cam.getRay((i + 0.5f) / aux_buffers.width, (j + 0.5f) / aux_buffers.height);
 
-				// Ray casted to find focal length
-				Ray ray = render_cam.getRay(u, v);
+	aux_buffers.color[k] = glm::vec3(color.r, color.g, color.b);
+	aux_buffers.variance[k] = stats.meanVariance();
 
-				Rgb clr = { 0.0f, 0.0f, 0.0f };
+	if (ra == RenderAlgo::raymarch) {
+		glm::vec3 p;
+		int obj_index;
+		if (rayMarch<RuntimeKernel>(ray, p, obj_index)) {
+			const ofColor &diffuse = scene.materials[obj_index].diffuseColor;
+			aux_buffers.albedo[k] = glm::vec3(diffuse.r, diffuse.g, diffuse.b) / 255.0f;
+			aux_buffers.normal[k] = getNormalRM<RuntimeKernel>(p);
+			aux_buffers.depth[k] = glm::distance(ray.p, p);
+		}
+		return;
+	}
 
-				uint32_t depth = 0;
-				pathTrace(clr, ray, depth, e2, dist);
+	// Luminaires are only visible to the path tracer
+	Hit hit;
+	if (ra == RenderAlgo::hybrid ? hybridHit<RuntimeKernel>(ray, hit, false) : scene.intersect(ray, hit, ra == RenderAlgo::raytrace)) {
+		const Material &m = scene.materials[hit.id];
+		aux_buffers.albedo[k] = m.isLuminaire ? glm::vec3(1.0f) : hitAlbedo(hit);
+		aux_buffers.normal[k] = hit.normal;
+		aux_buffers.depth[k] = hit.t;
+	}
+} // end writeFeatures
 
-				color.r = clr.r / (depth + 2);
-				color.g = clr.g / (depth + 2);
-				color.b = clr.b / (depth + 2);
 
-				color.r = clr.r;
-				color.g = clr.g;
-				color.b = clr.b;
-			}
-			else if (ra == RenderAlgo::raytrace) { // dof
-				color = rayColor(u, v);
-				//ofColor color = blurRayColor(u, v, 0.3, 1000);
-				//color = blurRayColor(u, v, apeture_size, dof_samples);
+//---Compile the packed scene's distance function----------------------------
+// The shared object is cached by the hash of its source, so only a changed scene
+// compiles again
+void RayTracer::compileSceneSDF() {
+	compiled_sdf = nullptr;
+	compiled_march = false;
+	if (!jit_sdf || (ra != RenderAlgo::raymarch && ra != RenderAlgo::hybrid))
+		return;
+
+	SDFSource src;
+	if (!scene.writeSource(src, ra == RenderAlgo::hybrid)) {
+		cout << "Scene SDF: objects without generated code, using the interpreted distance" << endl;
+		return;
+	}
+
+	sdf_compiler.compiler = jit_compiler;
+	sdf_compiler.cache_dir = cache_dir;
+	compiled_sdf = sdf_compiler.compile(src.source());
+
+	// Repeated tori march faster by the empty cells marchDistance skips
+	compiled_march = compiled_sdf && !scene.hasRepeatedTori();
+} // end compileSceneSDF
+
+
+//---Bake, pack the scene and set up the camera for a frame-------------------
+void RayTracer::prepareFrame() {
+	bakeDistanceFields();
+
+	// Pack the scene for the render loops
+	scene.build(objects, baked_sdfs);
+	compileSceneSDF();
+	light_tree.build(light_refs, cone_refs);
+	prepared_lights.build(light_refs, cone_refs);
+	ambient_color = ambient_light.diffuseColor * ambient_light.intensity;
+	tile_kernel = selectKernel();
+
+	// Irradiance records are only valid for this frame's scene
+	irradiance_cache.clear();
+	irradiance_cache.accuracy = irradiance_accuracy;
+
+	// Camera basis and pixel deltas for this frame
+	render_cam.focal_dist = focal_dist;
+	render_cam.apeture_size = apeture_size;
+	render_cam.prepare(final_image.getWidth(), final_image.getHeight());
+	pixel_spread = render_cam.pixelSpread();
+
+	// Textures are paged in from the cache as rays hit them
+	TextureCache::instance().setCacheDir(cache_dir);
+	TextureCache::instance().setBudget(texture_budget);
+
+	// Feature buffers for the denoiser
+	if (output_aux || denoise)
+		aux_buffers.allocate(final_image.getWidth(), final_image.getHeight());
+
+	// Photon maps of this frame's lights and scene
+	if (ra == RenderAlgo::photonmap)
+		PhotonTracer(*this).trace();
+} // end prepareFrame
+
+
+//---Render the pixels [x0, x1) x [y0, y1) into the image--------------------
+// Uses the kernel prepareFrame picked for this frame
+void RayTracer::renderTile(int x0, int y0, int x1, int y1, uint32_t threads_used) {
+	(this->*tile_kernel)(x0, y0, x1, y1, threads_used);
+}
+
+
+template <class K>
+void RayTracer::renderTileKernel(int x0, int y0, int x1, int y1, uint32_t threads_used) {
+	bool aux = output_aux || denoise;
+
+	// One pinhole ray per pixel can be generated a row at a time
+	bool primary_only = K::algo(*this) != RenderAlgo::pathtrace && aa_samples == 1 && !(K::algo(*this) == RenderAlgo::raytrace && depth_of_field);
+	bool record = record_pixels && primary_only;
+
+	// Rows are handed out to the render threads through a shared counter
+	// Every pixel has its own sampler stream, so the image doesn't depend on the thread count
+	std::atomic<int> next_row(y0);
+	auto renderRows = [&]() {
+		RayBatch batch;
+		for (int j = next_row++; j < y1; j = next_row++) {
+			if (primary_only) {
+				render_cam.generateRays(x0, j, x1, j + 1, batch);
+				for (int i = x0; i < x1; i++) {
+					Ray ray = batch.get(i - x0);
+					if (record)
+						beginPixelRecord();
+					ofColor color = traceColor<K>(ray, 0, 1.0f, false);
+					if (record)
+						endPixelRecord(i, j);
+					final_image.setColor(i, j, color);
+					if (aux)
+						writeFeatures(i, j, color, SampleStats());
+				}
+				continue;
 			}
-			else { // Ray march
-				Ray ray = render_cam.getRay(u, v);
-				color = rayMarchLoop(ray);
+
+			for (int i = x0; i < x1; i++) {
+				Sampler sampler(Sampler::pixelStream(i, j), sampler_seed);
+				SampleStats stats;
+
+				// set final color
+				ofColor color = pixelColor<K>(i, j, sampler, aux ? &stats : nullptr);
+				final_image.setColor(i, j, color);
+				if (aux)
+					writeFeatures(i, j, color, stats);
 			}
+		}
+	};
+
+	vector<std::thread> threads;
+	for (uint32_t t = 0; t < std::max(1u, threads_used); t++)
+		threads.push_back(std::thread(renderRows));
+	for (auto &thread : threads)
+		thread.join();
+} // end renderTileKernel
+
+
+//---Dispatch table of the fixed kernels-------------------------------------
+template <RenderAlgo A>
+RayTracer::TileKernel RayTracer::kernelFor(bool shadows, bool textures, bool cones) {
+	static const TileKernel kernels[8] = {
+		&RayTracer::renderTileKernel<FixedKernel<A, false, false, false>>,
+		&RayTracer::renderTileKernel<FixedKernel<A, false, false, true>>,
+		&RayTracer::renderTileKernel<FixedKernel<A, false, true, false>>,
+		&RayTracer::renderTileKernel<FixedKernel<A, false, true, true>>,
+		&RayTracer::renderTileKernel<FixedKernel<A, true, false, false>>,
+		&RayTracer::renderTileKernel<FixedKernel<A, true, false, true>>,
+		&RayTracer::renderTileKernel<FixedKernel<A, true, true, false>>,
+		&RayTracer::renderTileKernel<FixedKernel<A, true, true, true>>
+	};
+	return kernels[shadows * 4 + textures * 2 + cones];
+}
+
+
+// Kernel matching the packed scene and the settings of this frame
+RayTracer::TileKernel RayTracer::selectKernel() {
+	bool cones = prepared_lights.size() > prepared_lights.num_points;
+	bool textures = false;
+	for (const auto &m : scene.materials)
+		textures = textures || m.texture_ref;
+
+	switch (ra) {
+	case RenderAlgo::raytrace: return kernelFor<RenderAlgo::raytrace>(bshadow, textures, cones);
+	case RenderAlgo::pathtrace: return kernelFor<RenderAlgo::pathtrace>(bshadow, textures, cones);
+	case RenderAlgo::raymarch: return kernelFor<RenderAlgo::raymarch>(bshadow, textures, cones);
+	case RenderAlgo::hybrid: return kernelFor<RenderAlgo::hybrid>(bshadow, textures, cones);
+	case RenderAlgo::photonmap: return kernelFor<RenderAlgo::photonmap>(bshadow, textures, cones);
+	}
+	return &RayTracer::renderTileKernel<RuntimeKernel>;
+} // end selectKernel
+
+
+//---Render ray traced scene--------------------------------------------------
+void RayTracer::render() {
+	cout << "Render Started" << endl;
+
+	float before_time = ofGetElapsedTimeMillis();
+
+	prepareFrame();
+
+	int width = final_image.getWidth();
+	int height = final_image.getHeight();
+
+	// The wavefront tracer doesn't guide its paths
+	if (ra == RenderAlgo::pathtrace && path_guiding && !wavefront)
+		trainGuide(0, height);
+
+	// Records need one ray per pixel traced in this process, and the unfiltered image
+	record_pixels = pixel_records && render_workers == 0 && ra != RenderAlgo::pathtrace && aa_samples == 1
+		&& !(ra == RenderAlgo::raytrace && depth_of_field) && !denoise;
+	if (record_pixels)
+		records.allocate(width, height);
+	else
+		records.valid = false;
+
+	if (render_workers > 0) {
+		TileCoordinator(*this).render();
+	}
+	else if (ra == RenderAlgo::pathtrace && wavefront) {
+		WavefrontTracer(*this).render();
+	}
+	else {
+		renderTile(0, 0, width, height, num_threads);
+	}
+
+	if (record_pixels) {
+		records.valid = true;
+		records.frame_key = frameKey();
+		record_pixels = false;
+	}
+
+	if (ra == RenderAlgo::pathtrace && irradiance_caching)
+		cout << "Irradiance records: " << irradiance_cache.size() << endl;
+
+	if (ra == RenderAlgo::photonmap) {
+		uint64_t queries = global_photons.numQueries() + caustic_photons.numQueries();
+		double query_ms = global_photons.queryMillis() + caustic_photons.queryMillis();
+		cout << "Photon queries: " << queries << ", " << (queries > 0 ? query_ms * 1000.0 / queries : 0.0)
+			<< "us each, " << query_ms << "ms on all threads" << endl;
+	}
 
-			// set final color
-			final_image.setColor(i, j, color);
-				
+	if (output_aux)
+		aux_buffers.save("../../images/raytrace");
+
+	// Replace the image with the filtered color
+	if (denoise) {
+		float denoise_time = ofGetElapsedTimeMillis();
+		if (!final_image.save("../../images/raytrace_noisy.png"))
+			cerr << "Could not save render file" << endl;
+
+		vector<glm::vec3> filtered;
+		denoiser.denoise(aux_buffers, filtered, num_threads);
+		for (int k = 0; k < filtered.size(); k++) {
+			final_image.setColor(k % width, k / width, ofColor(
+				std::fmin(255.0, filtered[k].x),
+				std::fmin(255.0, filtered[k].y),
+				std::fmin(255.0, filtered[k].z)));
 		}
+		cout << "Denoise time: " << ofGetElapsedTimeMillis() - denoise_time << "ms" << endl;
 	}
+
 	// Save image to disk
 	if (!final_image.save("../../images/raytrace_image.png"))
 		cerr << "Could not save render file" << endl;
@@ -697,3 +1184,454 @@ void RayTracer::render() {
 } // end render
 
 
+//---Pixel records of the thread's current pixel-------------------------------
+void RayTracer::beginPixelRecord() {
+	pixel_trace.active = true;
+	pixel_trace.primary.id = -1;
+	pixel_trace.deps = 0;
+}
+
+void RayTracer::endPixelRecord(int i, int j) {
+	int k = j * records.width + i;
+	const Hit &hit = pixel_trace.primary;
+	records.hits[k] = hit;
+	records.deps[k] = pixel_trace.deps;
+	records.traced[k] = hit.id >= 0 && (scene.materials[hit.id].reflectivity > 0.0f || scene.materials[hit.id].transparency > 0.0f);
+	records.dirty[k] = 0;
+	pixel_trace.active = false;
+}
+
+
+// Settings that decide where the primary rays go, records of another key are stale
+string RayTracer::frameKey() {
+	ostringstream key;
+	const RenderCam &c = render_cam;
+	key << ra << " " << final_image.getWidth() << " " << final_image.getHeight() << " "
+		<< c.position.x << " " << c.position.y << " " << c.position.z << " "
+		<< c.aim.x << " " << c.aim.y << " " << c.aim.z << " "
+		<< c.up.x << " " << c.up.y << " " << c.up.z << " " << c.view_dist << " "
+		<< max_trace_depth << " " << min_ray_weight << " " << max_ray_steps << " " << distance_threshold;
+	return key.str();
+}
+
+
+//---Mark the pixels an edit changes--------------------------------------------
+// Photons carry every material's color through the scene, so a photon mapped
+// frame changes wherever there is a surface
+void RayTracer::markDirty(SceneObject *o) {
+	auto found = std::find(objects.begin(), objects.end(), o);
+	if (!records.valid || found == objects.end())
+		return;
+
+	uint64_t bit = PixelRecords::bit(found - objects.begin());
+	for (int k = 0; k < records.deps.size(); k++) {
+		if ((records.deps[k] & bit) || (ra == RenderAlgo::photonmap && records.hits[k].id >= 0))
+			records.dirty[k] = 1;
+	}
+}
+
+void RayTracer::markLightsDirty() {
+	for (int k = 0; k < records.hits.size(); k++) {
+		if (records.hits[k].id >= 0)
+			records.dirty[k] = 1;
+	}
+}
+
+void RayTracer::markGeometryDirty() {
+	records.valid = false;
+}
+
+
+//---Shade a kept primary hit as the render did-------------------------------
+template <class K>
+ofColor RayTracer::reshade(const Ray &ray, const Hit &hit) {
+	const Material &m = scene.materials[hit.id];
+	if (K::algo(*this) == RenderAlgo::raymarch)
+		return phong<K>(hit.point, hit.normal, m.diffuseColor, m.specularColor, m.power);
+	if (K::algo(*this) == RenderAlgo::photonmap) {
+		if (m.isLuminaire) {
+			float e = std::fmin(255.0f, m.emission * 255.0f);
+			return ofColor(e, e, e);
+		}
+		return photonShade<K>(ray, hit);
+	}
+	return shadeHit<K>(hit);
+} // end reshade
+
+
+//---Render the pixels edits marked------------------------------------------
+// Pixels whose surface doesn't reflect or refract are shaded from their kept hit,
+// the others trace their rays again. Without valid records it's a full render
+void RayTracer::renderDirty() {
+	if (!records.valid || records.frame_key != frameKey() || !pixel_records) {
+		render();
+		return;
+	}
+
+	float before_time = ofGetElapsedTimeMillis();
+
+	int width = records.width;
+	int height = records.height;
+	vector<int> pixels;
+	for (int k = 0; k < width * height; k++) {
+		if (records.dirty[k])
+			pixels.push_back(k);
+	}
+	if (pixels.empty()) {
+		cout << "No pixels marked for re-rendering" << endl;
+		return;
+	}
+
+	// Materials, lights and photons of the edited scene
+	prepareFrame();
+
+	const int chunk = 256;
+	std::atomic<int> next(0);
+	std::atomic<int> reshaded(0);
+	auto renderPixels = [&]() {
+		for (int c = next++; c * chunk < pixels.size(); c = next++) {
+			int end = std::min(static_cast<int>(pixels.size()), (c + 1) * chunk);
+			for (int p = c * chunk; p < end; p++) {
+				int k = pixels[p];
+				int i = k % width;
+				int j = k / width;
+				Ray ray = render_cam.getRay((i + 0.5f) / width, (j + 0.5f) / height);
+
+				// The material may have become a mirror or glass since the render
+				const Hit &hit = records.hits[k];
+				const Material &m = scene.materials[hit.id];
+				ofColor color;
+				if (!records.traced[k] && m.reflectivity <= 0.0f && m.transparency <= 0.0f) {
+					color = reshade<RuntimeKernel>(ray, hit);
+					records.dirty[k] = 0;
+					reshaded++;
+				}
+				else {
+					beginPixelRecord();
+					color = traceColor<RuntimeKernel>(ray, 0, 1.0f, false);
+					endPixelRecord(i, j);
+				}
+				final_image.setColor(i, j, color);
+			}
+		}
+	};
+
+	vector<std::thread> threads;
+	for (uint32_t t = 0; t < std::max(1u, num_threads); t++)
+		threads.push_back(std::thread(renderPixels));
+	for (auto &thread : threads)
+		thread.join();
+
+	if (!final_image.save("../../images/raytrace_image.png"))
+		cerr << "Could not save render file" << endl;
+
+	cout << "Re-rendered " << pixels.size() << " of " << width * height << " pixels, " << reshaded
+		<< " from their kept hits, " << ofGetElapsedTimeMillis() - before_time << "ms" << endl;
+} // end renderDirty
+
+
+//---Render within a time budget-----------------------------------------------
+// Every tile is rendered at level 1 before any goes higher, after that the tile
+// whose pixels changed most at its last level goes next. A tile is only started when
+// its estimated time fits before the deadline: twice its last level's time, or the
+// mean time per pixel of level 1 for its first
+BudgetResult RayTracer::renderBudgeted(float budget_ms) {
+	float start = ofGetElapsedTimeMillis();
+	float deadline = start + budget_ms;
+	int levels = std::max(1, budget_levels);
+
+	// Full settings, restored at the end
+	const uint32_t full_aa = aa_samples, full_paths = path_samples, full_dof = dof_samples;
+	const uint32_t full_trace_depth = max_trace_depth, full_bounces = max_depth, full_steps = max_ray_steps;
+	const float full_threshold = distance_threshold;
+	const bool saved_aux = output_aux, saved_denoise = denoise, saved_guiding = path_guiding;
+	output_aux = false;
+	denoise = false;
+	path_guiding = false;
+
+	// Level l scales the full settings by 2^(l - levels)
+	auto setLevel = [&](int level) {
+		float f = std::ldexp(1.0f, std::max(level, 1) - levels);
+		auto scaled = [f](uint32_t full, uint32_t least) { return std::min(full, std::max(least, static_cast<uint32_t>(full * f + 0.5f))); };
+		aa_samples = scaled(full_aa, 1);
+		path_samples = scaled(full_paths, 1);
+		dof_samples = scaled(full_dof, 1);
+		max_trace_depth = scaled(full_trace_depth, 1);
+		max_depth = scaled(full_bounces, 2);
+		max_ray_steps = scaled(full_steps, 32);
+		distance_threshold = full_threshold / f;
+	};
+
+	prepareFrame();
+	int width = final_image.getWidth();
+	int height = final_image.getHeight();
+
+	// The image won't match the pixel records of the last full render
+	records.valid = false;
+
+	// Level 0, the center pixel of each 4x4 block fills the block
+	setLevel(0);
+	const int block = 4;
+	int blocks_x = (width + block - 1) / block;
+	int blocks_y = (height + block - 1) / block;
+	std::atomic<int> next_row(0);
+	auto renderBlocks = [&]() {
+		for (int by = next_row++; by < blocks_y; by = next_row++) {
+			for (int bx = 0; bx < blocks_x; bx++) {
+				int i = std::min(bx * block + block / 2, width - 1);
+				int j = std::min(by * block + block / 2, height - 1);
+				Sampler sampler(Sampler::pixelStream(i, j), sampler_seed);
+				ofColor color = pixelColor<RuntimeKernel>(i, j, sampler, nullptr);
+				for (int y = by * block; y < std::min(height, (by + 1) * block); y++) {
+					for (int x = bx * block; x < std::min(width, (bx + 1) * block); x++)
+						final_image.setColor(x, y, color);
+				}
+			}
+		}
+	};
+	vector<std::thread> threads;
+	for (uint32_t t = 0; t < std::max(1u, num_threads); t++)
+		threads.push_back(std::thread(renderBlocks));
+	for (auto &thread : threads)
+		thread.join();
+
+	struct Tile {
+		int x0, y0, x1, y1;
+		int level;
+		float change;    // mean channel change of the last level, the error estimate
+		float ms;        // time of the last level
+	};
+	vector<Tile> tiles;
+	int size = std::max(8, tile_size);
+	for (int y = 0; y < height; y += size) {
+		for (int x = 0; x < width; x += size)
+			tiles.push_back({ x, y, std::min(width, x + size), std::min(height, y + size), 0, 0.0f, 0.0f });
+	}
+
+	double level1_ms = 0.0;
+	double level1_pixels = 0.0;
+	vector<ofColor> before;
+	for (;;) {
+		float now = ofGetElapsedTimeMillis();
+		if (now >= deadline)
+			break;
+
+		// Tile to render next among those that fit before the deadline
+		int best = -1;
+		for (int t = 0; t < tiles.size(); t++) {
+			const Tile &tile = tiles[t];
+			if (tile.level >= levels)
+				continue;
+			float area = static_cast<float>((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+			float estimate = tile.level == 0 ? (level1_pixels > 0.0 ? area * level1_ms / level1_pixels : 0.0f) : 2.0f * tile.ms;
+			if (now + estimate > deadline)
+				continue;
+			if (best < 0 || (tile.level == 0) > (tiles[best].level == 0)
+				|| ((tile.level == 0) == (tiles[best].level == 0) && tile.change > tiles[best].change))
+				best = t;
+		}
+		if (best < 0)
+			break;
+
+		Tile &tile = tiles[best];
+		before.clear();
+		for (int y = tile.y0; y < tile.y1; y++) {
+			for (int x = tile.x0; x < tile.x1; x++)
+				before.push_back(final_image.getColor(x, y));
+		}
+
+		tile.level++;
+		setLevel(tile.level);
+		renderTile(tile.x0, tile.y0, tile.x1, tile.y1, num_threads);
+		tile.ms = ofGetElapsedTimeMillis() - now;
+
+		double change = 0.0;
+		int k = 0;
+		for (int y = tile.y0; y < tile.y1; y++) {
+			for (int x = tile.x0; x < tile.x1; x++, k++) {
+				ofColor c = final_image.getColor(x, y);
+				change += std::abs(c.r - before[k].r) + std::abs(c.g - before[k].g) + std::abs(c.b - before[k].b);
+			}
+		}
+		tile.change = change / (3.0 * k);
+		if (tile.level == 1) {
+			level1_ms += tile.ms;
+			level1_pixels += k;
+		}
+	}
+
+	aa_samples = full_aa;
+	path_samples = full_paths;
+	dof_samples = full_dof;
+	max_trace_depth = full_trace_depth;
+	max_depth = full_bounces;
+	max_ray_steps = full_steps;
+	distance_threshold = full_threshold;
+	output_aux = saved_aux;
+	denoise = saved_denoise;
+	path_guiding = saved_guiding;
+
+	BudgetResult result = { levels, 0, 0.0f, 0.0f };
+	double level_sum = 0.0;
+	for (const auto &tile : tiles) {
+		result.min_level = std::min(result.min_level, tile.level);
+		result.max_level = std::max(result.max_level, tile.level);
+		level_sum += static_cast<double>(tile.level) * (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+	}
+	result.mean_level = level_sum / (static_cast<double>(width) * height);
+
+	if (!final_image.save("../../images/raytrace_image.png"))
+		cerr << "Could not save render file" << endl;
+
+	result.ms = ofGetElapsedTimeMillis() - start;
+	cout << "Budgeted render: levels " << result.min_level << " to " << result.max_level << " of " << levels
+		<< ", mean " << result.mean_level << ", " << result.ms << "ms of " << budget_ms << "ms" << endl;
+	return result;
+} // end renderBudgeted
+
+
+//---Learn the incident light of the scene for path guiding--------------------
+// Training pass k renders rows [y0, y1) with 2^k samples per pixel, drawing from what
+// the passes before it learned and recording into the refined trees
+void RayTracer::trainGuide(int y0, int y1) {
+	float before_time = ofGetElapsedTimeMillis();
+
+	// Space of the bounded objects, the lights and the camera, points outside it use
+	// the nearest region
+	glm::vec3 bmin(std::numeric_limits<float>::infinity());
+	glm::vec3 bmax = -bmin;
+	auto grow = [&](const glm::vec3 &p) {
+		bmin = glm::min(bmin, p);
+		bmax = glm::max(bmax, p);
+	};
+	for (auto o : objects) {
+		glm::vec3 omin, omax;
+		if (o->getBounds(omin, omax)) {
+			grow(omin);
+			grow(omax);
+		}
+	}
+	for (auto light : light_refs)
+		grow(light->position);
+	for (auto cone : cone_refs)
+		grow(cone->position);
+	grow(render_cam.position);
+
+	path_guide.memory_budget = guide_memory;
+	path_guide.reset(bmin, bmax);
+
+	// Every pass gets fresh samples
+	uint32_t samples = path_samples;
+	uint32_t seed = sampler_seed;
+	guide_recording = true;
+	for (uint32_t pass = 0; pass < guide_training_passes; pass++) {
+		path_samples = 1u << pass;
+		sampler_seed = seed + pass + 1;
+		renderTile(0, y0, final_image.getWidth(), y1, num_threads);
+		path_guide.refine(pass);
+	}
+	guide_recording = false;
+	path_samples = samples;
+	sampler_seed = seed;
+
+	cout << "Path guide: " << guide_training_passes << " training passes, " << path_guide.numLeaves() << " regions, "
+		<< path_guide.memoryUsage() / 1024 << "KB, " << ofGetElapsedTimeMillis() - before_time << "ms" << endl;
+} // end trainGuide
+
+
+//---Time the specialized kernel against the runtime configured one-----------
+// Both render the same band of rows, the best of the runs is reported per pixel.
+// The runs alternate so drift in the machine's speed reaches both kernels alike
+void RayTracer::benchmarkKernels(int rows, int runs) {
+	prepareFrame();
+
+	int width = final_image.getWidth();
+	int height = final_image.getHeight();
+	int y0 = std::max(0, (height - rows) / 2);
+	int y1 = std::min(height, y0 + rows);
+	float pixels = static_cast<float>(width) * (y1 - y0);
+
+	auto time = [&](TileKernel kernel) {
+		uint64_t start = ofGetElapsedTimeMicros();
+		(this->*kernel)(0, y0, width, y1, num_threads);
+		return ofGetElapsedTimeMicros() - start;
+	};
+
+	uint64_t runtime_best = std::numeric_limits<uint64_t>::max();
+	uint64_t fixed_best = std::numeric_limits<uint64_t>::max();
+	for (int r = 0; r < runs; r++) {
+		runtime_best = std::min(runtime_best, time(&RayTracer::renderTileKernel<RuntimeKernel>));
+		fixed_best = std::min(fixed_best, time(tile_kernel));
+	}
+	float runtime_ns = runtime_best * 1000.0f / pixels;
+	float fixed_ns = fixed_best * 1000.0f / pixels;
+
+	cout << "Kernel benchmark, " << width << "x" << y1 - y0 << " pixels, best of " << runs << endl;
+	cout << "  runtime configuration: " << runtime_ns << "ns per pixel" << endl;
+	cout << "  specialized kernel:    " << fixed_ns << "ns per pixel" << endl;
+	cout << "  speedup: " << runtime_ns / fixed_ns << "x" << endl;
+} // end benchmarkKernels
+
+
+//---Path guiding against plain path tracing over a band of rows----------------
+// Efficiency is the inverse of the mean pixel variance times the render time, its
+// ratio is the variance reduction at equal time
+void RayTracer::benchmarkGuiding(int rows) {
+	RenderAlgo saved_ra = ra;
+	bool saved_guiding = path_guiding;
+	ra = RenderAlgo::pathtrace;
+	path_guiding = false;
+	prepareFrame();
+
+	int width = final_image.getWidth();
+	int height = final_image.getHeight();
+	int y0 = std::max(0, (height - rows) / 2);
+	int y1 = std::min(height, y0 + rows);
+
+	// Mean over the band of the variance of each pixel's estimate
+	auto bandVariance = [&]() {
+		std::atomic<int> next_row(y0);
+		vector<double> sums(std::max(1u, num_threads), 0.0);
+		auto renderRows = [&](int t) {
+			for (int j = next_row++; j < y1; j = next_row++) {
+				for (int i = 0; i < width; i++) {
+					Sampler sampler(Sampler::pixelStream(i, j), sampler_seed);
+					SampleStats stats;
+					pixelColor<RuntimeKernel>(i, j, sampler, &stats);
+					sums[t] += stats.meanVariance();
+				}
+			}
+		};
+		vector<std::thread> threads;
+		for (int t = 0; t < sums.size(); t++)
+			threads.push_back(std::thread(renderRows, t));
+		for (auto &thread : threads)
+			thread.join();
+
+		double sum = 0.0;
+		for (double s : sums)
+			sum += s;
+		return sum / (static_cast<double>(width) * (y1 - y0));
+	};
+
+	float start = ofGetElapsedTimeMillis();
+	double plain_variance = bandVariance();
+	float plain_ms = ofGetElapsedTimeMillis() - start;
+
+	path_guiding = true;
+	start = ofGetElapsedTimeMillis();
+	trainGuide(y0, y1);
+	float train_ms = ofGetElapsedTimeMillis() - start;
+	double guided_variance = bandVariance();
+	float guided_ms = ofGetElapsedTimeMillis() - start;
+
+	cout << "Path guiding benchmark, " << width << "x" << y1 - y0 << " pixels, " << path_samples << " samples per pixel" << endl;
+	cout << "  plain:  variance " << plain_variance << ", " << plain_ms << "ms" << endl;
+	cout << "  guided: variance " << guided_variance << ", " << guided_ms << "ms with training ("
+		<< train_ms << "ms training, " << guided_ms - train_ms << "ms render)" << endl;
+	if (guided_variance > 0.0 && guided_ms > 0.0f)
+		cout << "  variance reduction at equal time: " << (plain_variance * plain_ms) / (guided_variance * guided_ms) << "x" << endl;
+
+	ra = saved_ra;
+	path_guiding = saved_guiding;
+} // end benchmarkGuiding
@@ -5,32 +5,59 @@
 #pragma once
 
 #include <random>
+#include <thread>
 
 #include "ofApp.h"
 #include "Ray.h"
 #include "SceneObjects.h"
 #include "CamObjects.h"
 #include "LightObjects.h"
+#include "DistanceField.h"
+#include "SceneData.h"
+#include "LightTree.h"
+#include "PreparedLights.h"
+#include "IrradianceCache.h"
+#include "PhotonMap.h"
+#include "PathGuide.h"
+#include "PixelRecords.h"
+#include "Sampling.h"
+#include "Sampler.h"
+#include "Denoiser.h"
 #include "glm/gtx/perpendicular.hpp"
 
 
-typedef struct {
-	float r;
-	float g;
-	float b;
-} Rgb;
-
-
 enum RenderAlgo {
 	raytrace,
 	pathtrace,
-	raymarch
+	raymarch,
+	hybrid,      // Exact hits for objects that have them, marching for the rest
+	photonmap    // Ray traced direct light, photon density estimates for caustics and indirect light
+};
+
+// How phong gathers the point and cone lights
+enum LightMode {
+	all_lights,       // Every light is shaded
+	cull_lights,      // Lights below the cull threshold are skipped
+	sample_lights     // A few lights are importance sampled from the light tree
+};
+
+// Quality a budgeted render reached. Level 0 is one pixel per 4x4 block, the top level
+// is the full settings, and each level below it halves the samples, bounces and steps
+struct BudgetResult {
+	int min_level;
+	int max_level;
+	float mean_level;    // over the pixels
+	float ms;
 };
 
 /*
 	Ray Tracer object
 */
 class RayTracer {
+	friend class WavefrontTracer;
+	friend class TileCoordinator;
+	friend class PhotonTracer;
+
 public:
 	// Constructor
 	RayTracer();
@@ -43,6 +70,28 @@ public:
 	// Render functions
 	void render();
 
+	// Render within budget_ms, a coarse pass first, then tiles are rendered again a level
+	// higher, those the last level changed most first, while the deadline allows
+	BudgetResult renderBudgeted(float budget_ms);
+
+	// Time the frame's specialized kernel against the runtime configured one
+	// over a band of rows through the middle of the image
+	void benchmarkKernels(int rows = 64, int runs = 3);
+
+	// Pixel variance and time of path tracing with and without path guiding over a band
+	// of rows, the guided time includes training
+	void benchmarkGuiding(int rows = 64);
+
+	// Incremental re-rendering, renders with pixel_records set keep every pixel's hit.
+	// Edits mark the pixels they change, renderDirty shades only those again: from the
+	// kept hit without tracing the pixel, unless its surface reflects or refracts.
+	// The app has no editing UI, code that changes objects or lights calls the mark
+	// functions itself; 'u' only renders what they marked
+	void markDirty(SceneObject *o);     // o's material changed
+	void markLightsDirty();             // lights moved or changed
+	void markGeometryDirty();           // objects moved, added or removed, renderDirty renders everything
+	void renderDirty();
+
 	// Return scene object references
 	vector<SceneObject*> getSceneObjects();
 
@@ -56,36 +105,228 @@ public:
 	float focal_dist;
 	uint32_t dof_samples;
 	uint32_t max_depth;
-	float apeture_size;
+	uint32_t path_samples = 16;    // Paths per pixel
+	bool wavefront = false;        // Path trace in bulk stages over ray queues
+	int wavefront_rows = 64;       // Image rows per wavefront tile set
+	float apeture_size;            // Lens radius of the render camera
+	bool depth_of_field = false;
+	uint32_t max_trace_depth = 8;      // Reflection and refraction bounces of raytrace and raymarch
+	float min_ray_weight = 0.02f;      // Secondary rays contributing less than this are not traced
+	uint32_t aa_samples = 1;           // Jittered rays per pixel for raytrace and raymarch
+
+	// Quality levels of renderBudgeted above the coarse pass, the top one is the full settings
+	int budget_levels = 4;
+
+	// Keep per pixel hits for renderDirty, for the algorithms that trace one ray per pixel
+	bool pixel_records = false;
+
+	// Sampling and threading
+	uint32_t sampler_seed = 0;         // Same seed gives the same image
+	uint32_t num_threads = std::thread::hardware_concurrency();
+
+	// Multi process rendering, the threads are split between the worker processes
+	uint32_t render_workers = 0;       // Worker processes, 0 renders in this process
+	int tile_size = 64;                // Tile edge in pixels handed to a worker
+	float worker_timeout = 60000;      // ms a worker may take on a tile before its speed is measured
 
 	RenderAlgo ra = RenderAlgo::raymarch;
 
+	// Many light shading
+	LightMode light_mode = LightMode::all_lights;
+	float light_cull_threshold = 0.004f;    // Inverse square intensity of about one 8 bit color step
+	uint32_t light_samples = 4;
+
+	// Baked distance fields for expensive sdf objects
+	bool bake_sdf = false;
+	float bake_voxel_size = 0.25f;
+	glm::vec3 bake_min = glm::vec3(-60, -40, -100);    // Bake region for unbounded objects
+	glm::vec3 bake_max = glm::vec3(60, 40, 0);
+	string cache_dir = "../../cache/";
+
+	// Ray marched scenes compile their distance function to a shared object, the
+	// interpreted loop stays in use when that fails or an object has no code
+	bool jit_sdf = false;
+	string jit_compiler = "c++";
+
+	// Irradiance caching of the indirect light at camera hits of the per pixel path tracer
+	// Records depend on which thread got to a point first, so the image does too
+	bool irradiance_caching = false;
+	uint32_t irradiance_samples = 256;     // Hemisphere rays traced for a record
+	float irradiance_accuracy = 0.2f;      // Largest error a record is used at
+	float irradiance_min_pixels = 2.0f;    // Record radius limits in pixel footprints
+	float irradiance_max_pixels = 40.0f;
+
+	// Path guiding of the per pixel path tracer
+	bool path_guiding = false;
+	uint32_t guide_training_passes = 5;    // Training pass k takes 2^k samples per pixel
+	float guide_fraction = 0.5f;           // Share of the bounces drawn from the guide
+	size_t guide_memory = 64 << 20;        // Bytes of the directional trees
+
+	// Photon mapping
+	uint32_t photon_count = 500000;        // Photons emitted per frame
+	uint32_t photon_bounces = 8;
+	int photon_gather_count = 100;         // Nearest photons of a density estimate
+	float photon_gather_radius = 2.0f;     // Largest radius of a density estimate
+	uint32_t photon_final_gather = 0;      // Final gather rays per shading point, 0 uses the photons there
+	uint32_t photon_light_samples = 4;     // Luminaire samples per shading point
+
+	// Texture tiles kept in memory, the rest are paged in from the texture cache on use
+	size_t texture_budget = 256 << 20;
+
+	// Feature buffers and denoising
+	bool output_aux = false;           // Save albedo, normal, depth and variance images
+	bool denoise = false;              // Filter the image with the feature buffers
+	Denoiser denoiser;
+
 private:
-	ofColor texture_lookup(const ofImage &texture, float u, float v);
+	/*
+		Render kernels
+		- The per pixel functions are templates over a kernel type that answers the
+		  render configuration questions they used to branch on
+		- A fixed kernel answers them at compile time, so each configuration is its own
+		  code with the dead paths removed
+		- The runtime kernel reads the settings, it shades like any configuration and is
+		  the baseline of benchmarkKernels
+	*/
+	template <RenderAlgo A, bool Shadows, bool Textures, bool Cones>
+	struct FixedKernel {
+		static RenderAlgo algo(const RayTracer &) { return A; }
+		static bool shadows(const RayTracer &) { return Shadows; }     // point light shadows
+		static bool textures(const RayTracer &) { return Textures; }   // any textured material
+		static bool cones(const RayTracer &) { return Cones; }         // any cone light
+	};
+
+	struct RuntimeKernel {
+		static RenderAlgo algo(const RayTracer &rt) { return rt.ra; }
+		static bool shadows(const RayTracer &rt) { return rt.bshadow; }
+		static bool textures(const RayTracer &) { return true; }
+		static bool cones(const RayTracer &) { return true; }
+	};
+
+	// Tile renderer of one kernel, render picks one per frame from the dispatch table
+	typedef void (RayTracer::*TileKernel)(int x0, int y0, int x1, int y1, uint32_t threads_used);
+	TileKernel selectKernel();
+	template <RenderAlgo A>
+	TileKernel kernelFor(bool shadows, bool textures, bool cones);
+	template <class K>
+	void renderTileKernel(int x0, int y0, int x1, int y1, uint32_t threads_used);
+	TileKernel tile_kernel = nullptr;
+
+	ofColor texture_lookup(TiledTexture &texture, float u, float v, float t);
+	template <class K>
 	bool inShadow(Ray r);
+	template <class K>
+	bool lightShadowed(const PreparedLights &lights, int i, const glm::vec3 &p, const glm::vec3 &norm);
+	template <class K>
 	ofColor phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power);
-	ofColor rayColor(float u, float v);
+	void prepareFrame();
+	void renderTile(int x0, int y0, int x1, int y1, uint32_t threads_used);
+	template <class K>
+	ofColor pixelColor(int i, int j, Sampler &sampler, SampleStats *stats = nullptr);
+	template <class K>
+	ofColor shadeHit(const Hit &hit);
+	ofColor shadeHit(const Hit &hit);
+	template <class K>
+	ofColor rayColor(const Ray &ray, uint32_t depth = 0, float weight = 1.0f);
+
+	// Reflection and refraction
+	template <class K>
+	ofColor specularColor(const Ray &ray, const glm::vec3 &p, const glm::vec3 &normal, const Material &m, const ofColor &local, uint32_t depth, float weight);
+	template <class K>
+	ofColor traceColor(const Ray &ray, uint32_t depth, float weight, bool inside);
+	template <class K>
+	bool hybridHit(const Ray &ray, Hit &hit, bool inside);
+	template <class K>
+	ofColor hybridColor(const Ray &ray, uint32_t depth, float weight, bool inside);
 	
 	// Dof
-	ofColor blurRayColor(float u, float v, float eye_radius, uint32_t num_sample);
+	template <class K>
+	ofColor blurRayColor(float u, float v, uint32_t num_sample, Sampler &sampler, SampleStats *stats = nullptr);
+	template <class K>
 	ofColor rayColorFromRay(Ray r);
 	
 	// Path tracing
-	void colorToRgb(Rgb &r, ofColor &c);
-	void pathTrace(Rgb &clr, Ray r, uint32_t depth, std::mt19937 &e2, std::uniform_real_distribution<> &dist);
+	glm::vec3 hitAlbedo(const Hit &hit);
+	float luminairePdf(const glm::vec3 &p, int id);
+	template <class K>
+	glm::vec3 pathTrace(Ray r, Sampler &sampler, bool indirect = false, float *first_t = nullptr);
+	template <class K>
+	glm::vec3 cachedIrradiance(const glm::vec3 &p, const glm::vec3 &n);
+
+	// Path guiding
+	void trainGuide(int y0, int y1);
+
+	// Photon mapping
+	template <class K>
+	ofColor photonColor(const Ray &ray, uint32_t depth, float weight);
+	template <class K>
+	ofColor photonShade(const Ray &ray, const Hit &hit);
+	glm::vec3 luminaireIrradiance(const glm::vec3 &p, const glm::vec3 &n, Sampler &sampler);
+	glm::vec3 finalGather(const glm::vec3 &p, const glm::vec3 &n, Sampler &sampler);
+
+	// Feature buffers
+	void writeFeatures(int i, int j, const ofColor &color, const SampleStats &stats);
+
+	// Baked distance fields
+	void bakeDistanceFields();
+
+	// Incremental re-rendering
+	struct PixelTrace {
+		bool active = false;
+		Hit primary;
+		uint64_t deps = 0;
+	};
+	static thread_local PixelTrace pixel_trace;    // the pixel a thread is recording
+
+	void notePixelHit(const Hit &hit, uint32_t depth) {
+		if (!pixel_trace.active)
+			return;
+		if (depth == 0)
+			pixel_trace.primary = hit;
+		pixel_trace.deps |= PixelRecords::bit(hit.id);
+	}
+	void beginPixelRecord();
+	void endPixelRecord(int i, int j);
+	string frameKey();
+	template <class K>
+	ofColor reshade(const Ray &ray, const Hit &hit);
+
+	// Compiled scene distance
+	void compileSceneSDF();
 
 	// SDF scene loop used for Ray Marching
+	template <class K>
 	float sceneSDF(const glm::vec3 &p, int &obj_index);
 	
 	// Ray Marching algorithm
-	bool rayMarch(const Ray &r, glm::vec3 &p, int &obj_index);
-	ofColor rayMarchLoop(const Ray &r);
+	template <class K>
+	bool rayMarch(const Ray &r, glm::vec3 &p, int &obj_index, bool inside = false, float t_limit = std::numeric_limits<float>::infinity());
+	template <class K>
+	ofColor rayMarchLoop(const Ray &r, uint32_t depth = 0, float weight = 1.0f, bool inside = false);
+	template <class K>
 	glm::vec3 getNormalRM(const glm::vec3 &p);
 
+	float pixel_spread;             // Width of a pixel's footprint per unit of distance
 	AmbientLight ambient_light;
 	vector<SceneObject*> objects; 	// Vector of pointers to scene objects
 	vector<Light*> light_refs;
 	vector<Luminaire*> lumin_refs;
+	vector<BrickMap*> baked_sdfs;   // Baked field per object, nullptr if not baked
+	SceneData scene;                // Packed scene used by the render loops
+	SDFCompiler sdf_compiler;
+	CompiledSDF compiled_sdf = nullptr;    // This frame's scene distance, nullptr when interpreted
+	bool compiled_march = false;           // The marcher steps by compiled_sdf too
+	LightTree light_tree;
+	PreparedLights prepared_lights; // Lights packed for shading at render start
+	IrradianceCache irradiance_cache;
+	PathGuide path_guide;
+	bool guide_recording = false;   // Paths record into the guide, set by the training passes
+	PhotonMap global_photons;       // Photons of every diffuse hit
+	PhotonMap caustic_photons;      // Photons that only passed mirrors and glass
+	ofColor ambient_color;
+	RenderBuffers aux_buffers;      // Filled when output_aux or denoise is set
+	PixelRecords records;           // Filled when pixel_records is set
+	bool record_pixels = false;     // This render fills records
 	ofImage final_image; 	// Image object that will be used to draw image and save to disk
 	ofColor background_color = ofColor::black;
 
@@ -0,0 +1,227 @@
+#include "ofApp.h"
+#include "SDFCompiler.h"
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+
+const char *SDFSource::function_name = "scene_sdf";
+
+
+void SDFSource::line(const string &statement) {
+	if (!statement.empty() && statement[0] == '}')
+		indent--;
+	body << string(indent, '\t') << statement << "\n";
+	if (!statement.empty() && statement.back() == '{')
+		indent++;
+}
+
+string SDFSource::var(const string &prefix) {
+	return prefix + std::to_string(next_var++);
+}
+
+// Enough digits to read back the same float
+string SDFSource::lit(float v) {
+	ostringstream s;
+	s << std::showpoint << std::setprecision(9) << v << "f";
+	return v < 0.0f ? "(" + s.str() + ")" : s.str();
+}
+
+
+SDFPoint SDFSource::transform(const glm::mat4 &m, const SDFPoint &p) {
+	SDFPoint q = { var("x"), var("y"), var("z") };
+	const string *out[3] = { &q.x, &q.y, &q.z };
+	for (int r = 0; r < 3; r++) {
+		line("float " + *out[r] + " = " + lit(m[0][r]) + " * " + p.x + " + " + lit(m[1][r]) + " * " + p.y
+			+ " + " + lit(m[2][r]) + " * " + p.z + " + " + lit(m[3][r]) + ";");
+	}
+	return q;
+}
+
+
+//---Code for the distance of one scene object-------------------------------
+// Mirrors the objects' sdf functions
+string SDFSource::object(SceneObject *obj, const SDFPoint &p) {
+	switch (obj->type) {
+	case ObjectType::sphere:
+	case ObjectType::luminaire: {
+		Sphere *s = static_cast<Sphere*>(obj);
+		string d = var("d");
+		line("float " + d + " = len3(" + p.x + " - " + lit(s->position.x) + ", " + p.y + " - " + lit(s->position.y) + ", "
+			+ p.z + " - " + lit(s->position.z) + ") - " + lit(s->radius) + ";");
+		return d;
+	}
+	case ObjectType::plane: {
+		string d = var("d");
+		line("float " + d + " = " + lit(obj->position.y) + " - " + p.y + ";");
+		return d;
+	}
+	case ObjectType::torus:
+	case ObjectType::twisted_torus:
+	case ObjectType::twisted_repeated_torus: {
+		Torus *t = static_cast<Torus*>(obj);
+		bool twisted = obj->type != ObjectType::torus;
+		return torus(p, t->getInverseTransform(), t->getRadii().x, t->getRadii().y,
+			twisted ? static_cast<TwistedTorus*>(obj)->getTwist() : 0.0f, twisted,
+			obj->type != ObjectType::twisted_torus, t->getRepeatPeriod());
+	}
+	default:
+		return "";
+	}
+} // end object
+
+
+//---Code for a torus, as SceneData::torusDistance--------------------------
+string SDFSource::torus(const SDFPoint &p, const glm::mat4 &inv, float R, float r, float k, bool twisted,
+	bool repeated, const glm::vec3 &period, const string &best) {
+	SDFPoint q = transform(inv, p);
+	if (repeated) {
+		line(q.x + " = modp(" + q.x + " + " + lit(0.5f * period.x) + ", " + lit(period.x) + ") - " + lit(0.5f * period.x) + ";");
+		line(q.y + " = modp(" + q.y + " + " + lit(0.5f * period.y) + ", " + lit(period.y) + ") - " + lit(0.5f * period.y) + ";");
+		line(q.z + " = modp(" + q.z + " + " + lit(0.5f * period.z) + ", " + lit(period.z) + ") - " + lit(0.5f * period.z) + ";");
+	}
+
+	string d = var("d");
+	if (!best.empty()) {
+		line("float " + d + " = len3(" + q.x + ", " + q.y + ", " + q.z + ") - " + lit(R + r) + ";");
+		line("if (" + d + " < " + best + ") {");
+	}
+	else {
+		line("float " + d + ";");
+		line("{");
+	}
+
+	// Torus::twist puts the turned (x, z) in x and y and the height in z
+	SDFPoint c = q;
+	if (twisted) {
+		string cs = var("c");
+		string sn = var("s");
+		c = { var("x"), var("y"), var("z") };
+		line("float " + cs + " = std::cos(" + lit(k) + " * " + p.y + ");");
+		line("float " + sn + " = std::sin(" + lit(k) + " * " + p.y + ");");
+		line("float " + c.x + " = " + cs + " * " + q.x + " + " + sn + " * " + q.z + ";");
+		line("float " + c.y + " = " + cs + " * " + q.z + " - " + sn + " * " + q.x + ";");
+		line("float " + c.z + " = " + q.y + ";");
+	}
+	line(d + " = len2(len2(" + c.x + ", " + c.z + ") - " + lit(R) + ", " + c.y + ") - " + lit(r) + ";");
+	line("}");
+	return d;
+} // end torus
+
+
+string SDFSource::source() const {
+	ostringstream src;
+	src << "// Generated scene distance function\n"
+		<< "#include <algorithm>\n"
+		<< "#include <cmath>\n"
+		<< "#include <limits>\n\n"
+		<< "static inline float len2(float x, float y) { return std::sqrt(x * x + y * y); }\n"
+		<< "static inline float len3(float x, float y, float z) { return std::sqrt(x * x + y * y + z * z); }\n"
+		<< "static inline float modp(float x, float period) { return x - period * std::floor(x / period); }\n"
+		<< "static inline float boxDist(float x, float y, float z, float x0, float y0, float z0, float x1, float y1, float z1) {\n"
+		<< "\tfloat qx = std::max(x0 - x, x - x1), qy = std::max(y0 - y, y - y1), qz = std::max(z0 - z, z - z1);\n"
+		<< "\treturn len3(std::max(qx, 0.0f), std::max(qy, 0.0f), std::max(qz, 0.0f)) + std::min(std::max(qx, std::max(qy, qz)), 0.0f);\n"
+		<< "}\n\n"
+		<< "extern \"C\" float " << function_name << "(float px, float py, float pz, int *id) {\n"
+		<< "\tconst float inf = std::numeric_limits<float>::infinity();\n"
+		<< "\tfloat dist = inf;\n"
+		<< "\t*id = -1;\n"
+		<< body.str()
+		<< "\treturn dist;\n"
+		<< "}\n";
+	return src.str();
+}
+
+
+/*
+	SDFCompiler ====================================================================================
+*/
+
+SDFCompiler::~SDFCompiler() {
+#ifndef _WIN32
+	for (auto handle : handles)
+		dlclose(handle);
+#endif
+}
+
+
+bool SDFCompiler::available() {
+	if (has_compiler < 0) {
+#ifndef _WIN32
+		string command = compiler + " --version > /dev/null 2>&1";
+		has_compiler = std::system(command.c_str()) == 0;
+#else
+		has_compiler = 0;
+#endif
+		if (!has_compiler)
+			cerr << "No compiler for the scene SDF (" << compiler << "), using the interpreted distance" << endl;
+	}
+	return has_compiler;
+}
+
+
+//---Shared object of the source, built on a cache miss----------------------
+CompiledSDF SDFCompiler::compile(const string &source) {
+#ifndef _WIN32
+	string command = compiler + " " + flags;
+	ostringstream hex;
+	hex << std::hex << std::hash<string>()(command + "\n" + source);
+
+	ofDirectory::createDirectory(cache_dir, false, true);
+	string base = ofToDataPath(cache_dir + "sdf_jit_" + hex.str());
+	string lib_path = base + ".so";
+
+	auto found = loaded.find(lib_path);
+	if (found != loaded.end())
+		return found->second;
+
+	void *handle = dlopen(lib_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		if (!available())
+			return nullptr;
+
+		float before_time = ofGetElapsedTimeMillis();
+		string src_path = base + ".cpp";
+		ofstream out(src_path);
+		out << source;
+		out.close();
+		if (!out) {
+			cerr << "Could not write scene SDF source: " << src_path << endl;
+			return nullptr;
+		}
+
+		// Built under a temporary name so a failed build never leaves a library behind
+		string tmp_path = base + ".tmp.so";
+		string build = command + " -o \"" + tmp_path + "\" \"" + src_path + "\"";
+		if (std::system(build.c_str()) != 0 || std::rename(tmp_path.c_str(), lib_path.c_str()) != 0) {
+			cerr << "Could not compile scene SDF: " << build << endl;
+			std::remove(tmp_path.c_str());
+			return nullptr;
+		}
+		cout << "Scene SDF compile time: " << ofGetElapsedTimeMillis() - before_time << "ms" << endl;
+
+		handle = dlopen(lib_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (!handle) {
+			cerr << "Could not load scene SDF: " << dlerror() << endl;
+			return nullptr;
+		}
+	}
+
+	CompiledSDF f = reinterpret_cast<CompiledSDF>(dlsym(handle, SDFSource::function_name));
+	if (!f) {
+		cerr << "Scene SDF library has no " << SDFSource::function_name << ": " << lib_path << endl;
+		dlclose(handle);
+		return nullptr;
+	}
+	handles.push_back(handle);
+	loaded[lib_path] = f;
+	return f;
+#else
+	return nullptr;
+#endif
+} // end compile
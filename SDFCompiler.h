@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ofApp.h"
+#include "SceneObjects.h"
+
+
+// Distance of a compiled scene at (x, y, z), id is set to the closest object
+typedef float (*CompiledSDF)(float x, float y, float z, int *id);
+
+
+/*
+	SDF Point
+	- Names of the variables holding the point a piece of generated code measures from
+*/
+struct SDFPoint {
+	string x, y, z;
+};
+
+
+/*
+	SDF Source
+	- C++ source of one scene's distance function, with every constant written in
+	  as a literal and the objects' distances one after the other
+	- SceneData and the CSG trees append their statements to it, each piece of code
+	  leaves its distance in a fresh variable whose name it returns
+*/
+class SDFSource {
+public:
+	// Append a statement
+	void line(const string &statement);
+
+	// Fresh variable name
+	string var(const string &prefix);
+
+	// Float literal
+	static string lit(float v);
+
+	// Point m * p in new variables
+	SDFPoint transform(const glm::mat4 &m, const SDFPoint &p);
+
+	// Distance of a scene object, empty if there is no code for its type
+	string object(SceneObject *obj, const SDFPoint &p);
+
+	// Distance of a torus in the world frame through inv, as SceneData packs them.
+	// With best set the exact distance is only computed when the bounding sphere
+	// is nearer than best
+	string torus(const SDFPoint &p, const glm::mat4 &inv, float R, float r, float k, bool twisted,
+		bool repeated, const glm::vec3 &period, const string &best = "");
+
+	// Whole translation unit defining scene_sdf
+	string source() const;
+
+	static const char *function_name;
+
+private:
+	ostringstream body;
+	int indent = 1;
+	int next_var = 0;
+};
+
+
+/*
+	SDF Compiler
+	- Builds the generated source into a shared object with the installed compiler
+	  and loads it
+	- Shared objects are cached on disk by a hash of the source and the compile
+	  command, and stay loaded until the compiler is destroyed
+	- compile returns nullptr when there's no compiler or the build fails, callers
+	  keep the interpreted distance then
+*/
+class SDFCompiler {
+public:
+	~SDFCompiler();
+
+	CompiledSDF compile(const string &source);
+
+	// A compiler answers to the compile command
+	bool available();
+
+	string compiler = "c++";
+	string flags = "-O2 -shared -fPIC";
+	string cache_dir = "../../cache/";
+
+private:
+	std::map<string, CompiledSDF> loaded;    // keyed by the cache file
+	vector<void*> handles;
+	int has_compiler = -1;    // -1 until checked
+};
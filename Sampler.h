@@ -0,0 +1,107 @@
+#pragma once
+
+#include "ofApp.h"
+#include <cstring>
+
+
+/*
+	Sampler
+	- Owen scrambled Sobol sequence (Burley 2020, "Practical Hash-based Owen Scrambling")
+	- Dimensions are drawn in pairs, every pair is padded by shuffling the
+	  sample index with its own seed so high dimensions stay decorrelated
+	- Stateless apart from the counters, one sampler per pixel (or shading
+	  point) per thread, the same stream and seed always give the same samples
+*/
+class Sampler {
+public:
+	Sampler() : seed(0), sample_index(0), dimension(0) {}
+	Sampler(uint32_t stream, uint32_t seed) {
+		this->seed = hashCombine(hash(stream), seed);
+		startSample(0);
+	}
+
+	// Stream id of a pixel
+	static uint32_t pixelStream(uint32_t x, uint32_t y) { return (y << 16) ^ x; }
+
+	// Stream id of a shading point, used where no pixel is at hand
+	static uint32_t pointStream(const glm::vec3 &p) {
+		uint32_t h = 0;
+		for (int i = 0; i < 3; i++) {
+			uint32_t bits;
+			std::memcpy(&bits, &p[i], sizeof(bits));
+			h = hashCombine(h, hash(bits));
+		}
+		return h;
+	}
+
+	// Start the index'th sample of the stream, dimensions restart at 0
+	void startSample(uint32_t index) {
+		sample_index = index;
+		dimension = 0;
+	}
+
+	glm::vec2 get2D() {
+		uint32_t dim_seed = hash(hashCombine(seed, dimension++));
+		uint32_t index = nestedUniformScramble(sample_index, dim_seed);
+		uint32_t x = nestedUniformScramble(reverseBits(index), hashCombine(dim_seed, 0x9e3779b9u));
+		uint32_t y = nestedUniformScramble(sobolDim1(index), hashCombine(dim_seed, 0x7f4a7c15u));
+		return glm::vec2(toFloat(x), toFloat(y));
+	}
+
+	float get1D() {
+		return get2D().x;
+	}
+
+private:
+	static uint32_t reverseBits(uint32_t x) {
+		x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+		x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+		x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+		x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+		return (x >> 16) | (x << 16);
+	}
+
+	// Second Sobol dimension, the first is the bit reversed index
+	static uint32_t sobolDim1(uint32_t index) {
+		uint32_t result = 0;
+		for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+			if (index & 1)
+				result ^= v;
+		}
+		return result;
+	}
+
+	static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+		return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+	}
+
+	static uint32_t hash(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	static uint32_t hashCombine(uint32_t seed, uint32_t v) {
+		return seed ^ (v + (seed << 6) + (seed >> 2));
+	}
+
+	static float toFloat(uint32_t x) {
+		return std::min(x * 2.3283064365386963e-10f, 0.99999994f);
+	}
+
+	uint32_t seed;
+	uint32_t sample_index;
+	uint32_t dimension;
+};
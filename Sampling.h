@@ -0,0 +1,124 @@
+#pragma once
+
+#include "ofApp.h"
+
+
+/*
+	Sampling helpers used by the path tracer
+	- u1, u2 are uniform random numbers in [0, 1)
+*/
+
+// Orthonormal basis (t, b) around the unit vector n
+inline void orthonormalBasis(const glm::vec3 &n, glm::vec3 &t, glm::vec3 &b) {
+	float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+	float a = -1.0f / (sign + n.z);
+	float c = n.x * n.y * a;
+	t = glm::vec3(1.0f + sign * n.x * n.x * a, sign * c, -sign * n.x);
+	b = glm::vec3(c, sign + n.y * n.y * a, -n.y);
+}
+
+// Direction in the hemisphere around n with pdf cos(theta) / pi
+inline glm::vec3 cosineSampleHemisphere(const glm::vec3 &n, float u1, float u2) {
+	float r = std::sqrt(u1);
+	float phi = glm::two_pi<float>() * u2;
+	glm::vec3 t, b;
+	orthonormalBasis(n, t, b);
+	return glm::normalize(r * std::cos(phi) * t + r * std::sin(phi) * b + std::sqrt(std::max(0.0f, 1.0f - u1)) * n);
+}
+
+// Direction in the cone around axis with half angle acos(cos_max), uniform in solid angle
+inline glm::vec3 uniformSampleCone(const glm::vec3 &axis, float cos_max, float u1, float u2) {
+	float cos_theta = 1.0f - u1 * (1.0f - cos_max);
+	float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+	float phi = glm::two_pi<float>() * u2;
+	glm::vec3 t, b;
+	orthonormalBasis(axis, t, b);
+	return glm::normalize(sin_theta * std::cos(phi) * t + sin_theta * std::sin(phi) * b + cos_theta * axis);
+}
+
+// Solid angle pdf of uniformSampleCone
+inline float uniformConePdf(float cos_max) {
+	return 1.0f / (glm::two_pi<float>() * (1.0f - cos_max));
+}
+
+// Cosine of the half angle of the cone a sphere subtends from p, false if p is inside
+// or so far away that the cosine rounds to 1 and the cone has no pdf
+inline bool sphereConeCos(const glm::vec3 &p, const glm::vec3 &center, float radius, float &cos_max) {
+	float d2 = glm::dot(center - p, center - p);
+	if (d2 <= radius * radius)
+		return false;
+	cos_max = std::sqrt(std::max(0.0f, 1.0f - radius * radius / d2));
+	return cos_max < 1.0f;
+}
+
+// Veach's power heuristic (beta = 2) for multiple importance sampling
+inline float powerHeuristic(float pdf_a, float pdf_b) {
+	float a = pdf_a * pdf_a;
+	float b = pdf_b * pdf_b;
+	return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+// Point on the unit disk, concentric mapping (Shirley and Chiu) keeps the strata of u
+inline glm::vec2 concentricSampleDisk(const glm::vec2 &u) {
+	glm::vec2 offset = 2.0f * u - glm::vec2(1.0f, 1.0f);
+	if (offset.x == 0.0f && offset.y == 0.0f)
+		return glm::vec2(0.0f, 0.0f);
+
+	float r, theta;
+	if (std::abs(offset.x) > std::abs(offset.y)) {
+		r = offset.x;
+		theta = glm::quarter_pi<float>() * (offset.y / offset.x);
+	}
+	else {
+		r = offset.y;
+		theta = glm::half_pi<float>() - glm::quarter_pi<float>() * (offset.x / offset.y);
+	}
+	return r * glm::vec2(std::cos(theta), std::sin(theta));
+}
+
+// Schlick's approximation of the Fresnel reflectance, f0 is the reflectance at normal incidence
+inline float schlickFresnel(float cos_theta, float f0) {
+	float m = 1.0f - std::max(0.0f, std::min(1.0f, cos_theta));
+	return f0 + (1.0f - f0) * m * m * m * m * m;
+}
+
+// Refraction of the unit direction d through the unit normal n facing it, eta = n_from / n_to.
+// False on total internal reflection
+inline bool refractDir(const glm::vec3 &d, const glm::vec3 &n, float eta, glm::vec3 &t) {
+	float cos_i = -glm::dot(d, n);
+	float k = 1.0f - eta * eta * (1.0f - cos_i * cos_i);
+	if (k < 0.0f)
+		return false;
+	t = glm::normalize(eta * d + (eta * cos_i - std::sqrt(k)) * n);
+	return true;
+}
+
+// Shares of a surface's local shading, reflected and refracted rays, they sum to 1
+struct FresnelSplit {
+	float k_local;
+	float k_reflect;
+	float k_refract;
+	glm::vec3 refracted;    // set when k_refract > 0
+};
+
+// Fresnel weighted split of the unit direction d hitting a surface with the unit normal n
+// facing it, entering when d goes into the object. The glass reflectance uses the cosine
+// on the outside, the transmitted one when leaving, and total internal reflection sends
+// all of the glass part to the reflected ray
+inline FresnelSplit fresnelSplit(const glm::vec3 &d, const glm::vec3 &n, bool entering, float reflectivity, float transparency, float ior) {
+	float cos_i = -glm::dot(d, n);
+	float f_mirror = reflectivity > 0.0f ? schlickFresnel(cos_i, reflectivity) : 0.0f;
+
+	FresnelSplit split;
+	float f_glass = 1.0f;
+	float eta = entering ? 1.0f / ior : ior;
+	if (transparency > 0.0f && refractDir(d, n, eta, split.refracted)) {
+		float f0 = (ior - 1.0f) / (ior + 1.0f);
+		f_glass = schlickFresnel(entering ? cos_i : -glm::dot(split.refracted, n), f0 * f0);
+	}
+
+	split.k_local = (1.0f - transparency) * (1.0f - f_mirror);
+	split.k_reflect = (1.0f - transparency) * f_mirror + transparency * f_glass;
+	split.k_refract = transparency * (1.0f - f_glass);
+	return split;
+}
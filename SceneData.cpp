@@ -0,0 +1,776 @@
+#include "ofApp.h"
+#include "SceneData.h"
+
+
+void SceneData::clear() {
+	materials.clear();
+	sphere_x.clear(); sphere_y.clear(); sphere_z.clear();
+	sphere_r.clear(); sphere_id.clear();
+	plane_x.clear(); plane_y.clear(); plane_z.clear();
+	plane_nx.clear(); plane_ny.clear(); plane_nz.clear();
+	plane_w.clear(); plane_h.clear(); plane_id.clear();
+	torus_inv.clear(); torus_R.clear(); torus_r.clear(); torus_k.clear(); torus_twisted.clear();
+	torus_repeat.clear(); torus_period.clear(); torus_bound.clear(); torus_baked.clear(); torus_id.clear();
+	csg_objs.clear(); csg_baked.clear(); csg_id.clear();
+	mesh_geometry.clear(); mesh_offset.clear(); mesh_id.clear();
+	inst_objs.clear(); inst_id.clear(); inst_nodes.clear(); unbounded_inst.clear(); unbounded_id.clear();
+	num_marched_inst = 0;
+	other_objs.clear(); other_id.clear();
+}
+
+
+void SceneData::addSphere(Sphere *s, int id) {
+	sphere_x.push_back(s->position.x);
+	sphere_y.push_back(s->position.y);
+	sphere_z.push_back(s->position.z);
+	sphere_r.push_back(s->radius);
+	sphere_id.push_back(id);
+}
+
+
+//---Pack the authoring objects-------------------------------------
+void SceneData::build(const vector<SceneObject*> &objects, const vector<BrickMap*> &baked) {
+	clear();
+
+	// Luminaires are packed after the other spheres so occlusion loops can stop before them
+	vector<int> luminaires;
+
+	// World bounds of the bounded instances
+	vector<glm::vec3> inst_min, inst_max;
+
+	for (int id = 0; id < objects.size(); id++) {
+		SceneObject *obj = objects[id];
+
+		// Material table
+		Material m;
+		m.diffuseColor = obj->diffuseColor;
+		m.specularColor = obj->specularColor;
+		m.power = obj->power;
+		m.reflectivity = obj->reflectivity;
+		m.transparency = obj->transparency;
+		m.ior = obj->ior;
+
+		// Geometry
+		switch (obj->type) {
+		case ObjectType::luminaire:
+			m.isLuminaire = true;
+			m.emission = static_cast<Luminaire*>(obj)->intensity;
+			m.luminaire = luminaires.size();
+			luminaires.push_back(id);
+			break;
+		case ObjectType::sphere:
+			addSphere(static_cast<Sphere*>(obj), id);
+			break;
+		case ObjectType::plane: {
+			Plane *p = static_cast<Plane*>(obj);
+			if (p->texture_ref && p->isTextured) {
+				// Orthogonal unit vectors
+				glm::vec3 x = glm::cross(p->normal, glm::vec3(1, 0, 0));
+				glm::vec3 y = glm::cross(p->normal, glm::vec3(0, 1, 0));
+				glm::vec3 z = glm::cross(p->normal, glm::vec3(0, 0, 1));
+
+				// Determine the unit vector whose magnitude is lesser and set that for the u direction vector
+				glm::vec3 max_xy = glm::dot(x, x) < glm::dot(y, y) ? y : x;
+				m.u_vec = glm::normalize(glm::dot(max_xy, max_xy) < glm::dot(z, z) ? max_xy : z);
+				// Cross for the v direction vector
+				m.v_vec = glm::cross(p->normal, m.u_vec);
+				m.texture_ref = p->texture_ref;
+			}
+			plane_x.push_back(p->position.x);
+			plane_y.push_back(p->position.y);
+			plane_z.push_back(p->position.z);
+			plane_nx.push_back(p->normal.x);
+			plane_ny.push_back(p->normal.y);
+			plane_nz.push_back(p->normal.z);
+			plane_w.push_back(p->width);
+			plane_h.push_back(p->height);
+			plane_id.push_back(id);
+			break;
+		}
+		case ObjectType::torus:
+		case ObjectType::twisted_torus:
+		case ObjectType::twisted_repeated_torus: {
+			Torus *t = static_cast<Torus*>(obj);
+			bool twisted = obj->type != ObjectType::torus;
+			torus_inv.push_back(t->getInverseTransform());
+			torus_R.push_back(t->getRadii().x);
+			torus_r.push_back(t->getRadii().y);
+			torus_k.push_back(twisted ? static_cast<TwistedTorus*>(obj)->getTwist() : 0.0f);
+			torus_twisted.push_back(twisted);
+			torus_repeat.push_back(obj->type != ObjectType::twisted_torus);
+			torus_period.push_back(t->getRepeatPeriod());
+			torus_bound.push_back(t->getRadii().x + t->getRadii().y);
+			torus_baked.push_back(id < baked.size() ? baked[id] : nullptr);
+			torus_id.push_back(id);
+			break;
+		}
+		case ObjectType::csg:
+			csg_objs.push_back(static_cast<CSGObject*>(obj));
+			csg_baked.push_back(id < baked.size() ? baked[id] : nullptr);
+			csg_id.push_back(id);
+			break;
+		case ObjectType::instance: {
+			Instance *inst = static_cast<Instance*>(obj);
+			glm::vec3 bmin, bmax;
+			inst->prepare();
+			num_marched_inst += inst->isMarched() && !inst->isTraced();
+			if (inst->getBounds(bmin, bmax)) {
+				inst_objs.push_back(inst);
+				inst_id.push_back(id);
+				inst_min.push_back(bmin);
+				inst_max.push_back(bmax);
+			}
+			else {
+				unbounded_inst.push_back(inst);
+				unbounded_id.push_back(id);
+			}
+			break;
+		}
+		case ObjectType::mesh: {
+			Mesh *mesh = static_cast<Mesh*>(obj);
+			if (mesh->geometry && mesh->geometry->isValid()) {
+				mesh_geometry.push_back(mesh->geometry);
+				mesh_offset.push_back(mesh->position);
+				mesh_id.push_back(id);
+			}
+			break;
+		}
+		default:
+			other_objs.push_back(obj);
+			other_id.push_back(id);
+			break;
+		}
+
+		materials.push_back(m);
+	}
+
+	// Instances in leaf order
+	vector<uint32_t> order;
+	buildBVH(inst_min, inst_max, 2, inst_nodes, order);
+	vector<Instance*> sorted_objs(order.size());
+	vector<int> sorted_id(order.size());
+	for (int i = 0; i < order.size(); i++) {
+		sorted_objs[i] = inst_objs[order[i]];
+		sorted_id[i] = inst_id[order[i]];
+	}
+	inst_objs.swap(sorted_objs);
+	inst_id.swap(sorted_id);
+
+	num_occluder_spheres = sphere_r.size();
+	num_occluders = objects.size() - luminaires.size();
+	for (int id : luminaires)
+		addSphere(static_cast<Sphere*>(objects[id]), id);
+} // end build
+
+
+//---Distance to torus i from its local point q and world point p------
+// Returns a lower bound when that is already at least best
+float SceneData::torusDistance(int i, const glm::vec3 &q, const glm::vec3 &p, float best) const {
+	// Baked fields are used until the refine distance
+	float d;
+	if (torus_baked[i] && torus_baked[i]->sample(p, d) && d > torus_baked[i]->refineDistance())
+		return d;
+
+	glm::vec3 c = torus_repeat[i] ? Torus::repeat(q, torus_period[i]) : q;
+
+	// The twist keeps the length, so the instance's bounding sphere is a cheap bound
+	float bound = glm::length(c) - torus_bound[i];
+	if (bound >= best)
+		return bound;
+
+	if (torus_twisted[i])
+		c = Torus::twist(c, p.y, torus_k[i]);
+	return Torus::torusDistance(c, glm::vec2(torus_R[i], torus_r[i]));
+} // end torusDistance
+
+
+//---Closest hit----------------------------------------------------
+bool SceneData::intersect(const Ray &r, Hit &hit, bool skip_luminaires) const {
+	const float eps = std::numeric_limits<float>::epsilon();
+	float best = std::numeric_limits<float>::infinity();
+	int best_id = -1;
+	glm::vec3 best_normal;
+
+	// Spheres (geometric test as in glm::intersectRaySphere)
+	int best_sphere = -1;
+	int num_spheres = skip_luminaires ? num_occluder_spheres : sphere_r.size();
+	for (int i = 0; i < num_spheres; i++) {
+		float dx = sphere_x[i] - r.p.x;
+		float dy = sphere_y[i] - r.p.y;
+		float dz = sphere_z[i] - r.p.z;
+		float t0 = dx * r.d.x + dy * r.d.y + dz * r.d.z;
+		float d2 = dx * dx + dy * dy + dz * dz - t0 * t0;
+		float r2 = sphere_r[i] * sphere_r[i];
+		if (d2 > r2)
+			continue;
+
+		float t1 = std::sqrt(r2 - d2);
+		float t = t0 > t1 + eps ? t0 - t1 : t0 + t1;
+		if (t > eps && t < best) {
+			best = t;
+			best_sphere = i;
+		}
+	}
+
+	// Planes (finite in x and z)
+	int best_plane = -1;
+	for (int i = 0; i < plane_w.size(); i++) {
+		float dn = r.d.x * plane_nx[i] + r.d.y * plane_ny[i] + r.d.z * plane_nz[i];
+		if (std::abs(dn) <= eps)
+			continue;
+
+		float t = ((plane_x[i] - r.p.x) * plane_nx[i] + (plane_y[i] - r.p.y) * plane_ny[i] + (plane_z[i] - r.p.z) * plane_nz[i]) / dn;
+		if (t <= 0 || t >= best)
+			continue;
+
+		float px = r.p.x + t * r.d.x;
+		float pz = r.p.z + t * r.d.z;
+		if (std::abs(px - plane_x[i]) < plane_w[i] / 2 && std::abs(pz - plane_z[i]) < plane_h[i] / 2) {
+			best = t;
+			best_plane = i;
+			best_sphere = -1;
+		}
+	}
+
+	// Meshes, each hierarchy only looks for hits closer than the best so far
+	int best_mesh = -1;
+	glm::vec3 mesh_normal;
+	for (int i = 0; i < mesh_geometry.size(); i++) {
+		float t;
+		glm::vec3 normal;
+		if (mesh_geometry[i]->intersect(Ray(r.p - mesh_offset[i], r.d), best, t, normal)) {
+			best = t;
+			best_mesh = i;
+			mesh_normal = normal;
+			best_sphere = -1;
+			best_plane = -1;
+		}
+	}
+
+	int best_inst = -1;
+	glm::vec3 inst_normal;
+	if (intersectInstances(r, best, inst_normal, best_inst)) {
+		best_sphere = -1;
+		best_plane = -1;
+		best_mesh = -1;
+	}
+
+	// Objects without a packed representation
+	for (int i = 0; i < other_objs.size(); i++) {
+		glm::vec3 point, normal;
+		if (other_objs[i]->intersect(r, point, normal)) {
+			float t = glm::distance(r.p, point);
+			if (t < best) {
+				best = t;
+				best_id = other_id[i];
+				best_normal = normal;
+				best_sphere = -1;
+				best_plane = -1;
+				best_mesh = -1;
+				best_inst = -1;
+			}
+		}
+	}
+
+	if (best_sphere >= 0) {
+		best_id = sphere_id[best_sphere];
+		glm::vec3 center(sphere_x[best_sphere], sphere_y[best_sphere], sphere_z[best_sphere]);
+		best_normal = (r.p + r.d * best - center) / sphere_r[best_sphere];
+	}
+	else if (best_plane >= 0) {
+		best_id = plane_id[best_plane];
+		best_normal = glm::vec3(plane_nx[best_plane], plane_ny[best_plane], plane_nz[best_plane]);
+	}
+	else if (best_mesh >= 0) {
+		best_id = mesh_id[best_mesh];
+		best_normal = mesh_normal;
+	}
+	else if (best_inst >= 0) {
+		best_id = best_inst;
+		best_normal = inst_normal;
+	}
+
+	if (best_id < 0)
+		return false;
+
+	hit.t = best;
+	hit.point = r.p + r.d * best;
+	hit.normal = glm::normalize(best_normal);
+	hit.id = best_id;
+	return true;
+} // end intersect
+
+
+//---Any hit with an occluder, luminaires don't cast shadows-------
+bool SceneData::occluded(const Ray &r) const {
+	const float eps = std::numeric_limits<float>::epsilon();
+
+	for (int i = 0; i < num_occluder_spheres; i++) {
+		float dx = sphere_x[i] - r.p.x;
+		float dy = sphere_y[i] - r.p.y;
+		float dz = sphere_z[i] - r.p.z;
+		float t0 = dx * r.d.x + dy * r.d.y + dz * r.d.z;
+		float d2 = dx * dx + dy * dy + dz * dz - t0 * t0;
+		float r2 = sphere_r[i] * sphere_r[i];
+		if (d2 > r2)
+			continue;
+
+		float t1 = std::sqrt(r2 - d2);
+		float t = t0 > t1 + eps ? t0 - t1 : t0 + t1;
+		if (t > eps)
+			return true;
+	}
+
+	for (int i = 0; i < plane_w.size(); i++) {
+		float dn = r.d.x * plane_nx[i] + r.d.y * plane_ny[i] + r.d.z * plane_nz[i];
+		if (std::abs(dn) <= eps)
+			continue;
+
+		float t = ((plane_x[i] - r.p.x) * plane_nx[i] + (plane_y[i] - r.p.y) * plane_ny[i] + (plane_z[i] - r.p.z) * plane_nz[i]) / dn;
+		float px = r.p.x + t * r.d.x;
+		float pz = r.p.z + t * r.d.z;
+		if (t > 0 && std::abs(px - plane_x[i]) < plane_w[i] / 2 && std::abs(pz - plane_z[i]) < plane_h[i] / 2)
+			return true;
+	}
+
+	for (int i = 0; i < mesh_geometry.size(); i++) {
+		if (mesh_geometry[i]->occluded(Ray(r.p - mesh_offset[i], r.d), std::numeric_limits<float>::infinity()))
+			return true;
+	}
+
+	if (occludedInstances(r))
+		return true;
+
+	for (auto obj : other_objs) {
+		glm::vec3 point, normal;
+		if (obj->intersect(r, point, normal))
+			return true;
+	}
+
+	return false;
+} // end occluded
+
+
+//---Scene signed distance------------------------------------------
+float SceneData::sdf(const glm::vec3 &p, int &id, bool marched_only) const {
+	float distance = std::numeric_limits<float>::infinity();
+	id = -1;
+
+	// Objects with exact hits are left to the hybrid renderer's intersect
+	int num_spheres = marched_only ? 0 : sphere_r.size();
+	int num_planes = marched_only ? 0 : plane_y.size();
+	int num_others = marched_only ? 0 : other_objs.size();
+
+	// Spheres
+	for (int i = 0; i < num_spheres; i++) {
+		float dx = p.x - sphere_x[i];
+		float dy = p.y - sphere_y[i];
+		float dz = p.z - sphere_z[i];
+		float d = std::sqrt(dx * dx + dy * dy + dz * dz) - sphere_r[i];
+		if (distance > d) {
+			distance = d;
+			id = sphere_id[i];
+		}
+	}
+
+	// Planes, treated as floors
+	for (int i = 0; i < num_planes; i++) {
+		float d = plane_y[i] - p.y;
+		if (distance > d) {
+			distance = d;
+			id = plane_id[i];
+		}
+	}
+
+	// Tori
+	for (int i = 0; i < torus_R.size(); i++) {
+		float d = torusDistance(i, torus_inv[i] * glm::vec4(p, 1), p, distance);
+		if (distance > d) {
+			distance = d;
+			id = torus_id[i];
+		}
+	}
+
+	// CSG trees skip the subtrees that are farther away than the closest distance so far
+	for (int i = 0; i < csg_objs.size(); i++) {
+		float d;
+		if (!csg_baked[i] || !csg_baked[i]->sample(p, d) || d <= csg_baked[i]->refineDistance())
+			d = csg_objs[i]->sdf(p, distance);
+		if (distance > d) {
+			distance = d;
+			id = csg_id[i];
+		}
+	}
+
+	// Instances whose bounds are nearer than the closest distance so far
+	distance = instanceDistance(p, distance, id, marched_only);
+
+	// Objects without a packed representation
+	for (int i = 0; i < num_others; i++) {
+		float d = other_objs[i]->sdf(p);
+		if (distance > d) {
+			distance = d;
+			id = other_id[i];
+		}
+	}
+
+	return distance;
+} // end sdf
+
+
+//---Scene signed distance as generated code-------------------------------
+// Statements in the order of sdf, each object lowers dist and sets id
+bool SceneData::writeSource(SDFSource &src, bool marched_only) const {
+	for (auto field : torus_baked) {
+		if (field)
+			return false;
+	}
+	for (auto field : csg_baked) {
+		if (field)
+			return false;
+	}
+	if (!inst_objs.empty() || !unbounded_inst.empty() || (!marched_only && !other_objs.empty()))
+		return false;
+
+	SDFPoint p = { "px", "py", "pz" };
+	auto closest = [&](const string &d, int id) {
+		src.line("if (dist > " + d + ") {");
+		src.line("dist = " + d + ";");
+		src.line("*id = " + std::to_string(id) + ";");
+		src.line("}");
+	};
+
+	if (!marched_only) {
+		for (int i = 0; i < sphere_r.size(); i++) {
+			string d = src.var("d");
+			src.line("float " + d + " = len3(px - " + SDFSource::lit(sphere_x[i]) + ", py - " + SDFSource::lit(sphere_y[i])
+				+ ", pz - " + SDFSource::lit(sphere_z[i]) + ") - " + SDFSource::lit(sphere_r[i]) + ";");
+			closest(d, sphere_id[i]);
+		}
+		for (int i = 0; i < plane_y.size(); i++) {
+			string d = src.var("d");
+			src.line("float " + d + " = " + SDFSource::lit(plane_y[i]) + " - py;");
+			closest(d, plane_id[i]);
+		}
+	}
+
+	for (int i = 0; i < torus_R.size(); i++) {
+		string d = src.torus(p, torus_inv[i], torus_R[i], torus_r[i], torus_k[i], torus_twisted[i],
+			torus_repeat[i], torus_period[i], "dist");
+		closest(d, torus_id[i]);
+	}
+
+	for (int i = 0; i < csg_objs.size(); i++) {
+		string d = csg_objs[i]->writeSource(src, p, "dist");
+		if (d.empty())
+			return false;
+		closest(d, csg_id[i]);
+	}
+
+	return true;
+} // end writeSource
+
+
+bool SceneData::hasRepeatedTori() const {
+	for (auto repeated : torus_repeat) {
+		if (repeated)
+			return true;
+	}
+	return false;
+}
+
+
+//---Walk the cells of repeated torus i along the local ray q + s * dir-------
+// Returns how far the ray runs through cells whose instance it misses, or -1
+// when the instance of the current cell may be hit
+float SceneData::cellSkip(int i, const glm::vec3 &q, const glm::vec3 &dir) const {
+	const int max_cells = 8;
+	glm::vec3 period = torus_period[i];
+	float br = torus_bound[i];
+	float min_period = std::min(period.x, std::min(period.y, period.z));
+
+	// Only valid while every instance stays inside its own cell
+	if (2.0f * br >= min_period)
+		return -1.0f;
+
+	// Ray relative to the center of the cell being walked
+	glm::vec3 c = Torus::repeat(q, period);
+	float b = glm::dot(c, dir);
+	float enter = 0.0f;
+
+	for (int cell = 0; cell < max_cells; cell++) {
+		// Ray parameter where it leaves the cell, and the wall it leaves through
+		float exit = std::numeric_limits<float>::infinity();
+		int axis = 0;
+		for (int a = 0; a < 3; a++) {
+			if (dir[a] == 0)
+				continue;
+			float wall = ((dir[a] > 0 ? 0.5f : -0.5f) * period[a] - c[a]) / dir[a];
+			if (wall < exit) {
+				exit = wall;
+				axis = a;
+			}
+		}
+
+		// Ray against the instance's bounding sphere within the cell
+		float disc = b * b - (glm::dot(c, c) - br * br);
+		if (disc >= 0) {
+			float root = std::sqrt(disc);
+			if (-b + root >= enter && -b - root <= exit) {
+				// Step to this cell, unless it's the one the ray is already in
+				return enter > 1e-3f * min_period ? enter : -1.0f;
+			}
+		}
+
+		// Move into the neighbouring cell
+		c[axis] -= (dir[axis] > 0 ? 1.0f : -1.0f) * period[axis];
+		b = glm::dot(c, dir);
+		enter = std::max(exit, enter);
+	}
+
+	// Step just past the last wall
+	return enter + 1e-3f * min_period;
+} // end cellSkip
+
+
+//---Ray in the local frame of every torus----------------------------------
+void SceneData::prepareMarch(const Ray &r, MarchCache &cache) const {
+	cache.torus_o.resize(torus_R.size());
+	cache.torus_d.resize(torus_R.size());
+	for (int i = 0; i < torus_R.size(); i++) {
+		cache.torus_o[i] = torus_inv[i] * glm::vec4(r.p, 1);
+		cache.torus_d[i] = torus_inv[i] * glm::vec4(r.d, 0);
+	}
+}
+
+
+//---Distance to march from r.p + t * r.d-------------------------------------
+// Same as sdf, except that a repeated torus whose instance in the current cell is
+// missed by the ray contributes the distance to the cell's exit instead
+float SceneData::marchDistance(const Ray &r, const MarchCache &cache, float t, int &id, bool marched_only) const {
+	glm::vec3 p = r.p + r.d * t;
+	float distance = std::numeric_limits<float>::infinity();
+	id = -1;
+
+	// Objects with exact hits are left to the hybrid renderer's intersect
+	int num_spheres = marched_only ? 0 : sphere_r.size();
+	int num_planes = marched_only ? 0 : plane_y.size();
+	int num_others = marched_only ? 0 : other_objs.size();
+
+	// Spheres
+	for (int i = 0; i < num_spheres; i++) {
+		float dx = p.x - sphere_x[i];
+		float dy = p.y - sphere_y[i];
+		float dz = p.z - sphere_z[i];
+		float d = std::sqrt(dx * dx + dy * dy + dz * dz) - sphere_r[i];
+		if (distance > d) {
+			distance = d;
+			id = sphere_id[i];
+		}
+	}
+
+	// Planes, treated as floors
+	for (int i = 0; i < num_planes; i++) {
+		float d = plane_y[i] - p.y;
+		if (distance > d) {
+			distance = d;
+			id = plane_id[i];
+		}
+	}
+
+	// Tori, the local point comes from the cached local ray
+	for (int i = 0; i < torus_R.size(); i++) {
+		glm::vec3 q = cache.torus_o[i] + cache.torus_d[i] * t;
+		float d = torus_repeat[i] ? cellSkip(i, q, cache.torus_d[i]) : -1.0f;
+		if (d < 0)
+			d = torusDistance(i, q, p, distance);
+
+		if (distance > d) {
+			distance = d;
+			id = torus_id[i];
+		}
+	}
+
+	// CSG trees
+	for (int i = 0; i < csg_objs.size(); i++) {
+		float d;
+		if (!csg_baked[i] || !csg_baked[i]->sample(p, d) || d <= csg_baked[i]->refineDistance())
+			d = csg_objs[i]->sdf(p, distance);
+		if (distance > d) {
+			distance = d;
+			id = csg_id[i];
+		}
+	}
+
+	// Instances whose bounds are nearer than the closest distance so far
+	distance = instanceDistance(p, distance, id, marched_only);
+
+	// Objects without a packed representation
+	for (int i = 0; i < num_others; i++) {
+		float d = other_objs[i]->sdf(p);
+		if (distance > d) {
+			distance = d;
+			id = other_id[i];
+		}
+	}
+
+	return distance;
+} // end marchDistance
+
+
+//---Closest instance hit, best is lowered to it------------------------------
+bool SceneData::intersectInstances(const Ray &r, float &best, glm::vec3 &normal, int &id) const {
+	bool found = false;
+	float t;
+	glm::vec3 n;
+
+	for (int i = 0; i < unbounded_inst.size(); i++) {
+		if (unbounded_inst[i]->isTraced() && unbounded_inst[i]->intersect(r, best, t, n)) {
+			best = t;
+			normal = n;
+			id = unbounded_id[i];
+			found = true;
+		}
+	}
+
+	if (inst_nodes.empty())
+		return found;
+
+	// Only instances whose bounds the ray enters are moved into prototype space
+	glm::vec3 inv_d = 1.0f / r.d;
+	struct Entry { int node; float t; } stack[bvh_max_depth + 8];
+	int depth = 0;
+	float t_enter;
+	if (inst_nodes[0].hit(r.p, inv_d, best, t_enter))
+		stack[depth++] = { 0, t_enter };
+
+	while (depth > 0) {
+		Entry e = stack[--depth];
+		if (e.t > best)
+			continue;
+
+		const BVHNode &node = inst_nodes[e.node];
+		if (node.count > 0) {
+			for (int i = node.index; i < node.index + node.count; i++) {
+				if (inst_objs[i]->isTraced() && inst_objs[i]->intersect(r, best, t, n)) {
+					best = t;
+					normal = n;
+					id = inst_id[i];
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// The nearer child goes on top
+		int left = e.node + 1, right = node.index;
+		float t_left, t_right;
+		bool hit_left = inst_nodes[left].hit(r.p, inv_d, best, t_left);
+		bool hit_right = inst_nodes[right].hit(r.p, inv_d, best, t_right);
+		if (hit_left && hit_right && t_left < t_right) {
+			stack[depth++] = { right, t_right };
+			stack[depth++] = { left, t_left };
+		}
+		else {
+			if (hit_left)
+				stack[depth++] = { left, t_left };
+			if (hit_right)
+				stack[depth++] = { right, t_right };
+		}
+	}
+	return found;
+} // end intersectInstances
+
+
+//---Any instance hit------------------------------------------------------------
+bool SceneData::occludedInstances(const Ray &r) const {
+	const float inf = std::numeric_limits<float>::infinity();
+	float t;
+	glm::vec3 n;
+
+	for (auto inst : unbounded_inst) {
+		if (inst->isTraced() && inst->intersect(r, inf, t, n))
+			return true;
+	}
+
+	if (inst_nodes.empty())
+		return false;
+
+	glm::vec3 inv_d = 1.0f / r.d;
+	int stack[bvh_max_depth + 8];
+	int depth = 0;
+	stack[depth++] = 0;
+
+	while (depth > 0) {
+		int index = stack[--depth];
+		const BVHNode &node = inst_nodes[index];
+		if (!node.hit(r.p, inv_d, inf, t))
+			continue;
+
+		if (node.count > 0) {
+			for (int i = node.index; i < node.index + node.count; i++) {
+				if (inst_objs[i]->isTraced() && inst_objs[i]->intersect(r, inf, t, n))
+					return true;
+			}
+			continue;
+		}
+		stack[depth++] = node.index;
+		stack[depth++] = index + 1;
+	}
+	return false;
+} // end occludedInstances
+
+
+//---Distance to the closest instance when that is below best-------------------
+// Subtrees whose bounds are at least best away are skipped, marched_only leaves out
+// instances that can be traced
+float SceneData::instanceDistance(const glm::vec3 &p, float best, int &id, bool marched_only) const {
+	for (int i = 0; i < unbounded_inst.size(); i++) {
+		if (!unbounded_inst[i]->isMarched() || (marched_only && unbounded_inst[i]->isTraced()))
+			continue;
+		float d = unbounded_inst[i]->distance(p, best);
+		if (d < best) {
+			best = d;
+			id = unbounded_id[i];
+		}
+	}
+
+	if (inst_nodes.empty())
+		return best;
+
+	int stack[bvh_max_depth + 8];
+	int depth = 0;
+	stack[depth++] = 0;
+
+	while (depth > 0) {
+		int index = stack[--depth];
+		const BVHNode &node = inst_nodes[index];
+		if (node.distance(p) >= best)
+			continue;
+
+		if (node.count > 0) {
+			for (int i = node.index; i < node.index + node.count; i++) {
+				if (!inst_objs[i]->isMarched() || (marched_only && inst_objs[i]->isTraced()))
+					continue;
+				float d = inst_objs[i]->distance(p, best);
+				if (d < best) {
+					best = d;
+					id = inst_id[i];
+				}
+			}
+			continue;
+		}
+
+		// The nearer child goes on top so it can lower best first
+		int left = index + 1, right = node.index;
+		if (inst_nodes[left].distance(p) < inst_nodes[right].distance(p)) {
+			stack[depth++] = right;
+			stack[depth++] = left;
+		}
+		else {
+			stack[depth++] = left;
+			stack[depth++] = right;
+		}
+	}
+	return best;
+} // end instanceDistance
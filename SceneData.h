@@ -0,0 +1,157 @@
+#pragma once
+
+#include "ofApp.h"
+#include "Ray.h"
+#include "SceneObjects.h"
+#include "LightObjects.h"
+#include "DistanceField.h"
+#include "CSG.h"
+#include "Mesh.h"
+#include "Instance.h"
+
+
+/*
+	Material
+	- Shading data of a scene object, indexed by object id
+*/
+struct Material {
+	ofColor diffuseColor;
+	ofColor specularColor;
+	float power;
+	TiledTexture *texture_ref = NULL;    // Only set for textured planes
+	glm::vec3 u_vec, v_vec;         // Texture axes of textured planes
+	bool isLuminaire = false;
+	float emission = 0.0f;          // Emitted radiance of luminaires
+	int luminaire = -1;             // Index into the scene's luminaires
+	float reflectivity = 0.0f;      // Mirror reflectance at normal incidence
+	float transparency = 0.0f;
+	float ior = 1.5f;
+};
+
+
+/*
+	Hit
+	- Closest hit of a ray with the scene
+*/
+struct Hit {
+	float t;
+	glm::vec3 point;
+	glm::vec3 normal;
+	int id;             // Object id, indexes the material table
+};
+
+
+/*
+	March Cache
+	- Per ray state of the ray marcher, the ray in the local frame of every torus
+	  so marching doesn't transform each step
+*/
+struct MarchCache {
+	vector<glm::vec3> torus_o, torus_d;
+};
+
+
+/*
+	Scene Data
+	- Compact render side copy of the scene, rebuilt at render start
+	- Geometry is packed per primitive type as structure of arrays,
+	  materials live in a separate table indexed by object id
+*/
+class SceneData {
+public:
+	// Build from the authoring objects, object ids are indices into objects
+	void build(const vector<SceneObject*> &objects, const vector<BrickMap*> &baked);
+
+	// Closest hit along the ray
+	bool intersect(const Ray &r, Hit &hit, bool skip_luminaires = false) const;
+
+	// Any hit with an object that casts shadows
+	bool occluded(const Ray &r) const;
+	bool hasOccluders() const { return num_occluders > 0; }
+
+	// Luminaires for explicit light sampling
+	int numLuminaires() const { return sphere_r.size() - num_occluder_spheres; }
+	void getLuminaire(int i, glm::vec3 &center, float &radius, int &id) const {
+		int s = num_occluder_spheres + i;
+		center = glm::vec3(sphere_x[s], sphere_y[s], sphere_z[s]);
+		radius = sphere_r[s];
+		id = sphere_id[s];
+	}
+
+	// Distance to the closest object, id is set to that object. With marched_only
+	// the objects that have exact hits (spheres, planes, meshes) are left out
+	float sdf(const glm::vec3 &p, int &id, bool marched_only = false) const;
+
+	// There are objects that only have a distance (tori, CSG trees and their instances)
+	bool hasMarchedOnly() const { return !torus_R.empty() || !csg_objs.empty() || num_marched_inst > 0; }
+
+	// Ray marching, the step is never past a surface on the ray but skips whole
+	// cells of repeated tori the ray doesn't come near
+	void prepareMarch(const Ray &r, MarchCache &cache) const;
+	float marchDistance(const Ray &r, const MarchCache &cache, float t, int &id, bool marched_only = false) const;
+
+	// Code for sdf with the scene's constants written in, false if an object has no
+	// code (baked fields, instances, meshes and unpacked objects)
+	bool writeSource(SDFSource &src, bool marched_only = false) const;
+
+	// marchDistance skips cells of repeated tori, the plain distance doesn't
+	bool hasRepeatedTori() const;
+
+	vector<Material> materials;
+
+private:
+	void clear();
+	void addSphere(Sphere *s, int id);
+	float torusDistance(int i, const glm::vec3 &q, const glm::vec3 &p, float best) const;
+	float cellSkip(int i, const glm::vec3 &q, const glm::vec3 &dir) const;
+	bool intersectInstances(const Ray &r, float &best, glm::vec3 &normal, int &id) const;
+	bool occludedInstances(const Ray &r) const;
+	float instanceDistance(const glm::vec3 &p, float best, int &id, bool marched_only) const;
+
+	int num_occluders = 0;
+
+	// Spheres, luminaires are packed after num_occluder_spheres
+	vector<float> sphere_x, sphere_y, sphere_z;
+	vector<float> sphere_r;
+	vector<int> sphere_id;
+	int num_occluder_spheres = 0;
+
+	// Planes
+	vector<float> plane_x, plane_y, plane_z;
+	vector<float> plane_nx, plane_ny, plane_nz;
+	vector<float> plane_w, plane_h;
+	vector<int> plane_id;
+
+	// Tori
+	vector<glm::mat4> torus_inv;        // World to local transform
+	vector<float> torus_R, torus_r;     // Ring radius and thickness
+	vector<float> torus_k;              // Twist amount
+	vector<uint8_t> torus_twisted;
+	vector<uint8_t> torus_repeat;       // Repeated over the torus_period lattice
+	vector<glm::vec3> torus_period;
+	vector<float> torus_bound;          // Radius of the sphere around one instance
+	vector<BrickMap*> torus_baked;      // Baked field, nullptr if not baked
+	vector<int> torus_id;
+
+	// CSG trees, only ray marched like the tori
+	vector<CSGObject*> csg_objs;
+	vector<BrickMap*> csg_baked;
+	vector<int> csg_id;
+
+	// Triangle meshes, only ray traced
+	vector<TriangleMesh*> mesh_geometry;
+	vector<glm::vec3> mesh_offset;
+	vector<int> mesh_id;
+
+	// Instances, bounded ones in the leaf order of a hierarchy over their world bounds
+	vector<Instance*> inst_objs;
+	vector<int> inst_id;
+	vector<BVHNode> inst_nodes;
+	vector<Instance*> unbounded_inst;
+	vector<int> unbounded_id;
+	int num_marched_inst = 0;           // Instances that can only be marched
+
+	// Objects without a packed representation
+	vector<SceneObject*> other_objs;
+	vector<int> other_id;
+};
@@ -2,9 +2,26 @@
 
 #include "ofApp.h"
 #include "Ray.h"
+#include "TextureCache.h"
 #include "glm/gtx/intersect.hpp"
 
 
+// Type tag of scene objects, set once by each constructor so
+// render loops can branch on it instead of using dynamic_cast
+//
+enum class ObjectType : uint8_t {
+	generic,
+	sphere,
+	luminaire,
+	plane,
+	torus,
+	twisted_torus,
+	twisted_repeated_torus,
+	csg,
+	mesh,
+	instance
+};
+
 //  Base class for any renderable object in the scene
 //
 class SceneObject {
@@ -18,6 +35,13 @@ public:
 		return 0.0f;
 	}
 
+	// Axis aligned bounds of the object, false if the object is unbounded
+	virtual bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax) { return false; }
+
+	// String of the parameters that define the object's shape.
+	// Used to key baked data, empty if the object can't be baked
+	virtual string getParamKey() { return ""; }
+
 	// any data common to all scene objects goes here
 	glm::vec3 position = glm::vec3(0, 0, 0);
 
@@ -25,17 +49,24 @@ public:
 	//
 	ofColor diffuseColor = ofColor::grey;    // default colors - can be changed.
 	ofColor specularColor = ofColor::lightGray;
-	ofImage *texture_ref = NULL;
+	TiledTexture *texture_ref = NULL;    // Shared texture, loaded on first lookup
 	float power;
 	glm::vec3 normal;
+
+	// Specular transport of the ray tracer and ray marcher
+	float reflectivity = 0.0f;    // mirror reflectance at normal incidence
+	float transparency = 0.0f;    // fraction of the surface that is glass
+	float ior = 1.5f;             // index of refraction of the glass
+
+	ObjectType type = ObjectType::generic;
 }; // class SceneObject
 
 //  General purpose sphere  (assume parametric)
 //
 class Sphere : public SceneObject {
 public:
-	Sphere(glm::vec3 p, float r, ofColor diffuse, float power) { position = p; radius = r; diffuseColor = diffuse; this->power = power; }
-	Sphere() {}
+	Sphere(glm::vec3 p, float r, ofColor diffuse, float power) { position = p; radius = r; diffuseColor = diffuse; this->power = power; type = ObjectType::sphere; }
+	Sphere() { type = ObjectType::sphere; }
 
 	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
 		return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
@@ -51,17 +82,15 @@ public:
 		return glm::distance(p, position) - radius;
 	}
 
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax) {
+		bmin = position - glm::vec3(radius);
+		bmax = position + glm::vec3(radius);
+		return true;
+	}
+
 	float radius = 1.0;
 }; // end class Sphere
 
-//  Mesh class (will complete later- this will be a refinement of Mesh from Project 1)
-//
-class Mesh : public SceneObject {
-	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) { return false; }
-	void draw() { }
-}; // Place Mesh
-
-
 // General purpose plane
 class Plane : public SceneObject {
 public:
@@ -72,15 +101,14 @@ public:
 		this->power = power;
 		diffuseColor = diffuse;
 		this->isTextured = isTextured;
+		type = ObjectType::plane;
 
-		texture_ref = new ofImage();
-		if (!texture_ref->load(image_filename)) {
-			cerr << "Could not find image for plane at path: " << image_filename << endl;
-		}
+		texture_ref = TextureCache::instance().get(image_filename);
 		if (normal == glm::vec3(0, -1, 0) || normal == glm::vec3(0, 1, 0))
 			plane.rotateDeg(90, 1, 0, 0);
 	}
 	Plane() {
+		type = ObjectType::plane;
 		normal = glm::vec3(0, 1, 0);
 		plane.rotateDeg(90, 1, 0, 0);
 	}
@@ -119,6 +147,7 @@ public:
 		rotate_amt = 45.0f;
 		rotate_axis = glm::vec3(1.0f, 0.0f, 0.0f);
 		t = glm::vec2(5.0f, 2.0f);
+		type = ObjectType::torus;
 	}
 
 	Torus(glm::vec3 p, float radius, float thickness, ofColor diffuse, float power) {
@@ -128,6 +157,7 @@ public:
 		rotate_amt = 45.0f;
 		rotate_axis = glm::vec3(-0.7f, -0.3f, 0.0f);
 		t = glm::vec2(radius, thickness);
+		type = ObjectType::torus;
 	}
 
 	void draw() {
@@ -139,16 +169,43 @@ public:
 	float sdf(const glm::vec3 &p1) {
 
 		// Transform
-		glm::mat4 m = glm::translate(glm::mat4(1.0), position);
-		glm::mat4 M = glm::rotate(m, glm::radians(rotate_amt), rotate_axis);
-		glm::vec3 p = glm::inverse(M) * glm::vec4(p1, 1);
+		glm::vec3 p = getInverseTransform() * glm::vec4(p1, 1);
 
 		// Repeat
-		glm::vec3 rep_period = glm::vec3(21, 21, 21);
-		glm::vec3 p2 = glm::mod(p + 0.5 * rep_period, rep_period) - 0.5 * rep_period;
+		glm::vec3 p2 = repeat(p, rep_period);
 
 		// Torus
-		glm::vec2 q = glm::vec2(glm::length(glm::vec2(p2.x, p2.z)) - t.x, p2.y);
+		return torusDistance(p2, t);
+	}
+
+	// World to local transform
+	glm::mat4 getInverseTransform() {
+		glm::mat4 m = glm::translate(glm::mat4(1.0), position);
+		glm::mat4 M = glm::rotate(m, glm::radians(rotate_amt), rotate_axis);
+		return glm::inverse(M);
+	}
+
+	glm::vec2 getRadii() { return t; }
+
+	// Lattice the repeated tori are copied over
+	void setRepeatPeriod(const glm::vec3 &period) { rep_period = period; }
+	glm::vec3 getRepeatPeriod() { return rep_period; }
+
+	// Distance helpers shared with the packed render scene
+	static glm::vec3 repeat(const glm::vec3 &p, const glm::vec3 &rep_period) {
+		return glm::mod(p + 0.5 * rep_period, rep_period) - 0.5 * rep_period;
+	}
+
+	// Rotate p about the local axis by an angle proportional to the world height y
+	static glm::vec3 twist(const glm::vec3 &p, float y, float k) {
+		float c = glm::cos(k * y);
+		float s = glm::sin(k * y);
+		glm::mat2 mr = glm::mat2(c, -s, s, c);
+		return glm::vec3(mr * glm::vec2(p.x, p.z), p.y);
+	}
+
+	static float torusDistance(const glm::vec3 &p, const glm::vec2 &t) {
+		glm::vec2 q = glm::vec2(glm::length(glm::vec2(p.x, p.z)) - t.x, p.y);
 		return glm::length(q) - t.y;
 	}
 
@@ -160,10 +217,19 @@ public:
 		rotate_axis = glm::normalize(ra);
 	}
 
+	string getParamKey() {
+		ostringstream key;
+		key << "torus " << position.x << " " << position.y << " " << position.z << " "
+			<< rotate_amt << " " << rotate_axis.x << " " << rotate_axis.y << " " << rotate_axis.z << " "
+			<< t.x << " " << t.y << " " << rep_period.x << " " << rep_period.y << " " << rep_period.z;
+		return key.str();
+	}
+
 protected:
 	float rotate_amt;
 	glm::vec3 rotate_axis;
 	glm::vec2 t;
+	glm::vec3 rep_period = glm::vec3(21, 21, 21);
 }; // class Torus
 
 
@@ -172,6 +238,7 @@ public:
 	TwistedTorus(glm::vec3 p, float radius, float thickness, ofColor diffuse, float power) 
 		: Torus(p, radius, thickness, diffuse, power) {
 		k = 0.2f;
+		type = ObjectType::twisted_torus;
 	}
 
 	void draw() {
@@ -182,25 +249,35 @@ public:
 	float sdf(const glm::vec3 &p) {
 
 		// Transform 
-		glm::mat4 m = glm::translate(glm::mat4(1.0), position);
-		glm::mat4 M = glm::rotate(m, glm::radians(rotate_amt), rotate_axis);
-		glm::vec3 p1 = glm::inverse(M) * glm::vec4(p, 1);
+		glm::vec3 p1 = getInverseTransform() * glm::vec4(p, 1);
 
 		// Twist
-		float c = glm::cos(k * p.y);
-		float s = glm::sin(k * p.y);
-		glm::mat2 mr = glm::mat2(c, -s, s, c);
-		glm::vec3 p2 = glm::vec3(mr * glm::vec2(p1.x, p1.z), p1.y);
+		glm::vec3 p2 = twist(p1, p.y, k);
 		
 		// Torus
-		glm::vec2 q = glm::vec2(glm::length(glm::vec2(p2.x, p2.z)) - t.x, p2.y);
-		return glm::length(q) - t.y;
+		return torusDistance(p2, t);
 	}
 
 	void setTwist(float k) {
 		this->k = k;
 	}
 
+	float getTwist() { return k; }
+
+	// The twist only rotates about the local axis, so the untwisted torus radius still bounds it
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax) {
+		float r = glm::length(glm::vec2(t.x + t.y, t.y));
+		bmin = position - glm::vec3(r);
+		bmax = position + glm::vec3(r);
+		return true;
+	}
+
+	string getParamKey() {
+		ostringstream key;
+		key << "twisted " << Torus::getParamKey() << " " << k;
+		return key.str();
+	}
+
 protected:
 	float k;
 
@@ -210,32 +287,31 @@ protected:
 class TwistedRepeatedTorus : public TwistedTorus {
 public:
 	TwistedRepeatedTorus(glm::vec3 p, float radius, float thickness, ofColor diffuse, float power)
-		: TwistedTorus(p, radius, thickness, diffuse, power) {}
+		: TwistedTorus(p, radius, thickness, diffuse, power) {
+		type = ObjectType::twisted_repeated_torus;
+	}
 
 
 	float sdf(const glm::vec3 &p) {
 
 		// Transform 
-		glm::mat4 m = glm::translate(glm::mat4(1.0), position);
-		glm::mat4 M = glm::rotate(m, glm::radians(rotate_amt), rotate_axis);
-		glm::vec3 p1 = glm::inverse(M) * glm::vec4(p, 1);
+		glm::vec3 p1 = getInverseTransform() * glm::vec4(p, 1);
 
 		// Repeat
-		rep_period = glm::vec3(21, 21, 21);
-		glm::vec3 p3 = glm::mod(p1 + 0.5*rep_period, rep_period) - 0.5*rep_period;
+		glm::vec3 p3 = repeat(p1, rep_period);
 
 		// Twist
-		float c = glm::cos(k * p.y);
-		float s = glm::sin(k * p.y);
-		glm::mat2 mr = glm::mat2(c, -s, s, c);
-		glm::vec3 p2 = glm::vec3(mr * glm::vec2(p3.x, p3.z), p3.y);
+		glm::vec3 p2 = twist(p3, p.y, k);
 
 		// Torus
-		glm::vec2 q = glm::vec2(glm::length(glm::vec2(p2.x, p2.z)) - t.x, p2.y);
-		return glm::length(q) - t.y;
+		return torusDistance(p2, t);
 
 	}
 
-private:
-	glm::vec3 rep_period;
+	// Repeats to infinity
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax) { return false; }
+
+	string getParamKey() {
+		return "repeated " + TwistedTorus::getParamKey();
+	}
 }; // class TwistedRepeatedTorus
\ No newline at end of file
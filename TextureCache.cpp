@@ -0,0 +1,325 @@
+#include "ofApp.h"
+#include "TextureCache.h"
+#include <filesystem>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+// Cache file layout
+//   page 0:  "TEX1", int32 number of levels, then a Level record per level
+//   tiles:   every level's tiles in row major order, tile_bytes each, texels row major rgb,
+//            edge tiles are padded by repeating the last texel
+static const size_t header_bytes = 4096;
+
+
+TiledTexture::~TiledTexture() {
+#ifndef _WIN32
+	if (data && fallback.empty())
+		munmap(const_cast<uint8_t*>(data), data_size);
+#endif
+}
+
+
+//---Open the cache file, converting the image first if needed--------------
+void TiledTexture::open() {
+	// The cache file is keyed by the source path, size and modification time
+	string source = ofToDataPath(path);
+	std::error_code ec;
+	uintmax_t size = std::filesystem::file_size(source, ec);
+	if (ec) {
+		cerr << "Could not find image for plane at path: " << path << endl;
+		return;
+	}
+	auto mtime = std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+
+	ostringstream key, hex;
+	key << path << " " << size << " " << mtime;
+	hex << std::hex << std::hash<string>()(key.str());
+
+	string dir = TextureCache::instance().getCacheDir();
+	ofDirectory::createDirectory(dir, false, true);
+	string cache_path = ofToDataPath(dir + "tex_" + hex.str() + ".tex");
+
+	if (!mapCache(cache_path)) {
+		float before_time = ofGetElapsedTimeMillis();
+		if (!convert(cache_path) || !mapCache(cache_path)) {
+			cerr << "Could not build texture cache for: " << path << endl;
+			return;
+		}
+		cout << "Texture conversion time (" << path << "): " << ofGetElapsedTimeMillis() - before_time << "ms" << endl;
+	}
+
+	num_tiles = 0;
+	for (auto &level : levels) {
+		level.first_tile = num_tiles;
+		num_tiles += level.tiles_x * level.tiles_y;
+	}
+	tile_used.reset(new std::atomic<uint8_t>[num_tiles]);
+	for (int i = 0; i < num_tiles; i++)
+		tile_used[i] = 0;
+	valid = true;
+} // end open
+
+
+//---Map the cache file and read its level table------------------------------
+bool TiledTexture::mapCache(const string &cache_path) {
+	size_t size;
+#ifndef _WIN32
+	int fd = ::open(cache_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(header_bytes)) {
+		close(fd);
+		return false;
+	}
+	size = st.st_size;
+	void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return false;
+	data = static_cast<const uint8_t*>(p);
+#else
+	ifstream in(cache_path, ios::binary | ios::ate);
+	if (!in)
+		return false;
+	size = in.tellg();
+	fallback.resize(size);
+	in.seekg(0);
+	in.read(reinterpret_cast<char*>(fallback.data()), size);
+	if (!in || size < header_bytes)
+		return false;
+	data = fallback.data();
+#endif
+	data_size = size;
+
+	// Level table, the file has to hold every tile it lists
+	int32_t num_levels;
+	std::memcpy(&num_levels, data + 4, sizeof(num_levels));
+	bool ok = string(reinterpret_cast<const char*>(data), 4) == "TEX1" && num_levels > 0 &&
+		8 + num_levels * sizeof(Level) <= header_bytes;
+	if (ok) {
+		levels.resize(num_levels);
+		std::memcpy(levels.data(), data + 8, num_levels * sizeof(Level));
+		const Level &last = levels.back();
+		ok = last.offset + static_cast<int64_t>(last.tiles_x * last.tiles_y * tile_bytes) <= static_cast<int64_t>(size);
+	}
+
+	if (!ok) {
+		cerr << "Ignoring stale texture cache: " << cache_path << endl;
+#ifndef _WIN32
+		munmap(const_cast<uint8_t*>(data), size);
+#endif
+		fallback.clear();
+		levels.clear();
+		data = nullptr;
+		return false;
+	}
+	return true;
+} // end mapCache
+
+
+//---Decode the image and write the tiled mip chain----------------------------
+bool TiledTexture::convert(const string &cache_path) {
+	ofImage image;
+	if (!image.load(path)) {
+		cerr << "Could not find image for plane at path: " << path << endl;
+		return false;
+	}
+
+	// Level 0 texels
+	int w = image.getWidth();
+	int h = image.getHeight();
+	vector<uint8_t> texels(w * h * 3);
+	const ofPixels &pixels = image.getPixels();
+	for (int j = 0; j < h; j++) {
+		for (int i = 0; i < w; i++) {
+			ofColor c = pixels.getColor(i, j);
+			uint8_t *t = &texels[(j * w + i) * 3];
+			t[0] = c.r; t[1] = c.g; t[2] = c.b;
+		}
+	}
+
+	string tmp_path = cache_path + ".tmp";
+	ofstream out(tmp_path, ios::binary);
+	if (!out)
+		return false;
+
+	vector<Level> table;
+	vector<uint8_t> tile(tile_bytes);
+	int64_t offset = header_bytes;
+	out.seekp(offset);
+
+	for (;;) {
+		Level level;
+		level.width = w;
+		level.height = h;
+		level.tiles_x = (w + tile_size - 1) / tile_size;
+		level.tiles_y = (h + tile_size - 1) / tile_size;
+		level.offset = offset;
+		level.first_tile = 0;
+		table.push_back(level);
+
+		for (int ty = 0; ty < level.tiles_y; ty++) {
+			for (int tx = 0; tx < level.tiles_x; tx++) {
+				for (int y = 0; y < tile_size; y++) {
+					int sy = std::min(ty * tile_size + y, h - 1);
+					for (int x = 0; x < tile_size; x++) {
+						int sx = std::min(tx * tile_size + x, w - 1);
+						std::memcpy(&tile[(y * tile_size + x) * 3], &texels[(sy * w + sx) * 3], 3);
+					}
+				}
+				out.write(reinterpret_cast<const char*>(tile.data()), tile_bytes);
+			}
+		}
+		offset += static_cast<int64_t>(level.tiles_x * level.tiles_y) * tile_bytes;
+
+		if (w == 1 && h == 1)
+			break;
+
+		// Next level by a 2x2 box filter, odd edges fold into the last texel
+		int nw = std::max(1, w / 2);
+		int nh = std::max(1, h / 2);
+		vector<uint8_t> next(nw * nh * 3);
+		for (int j = 0; j < nh; j++) {
+			for (int i = 0; i < nw; i++) {
+				int x0 = std::min(2 * i, w - 1), x1 = std::min(2 * i + 1, w - 1);
+				int y0 = std::min(2 * j, h - 1), y1 = std::min(2 * j + 1, h - 1);
+				for (int c = 0; c < 3; c++) {
+					int sum = texels[(y0 * w + x0) * 3 + c] + texels[(y0 * w + x1) * 3 + c] +
+						texels[(y1 * w + x0) * 3 + c] + texels[(y1 * w + x1) * 3 + c];
+					next[(j * nw + i) * 3 + c] = (sum + 2) / 4;
+				}
+			}
+		}
+		texels.swap(next);
+		w = nw;
+		h = nh;
+	}
+
+	int32_t num_levels = table.size();
+	out.seekp(0);
+	out.write("TEX1", 4);
+	out.write(reinterpret_cast<const char*>(&num_levels), sizeof(num_levels));
+	out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Level));
+	out.close();
+	if (!out)
+		return false;
+
+	// Readers never see a half written cache
+	return std::rename(tmp_path.c_str(), cache_path.c_str()) == 0;
+} // end convert
+
+
+//---Give a tile's pages back to the OS, they fault in again from the file----
+void TiledTexture::release(int tile) {
+	tile_used[tile] = 0;
+
+#ifndef _WIN32
+	static const long page = sysconf(_SC_PAGESIZE);
+	if (!fallback.empty() || page <= 0 || tile_bytes % page != 0)
+		return;
+
+	// Find the tile's level
+	int l = 0;
+	while (l + 1 < levels.size() && levels[l + 1].first_tile <= tile)
+		l++;
+	const uint8_t *p = data + levels[l].offset + (tile - levels[l].first_tile) * tile_bytes;
+	madvise(const_cast<uint8_t*>(p), tile_bytes, MADV_DONTNEED);
+#endif
+}
+
+
+//---Texel lookup-------------------------------------------------------------
+ofColor TiledTexture::lookup(float u, float v, float footprint) {
+	std::call_once(opened, &TiledTexture::open, this);
+	if (!valid)
+		return ofColor::black;
+
+	int l = footprint > 1.0f ? std::min(static_cast<int>(levels.size()) - 1, static_cast<int>(std::log2(footprint))) : 0;
+	const Level &level = levels[l];
+
+	// Wrapped texel coordinates
+	int i = static_cast<int>(std::floor(u * level.width)) % level.width;
+	int j = static_cast<int>(std::floor(v * level.height)) % level.height;
+	if (i < 0) i += level.width;
+	if (j < 0) j += level.height;
+
+	int tx = i / tile_size;
+	int ty = j / tile_size;
+	int tile = level.first_tile + ty * level.tiles_x + tx;
+
+	// Mark the tile for the clock, first touches go through the cache
+	uint8_t state = tile_used[tile].load(std::memory_order_relaxed);
+	if (state == 0)
+		TextureCache::instance().touch(this, tile);
+	else if (state == 1)
+		tile_used[tile].store(2, std::memory_order_relaxed);
+
+	const uint8_t *t = data + level.offset + (ty * level.tiles_x + tx) * tile_bytes +
+		((j % tile_size) * tile_size + (i % tile_size)) * 3;
+	return ofColor(t[0], t[1], t[2]);
+} // end lookup
+
+int TiledTexture::getWidth() {
+	std::call_once(opened, &TiledTexture::open, this);
+	return valid ? levels[0].width : 0;
+}
+
+int TiledTexture::getHeight() {
+	std::call_once(opened, &TiledTexture::open, this);
+	return valid ? levels[0].height : 0;
+}
+
+
+//---Registry-------------------------------------------------------------------
+TextureCache &TextureCache::instance() {
+	static TextureCache cache;
+	return cache;
+}
+
+TiledTexture *TextureCache::get(const string &path) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	TiledTexture *&texture = textures[path];
+	if (!texture)
+		texture = new TiledTexture(path);
+	return texture;
+}
+
+
+//---Make a tile resident, evicting by the clock when over budget---------------
+void TextureCache::touch(TiledTexture *texture, int tile) {
+	std::lock_guard<std::mutex> lock(resident_mutex);
+
+	// Another thread got here first
+	uint8_t expected = 0;
+	if (!texture->tile_used[tile].compare_exchange_strong(expected, 2))
+		return;
+
+	if (resident.size() < budget_tiles) {
+		resident.push_back({ texture, tile });
+		return;
+	}
+
+	// Referenced tiles get a second chance, the first unreferenced one is replaced
+	for (;;) {
+		hand %= resident.size();
+		auto &slot = resident[hand++];
+		std::atomic<uint8_t> &used = slot.first->tile_used[slot.second];
+		if (used.load(std::memory_order_relaxed) == 2) {
+			used.store(1, std::memory_order_relaxed);
+			continue;
+		}
+		slot.first->release(slot.second);
+		slot = { texture, tile };
+		return;
+	}
+} // end touch
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "ofApp.h"
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <memory>
+
+
+/*
+	Tiled Texture
+	- Image converted once into a tiled, mip mapped cache file and memory mapped,
+	  so only the tiles rays touch are paged in
+	- Nothing is read until the first lookup, the conversion runs then if the
+	  cache file is missing or older than the source image
+	- Tiles are page aligned so the cache can drop single tiles from memory
+*/
+class TiledTexture {
+public:
+	TiledTexture(const string &path) : path(path) {}
+	~TiledTexture();
+
+	// Nearest texel at (u, v) in the mip level whose texels match the footprint,
+	// given in level 0 texels. u and v wrap
+	ofColor lookup(float u, float v, float footprint);
+
+	int getWidth();
+	int getHeight();
+
+	static const int tile_size = 64;                                  // texels per tile side
+	static const size_t tile_bytes = tile_size * tile_size * 3;       // rgb, a multiple of the page size
+
+private:
+	friend class TextureCache;
+
+	struct Level {
+		int32_t width, height;
+		int32_t tiles_x, tiles_y;
+		int64_t offset;                 // file offset of the level's first tile
+		int32_t first_tile;             // index of the level's first tile in tile_used
+	};
+
+	void open();
+	bool mapCache(const string &cache_path);
+	bool convert(const string &cache_path);
+	void release(int tile);
+
+	string path;
+	std::once_flag opened;
+	bool valid = false;
+
+	vector<Level> levels;
+	const uint8_t *data = nullptr;      // mapped cache file
+	size_t data_size = 0;
+	vector<uint8_t> fallback;           // whole file when mapping isn't available
+
+	std::unique_ptr<std::atomic<uint8_t>[]> tile_used;   // 0 not resident, 1 resident, 2 referenced since the last sweep
+	int num_tiles = 0;
+};
+
+
+/*
+	Texture Cache
+	- Shared registry of tiled textures, one per image path
+	- Keeps the number of resident tiles under a budget with the clock approximation
+	  of LRU, evicted tiles are handed back to the OS and fault in again if used
+*/
+class TextureCache {
+public:
+	static TextureCache &instance();
+
+	// Texture for the image at path, opened on first lookup
+	TiledTexture *get(const string &path);
+
+	void setCacheDir(const string &dir) { cache_dir = dir; }
+	string getCacheDir() { return cache_dir; }
+	void setBudget(size_t bytes) { budget_tiles = std::max<size_t>(1, bytes / TiledTexture::tile_bytes); }
+
+	// Called by a texture the first time a tile is touched
+	void touch(TiledTexture *texture, int tile);
+
+private:
+	TextureCache() {}
+
+	string cache_dir = "../../cache/";
+	size_t budget_tiles = (256 << 20) / TiledTexture::tile_bytes;
+
+	std::mutex registry_mutex;
+	map<string, TiledTexture*> textures;
+
+	// Resident tiles in clock order
+	std::mutex resident_mutex;
+	vector<pair<TiledTexture*, int>> resident;
+	size_t hand = 0;
+};
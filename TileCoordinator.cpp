@@ -0,0 +1,354 @@
+#include "ofApp.h"
+#include "TileCoordinator.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <cerrno>
+#endif
+
+
+// Wire format, native byte order since both ends run on the same host
+//   request: int32 x0, y0, x1, y1
+//   reply:   int32 x0, y0, x1, y1, then uint8 rgb per pixel in row major order,
+//            then when feature buffers are on 11 floats per pixel
+//            (color, albedo, normal, depth, variance)
+// The worker exits when the coordinator closes its socket
+static const int aux_floats = 11;
+
+#ifndef _WIN32
+
+#ifdef MSG_NOSIGNAL
+static const int send_flags = MSG_NOSIGNAL;
+#else
+static const int send_flags = 0;
+#endif
+
+static bool writeFull(int fd, const void *data, size_t size) {
+	const char *p = static_cast<const char *>(data);
+	while (size > 0) {
+		ssize_t n = send(fd, p, size, send_flags);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool readFull(int fd, void *data, size_t size) {
+	char *p = static_cast<char *>(data);
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+
+//---Worker side, render requested tiles until the socket closes-------
+void TileCoordinator::workerLoop(int fd, uint32_t threads_used) {
+	int32_t bounds[4];
+	vector<uint8_t> pixels;
+	vector<float> features;
+	RenderBuffers &b = rt.aux_buffers;
+
+	while (readFull(fd, bounds, sizeof(bounds))) {
+		int x0 = bounds[0], y0 = bounds[1], x1 = bounds[2], y1 = bounds[3];
+		rt.renderTile(x0, y0, x1, y1, threads_used);
+
+		pixels.clear();
+		features.clear();
+		for (int j = y0; j < y1; j++) {
+			for (int i = x0; i < x1; i++) {
+				ofColor c = rt.final_image.getColor(i, j);
+				pixels.push_back(c.r);
+				pixels.push_back(c.g);
+				pixels.push_back(c.b);
+
+				if (aux) {
+					int k = j * b.width + i;
+					const glm::vec3 *v[3] = { &b.color[k], &b.albedo[k], &b.normal[k] };
+					for (auto vec : v) {
+						features.push_back(vec->x);
+						features.push_back(vec->y);
+						features.push_back(vec->z);
+					}
+					features.push_back(b.depth[k]);
+					features.push_back(b.variance[k]);
+				}
+			}
+		}
+
+		if (!writeFull(fd, bounds, sizeof(bounds)) || !writeFull(fd, pixels.data(), pixels.size()) ||
+			!writeFull(fd, features.data(), features.size() * sizeof(float)))
+			break;
+	}
+} // end workerLoop
+
+
+//---Fork a worker process connected through a socket pair-------------
+bool TileCoordinator::startWorker(Worker &w, uint32_t threads_used) {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		cerr << "Could not create worker socket" << endl;
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		cerr << "Could not fork render worker" << endl;
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	if (pid == 0) {
+		// The worker only keeps its own end of its own socket
+		close(fds[0]);
+		for (auto &other : workers) {
+			if (other.fd >= 0)
+				close(other.fd);
+		}
+		workerLoop(fds[1], threads_used);
+		close(fds[1]);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	w.pid = pid;
+	w.fd = fds[0];
+	return true;
+}
+
+void TileCoordinator::stopWorker(Worker &w) {
+	if (w.fd >= 0)
+		close(w.fd);
+	if (w.pid > 0)
+		waitpid(w.pid, nullptr, 0);
+	w.fd = -1;
+	w.pid = -1;
+}
+
+
+//---Send a tile request, the tile goes back on the queue on failure
+bool TileCoordinator::assignTile(Worker &w, int tile) {
+	const Tile &t = tiles[tile];
+	int32_t bounds[4] = { t.x0, t.y0, t.x1, t.y1 };
+
+	w.tile = tile;
+	w.tile_start = ofGetElapsedTimeMillis();
+	w.tile_deadline = w.tile_start + tileAllowance(w, tile);
+	if (!writeFull(w.fd, bounds, sizeof(bounds))) {
+		failWorker(w);
+		return false;
+	}
+	return true;
+}
+
+
+//---Read the finished tile of a worker into the image--------------------
+bool TileCoordinator::receiveTile(Worker &w) {
+	const Tile &t = tiles[w.tile];
+	int n = (t.x1 - t.x0) * (t.y1 - t.y0);
+
+	int32_t bounds[4];
+	vector<uint8_t> pixels(n * 3);
+	vector<float> features(aux ? n * aux_floats : 0);
+	if (!readFull(w.fd, bounds, sizeof(bounds)) ||
+		bounds[0] != t.x0 || bounds[1] != t.y0 || bounds[2] != t.x1 || bounds[3] != t.y1 ||
+		!readFull(w.fd, pixels.data(), pixels.size()) ||
+		!readFull(w.fd, features.data(), features.size() * sizeof(float)))
+		return false;
+
+	RenderBuffers &b = rt.aux_buffers;
+	int p = 0;
+	for (int j = t.y0; j < t.y1; j++) {
+		for (int i = t.x0; i < t.x1; i++, p++) {
+			rt.final_image.setColor(i, j, ofColor(pixels[p * 3], pixels[p * 3 + 1], pixels[p * 3 + 2]));
+
+			if (aux) {
+				const float *f = &features[p * aux_floats];
+				int k = j * b.width + i;
+				b.color[k] = glm::vec3(f[0], f[1], f[2]);
+				b.albedo[k] = glm::vec3(f[3], f[4], f[5]);
+				b.normal[k] = glm::vec3(f[6], f[7], f[8]);
+				b.depth[k] = f[9];
+				b.variance[k] = f[10];
+			}
+		}
+	}
+
+	w.tiles_done++;
+	w.pixels_done += n;
+	w.busy_time += ofGetElapsedTimeMillis() - w.tile_start;
+	w.tile = -1;
+	return true;
+}
+
+
+//---Time a worker may spend on a tile before it's taken as hung------
+float TileCoordinator::tileAllowance(const Worker &w, int tile) const {
+	// Pixels per ms of the worker, or of all workers until it has finished a tile
+	uint64_t pixels = w.pixels_done;
+	float time = w.busy_time;
+	if (w.tiles_done == 0) {
+		for (auto &other : workers) {
+			pixels += other.pixels_done;
+			time += other.busy_time;
+		}
+	}
+	if (pixels == 0 || time <= 0)
+		return rt.worker_timeout;
+
+	// Tiles over busy geometry are far slower than ones over the sky, so the expected
+	// time gets a wide margin and a floor against the timer's resolution
+	const Tile &t = tiles[tile];
+	float expected = (t.x1 - t.x0) * (t.y1 - t.y0) * time / pixels;
+	return std::max(2000.0f, 10.0f * expected);
+}
+
+
+//---Drop a worker that died or misbehaved, its tile is re-queued------
+void TileCoordinator::failWorker(Worker &w) {
+	cerr << "Render worker " << w.pid << " failed";
+	if (w.tile >= 0) {
+		cerr << ", re-queueing tile " << w.tile;
+		queue.push_back(w.tile);
+		w.tile = -1;
+	}
+	cerr << endl;
+
+	if (w.pid > 0)
+		kill(w.pid, SIGKILL);
+	stopWorker(w);
+	w.failures++;
+}
+
+#endif
+
+
+//---Throughput of every worker------------------------------------------
+void TileCoordinator::report(float elapsed) {
+	for (int i = 0; i < workers.size(); i++) {
+		const Worker &w = workers[i];
+		float rate = w.busy_time > 0 ? w.pixels_done / w.busy_time : 0.0f;
+		cout << "Worker " << i << ": " << w.tiles_done << " tiles, " << w.pixels_done << " pixels, "
+			<< w.busy_time << "ms busy, " << rate << " kpixels/s";
+		if (w.failures > 0)
+			cout << ", failed";
+		cout << endl;
+	}
+	cout << "Distributed render: " << tiles.size() << " tiles in " << elapsed << "ms" << endl;
+}
+
+
+//---Render the frame on the worker processes------------------------------
+void TileCoordinator::render() {
+	float before_time = ofGetElapsedTimeMillis();
+	int width = rt.final_image.getWidth();
+	int height = rt.final_image.getHeight();
+	int size = std::max(8, rt.tile_size);
+	aux = rt.output_aux || rt.denoise;
+
+	// Tiles in scanline order, the queue hands out the top of the image first
+	tiles.clear();
+	for (int y = 0; y < height; y += size) {
+		for (int x = 0; x < width; x += size)
+			tiles.push_back({ x, y, std::min(width, x + size), std::min(height, y + size) });
+	}
+	queue.clear();
+	for (int i = tiles.size() - 1; i >= 0; i--)
+		queue.push_back(i);
+
+#ifndef _WIN32
+	uint32_t threads_used = std::max(1u, rt.num_threads / rt.render_workers);
+	workers.assign(rt.render_workers, Worker());
+	for (auto &w : workers)
+		startWorker(w, threads_used);
+
+	vector<pollfd> fds;
+	vector<Worker *> polled;
+	for (;;) {
+		// Keep every live worker busy
+		bool any_busy = false;
+		for (auto &w : workers) {
+			if (w.fd >= 0 && w.tile < 0 && !queue.empty()) {
+				int tile = queue.back();
+				queue.pop_back();
+				assignTile(w, tile);
+			}
+			any_busy |= w.fd >= 0 && w.tile >= 0;
+		}
+		if (!any_busy)
+			break;
+
+		fds.clear();
+		polled.clear();
+		for (auto &w : workers) {
+			if (w.fd >= 0 && w.tile >= 0) {
+				fds.push_back({ w.fd, POLLIN, 0 });
+				polled.push_back(&w);
+			}
+		}
+
+		// Wait until a tile arrives or the nearest deadline passes
+		float now = ofGetElapsedTimeMillis();
+		float wait = std::numeric_limits<float>::max();
+		for (Worker *w : polled)
+			wait = std::min(wait, w->tile_deadline - now);
+		int timeout = static_cast<int>(std::ceil(std::max(0.0f, wait)));
+
+		if (poll(fds.data(), fds.size(), timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			cerr << "Render worker poll failed" << endl;
+			break;
+		}
+
+		now = ofGetElapsedTimeMillis();
+		for (int i = 0; i < fds.size(); i++) {
+			Worker &w = *polled[i];
+			if (fds[i].revents == 0) {
+				// A worker past its deadline is stuck, killing it re-queues the tile
+				if (now >= w.tile_deadline) {
+					cerr << "Render worker " << w.pid << " timed out on tile " << w.tile << endl;
+					failWorker(w);
+				}
+				continue;
+			}
+			if (!receiveTile(w))
+				failWorker(w);
+		}
+	}
+
+	// Closing the sockets ends the worker loops
+	for (auto &w : workers) {
+		if (w.tile >= 0)
+			queue.push_back(w.tile);
+		stopWorker(w);
+	}
+#else
+	cerr << "Render workers need fork and sockets, rendering in this process" << endl;
+#endif
+
+	// Whatever the workers couldn't finish is rendered here
+	if (!queue.empty())
+		cerr << "Rendering " << queue.size() << " tiles in the coordinator" << endl;
+	for (int tile : queue) {
+		const Tile &t = tiles[tile];
+		rt.renderTile(t.x0, t.y0, t.x1, t.y1, rt.num_threads);
+	}
+
+	report(ofGetElapsedTimeMillis() - before_time);
+} // end render
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ofApp.h"
+#include "RayTracer.h"
+
+
+/*
+	Tile Coordinator
+	- Splits the frame into tiles and renders them in local worker processes
+	- Workers are forked after RayTracer::prepareFrame, so they share the packed scene and
+	  baked fields copy on write, and render their tiles with RayTracer::renderTile
+	- Each worker talks to the coordinator over its own stream socket, a tile is a request
+	  of its pixel bounds answered by its pixels, so the transport can later be a TCP socket
+	- A worker that dies or sends a bad reply has its tile re-queued, tiles left over
+	  when every worker is gone are rendered in this process
+	- A tile has a deadline from the measured throughput of its worker, a worker that
+	  misses it is taken as hung, killed, and its tile re-queued
+*/
+class TileCoordinator {
+public:
+	TileCoordinator(RayTracer &tracer) : rt(tracer) {}
+
+	void render();
+
+private:
+	struct Tile {
+		int x0, y0, x1, y1;
+	};
+
+	struct Worker {
+		int pid = -1;
+		int fd = -1;
+		int tile = -1;                 // tile being rendered, -1 when idle
+		float tile_start = 0;
+		float tile_deadline = 0;       // time the tile is given up on
+		uint32_t tiles_done = 0;
+		uint64_t pixels_done = 0;
+		float busy_time = 0;           // ms spent on finished tiles
+		uint32_t failures = 0;
+	};
+
+	bool startWorker(Worker &w, uint32_t threads_used);
+	void stopWorker(Worker &w);
+	void workerLoop(int fd, uint32_t threads_used);
+
+	bool assignTile(Worker &w, int tile);
+	bool receiveTile(Worker &w);
+	float tileAllowance(const Worker &w, int tile) const;
+	void failWorker(Worker &w);
+	void report(float elapsed);
+
+	RayTracer &rt;
+	bool aux;                          // feature buffers are sent with the pixels
+	vector<Tile> tiles;
+	vector<int> queue;                 // tiles not yet finished, back is handed out next
+	vector<Worker> workers;
+};
@@ -0,0 +1,291 @@
+#include "ofApp.h"
+#include "Wavefront.h"
+#include <thread>
+#include <atomic>
+#include <functional>
+
+
+// Run fn(begin, end) over chunks of [0, n) on the render threads
+static void parallelFor(size_t n, uint32_t num_threads, const std::function<void(size_t, size_t)> &fn) {
+	const size_t chunk = 1024;
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t begin = next.fetch_add(chunk); begin < n; begin = next.fetch_add(chunk))
+			fn(begin, std::min(n, begin + chunk));
+	};
+
+	vector<std::thread> threads;
+	for (uint32_t t = 0; t < std::max(1u, num_threads); t++)
+		threads.push_back(std::thread(worker));
+	for (auto &thread : threads)
+		thread.join();
+}
+
+// Stable counting sort, order receives the indices of keys sorted by key
+static void countingSort(const vector<int> &keys, int num_keys, vector<int> &order) {
+	vector<int> offsets(num_keys + 1, 0);
+	for (int k : keys)
+		offsets[k + 1]++;
+	for (int k = 0; k < num_keys; k++)
+		offsets[k + 1] += offsets[k];
+
+	order.resize(keys.size());
+	for (int i = 0; i < keys.size(); i++)
+		order[offsets[keys[i]]++] = i;
+}
+
+
+//---Queues-----------------------------------------------------------
+void PathQueue::resize(size_t n) {
+	ox.resize(n); oy.resize(n); oz.resize(n);
+	dx.resize(n); dy.resize(n); dz.resize(n);
+	tr.resize(n); tg.resize(n); tb.resize(n);
+	px.resize(n); py.resize(n); pz.resize(n);
+	bsdf_pdf.resize(n);
+	pixel.resize(n);
+	samplers.resize(n);
+}
+
+void PathQueue::copyFrom(const PathQueue &other, size_t src, size_t dst) {
+	ox[dst] = other.ox[src]; oy[dst] = other.oy[src]; oz[dst] = other.oz[src];
+	dx[dst] = other.dx[src]; dy[dst] = other.dy[src]; dz[dst] = other.dz[src];
+	tr[dst] = other.tr[src]; tg[dst] = other.tg[src]; tb[dst] = other.tb[src];
+	px[dst] = other.px[src]; py[dst] = other.py[src]; pz[dst] = other.pz[src];
+	bsdf_pdf[dst] = other.bsdf_pdf[src];
+	pixel[dst] = other.pixel[src];
+	samplers[dst] = other.samplers[src];
+}
+
+void ShadowQueue::resize(size_t n) {
+	ox.resize(n); oy.resize(n); oz.resize(n);
+	dx.resize(n); dy.resize(n); dz.resize(n);
+	cr.resize(n); cg.resize(n); cb.resize(n);
+	target.resize(n);
+}
+
+
+//---Camera rays for every pixel of the tile set--------------------
+void WavefrontTracer::generate(int row_begin, int row_end, uint32_t sample) {
+	int n = width * (row_end - row_begin);
+	paths.resize(n);
+
+	parallelFor(n, rt.num_threads, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++) {
+			int i = k % width;
+			int j = row_begin + k / width;
+
+			// Same sampler stream and dimensions as the recursive path tracer
+			Sampler sampler(Sampler::pixelStream(i, j), rt.sampler_seed);
+			sampler.startSample(sample);
+			glm::vec2 jitter = sampler.get2D();
+			Ray ray = rt.render_cam.getRay((i + jitter.x) / width, (j + jitter.y) / height);
+
+			paths.ox[k] = ray.p.x; paths.oy[k] = ray.p.y; paths.oz[k] = ray.p.z;
+			paths.dx[k] = ray.d.x; paths.dy[k] = ray.d.y; paths.dz[k] = ray.d.z;
+			paths.tr[k] = paths.tg[k] = paths.tb[k] = 1.0f;
+			paths.px[k] = ray.p.x; paths.py[k] = ray.p.y; paths.pz[k] = ray.p.z;
+			paths.bsdf_pdf[k] = 0.0f;
+			paths.pixel[k] = k;
+			paths.samplers[k] = sampler;
+		}
+	});
+}
+
+
+//---Group rays of the same direction octant for coherent traversal
+void WavefrontTracer::sortByDirection() {
+	vector<int> keys(paths.size());
+	for (size_t i = 0; i < paths.size(); i++)
+		keys[i] = (paths.dx[i] < 0) | ((paths.dy[i] < 0) << 1) | ((paths.dz[i] < 0) << 2);
+
+	vector<int> order;
+	countingSort(keys, 8, order);
+
+	sorted_paths.resize(paths.size());
+	for (size_t i = 0; i < order.size(); i++)
+		sorted_paths.copyFrom(paths, order[i], i);
+	std::swap(paths, sorted_paths);
+}
+
+
+//---Closest hit of every path----------------------------------------
+void WavefrontTracer::extend() {
+	hits.resize(paths.size());
+	hit_valid.resize(paths.size());
+
+	parallelFor(paths.size(), rt.num_threads, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			Ray r(glm::vec3(paths.ox[i], paths.oy[i], paths.oz[i]), glm::vec3(paths.dx[i], paths.dy[i], paths.dz[i]));
+			hit_valid[i] = rt.scene.intersect(r, hits[i]);
+		}
+	});
+}
+
+
+//---Shade hits in material order, emit shadow rays and bounce rays-
+void WavefrontTracer::shade() {
+	size_t n = paths.size();
+
+	// Misses first, then by object id
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++)
+		keys[i] = hit_valid[i] ? hits[i].id + 1 : 0;
+	countingSort(keys, rt.scene.materials.size() + 1, shade_order);
+
+	vector<uint8_t> alive(n, 0);
+	shadows.resize(n);
+
+	parallelFor(n, rt.num_threads, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++) {
+			int i = shade_order[k];
+			shadows.target[i] = -1;
+
+			glm::vec3 throughput(paths.tr[i], paths.tg[i], paths.tb[i]);
+			glm::vec3 &radiance = wave[paths.pixel[i]];
+
+			if (!hit_valid[i]) { // background color if no object was hit
+				radiance += throughput * glm::vec3(rt.background_color.r, rt.background_color.g, rt.background_color.b) / 255.0f;
+				continue;
+			}
+
+			const Hit &hit = hits[i];
+			const Material &m = rt.scene.materials[hit.id];
+			Sampler &sampler = paths.samplers[i];
+
+			// Luminaire hit by the camera or by a bounce, weighted against the explicit light sample
+			if (m.isLuminaire) {
+				glm::vec3 origin(paths.px[i], paths.py[i], paths.pz[i]);
+				float weight = depth == 0 ? 1.0f : powerHeuristic(paths.bsdf_pdf[i], rt.luminairePdf(origin, hit.id));
+				radiance += throughput * m.emission * weight;
+				continue;
+			}
+
+			glm::vec3 d(paths.dx[i], paths.dy[i], paths.dz[i]);
+			glm::vec3 n = glm::dot(hit.normal, d) > 0 ? -hit.normal : hit.normal;
+			glm::vec3 albedo = rt.hitAlbedo(hit);
+
+			// Point and cone lights are shaded directly
+			ofColor direct = rt.shadeHit(hit);
+			radiance += throughput * glm::vec3(direct.r, direct.g, direct.b) / 255.0f;
+
+			// Next event estimation, the visibility test is deferred to the shadow stage
+			int num_lum = rt.scene.numLuminaires();
+			if (num_lum > 0) {
+				int l = std::min(static_cast<int>(sampler.get1D() * num_lum), num_lum - 1);
+				glm::vec3 center;
+				float radius, cos_max;
+				int lum_id;
+				rt.scene.getLuminaire(l, center, radius, lum_id);
+				if (sphereConeCos(hit.point, center, radius, cos_max)) {
+					glm::vec2 u = sampler.get2D();
+					glm::vec3 wi = uniformSampleCone(glm::normalize(center - hit.point), cos_max, u.x, u.y);
+					float cos_theta = glm::dot(n, wi);
+					if (cos_theta > 0) {
+						float light_pdf = uniformConePdf(cos_max) / num_lum;
+						float weight = powerHeuristic(light_pdf, cos_theta * glm::one_over_pi<float>());
+						glm::vec3 c = throughput * albedo * glm::one_over_pi<float>() * cos_theta * rt.scene.materials[lum_id].emission * weight / light_pdf;
+						glm::vec3 o = hit.point + n * 0.001f;
+
+						shadows.ox[i] = o.x; shadows.oy[i] = o.y; shadows.oz[i] = o.z;
+						shadows.dx[i] = wi.x; shadows.dy[i] = wi.y; shadows.dz[i] = wi.z;
+						shadows.cr[i] = c.x; shadows.cg[i] = c.y; shadows.cb[i] = c.z;
+						shadows.target[i] = lum_id;
+					}
+				}
+			}
+
+			// Cosine weighted diffuse bounce
+			glm::vec2 u = sampler.get2D();
+			glm::vec3 wi = cosineSampleHemisphere(n, u.x, u.y);
+			throughput *= albedo;
+			if (throughput.x + throughput.y + throughput.z <= 0.0f)
+				continue;
+
+			glm::vec3 o = hit.point + n * 0.001f;
+			paths.ox[i] = o.x; paths.oy[i] = o.y; paths.oz[i] = o.z;
+			paths.dx[i] = wi.x; paths.dy[i] = wi.y; paths.dz[i] = wi.z;
+			paths.tr[i] = throughput.x; paths.tg[i] = throughput.y; paths.tb[i] = throughput.z;
+			paths.px[i] = hit.point.x; paths.py[i] = hit.point.y; paths.pz[i] = hit.point.z;
+			paths.bsdf_pdf[i] = glm::dot(n, wi) * glm::one_over_pi<float>();
+			alive[i] = 1;
+		}
+	});
+
+	// Compact the surviving paths into the next queue
+	size_t count = 0;
+	for (size_t i = 0; i < n; i++)
+		count += alive[i];
+	next_paths.resize(count);
+	for (size_t i = 0, dst = 0; i < n; i++) {
+		if (alive[i])
+			next_paths.copyFrom(paths, i, dst++);
+	}
+} // end shade
+
+
+//---Trace the shadow rays of the luminaire samples-------------------
+void WavefrontTracer::shadow() {
+	parallelFor(shadows.target.size(), rt.num_threads, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			if (shadows.target[i] < 0)
+				continue;
+
+			Hit light_hit;
+			Ray r(glm::vec3(shadows.ox[i], shadows.oy[i], shadows.oz[i]), glm::vec3(shadows.dx[i], shadows.dy[i], shadows.dz[i]));
+			if (rt.scene.intersect(r, light_hit) && light_hit.id == shadows.target[i])
+				wave[paths.pixel[i]] += glm::vec3(shadows.cr[i], shadows.cg[i], shadows.cb[i]);
+		}
+	});
+}
+
+
+//---Render the image a set of rows at a time-------------------------
+void WavefrontTracer::render() {
+	width = rt.final_image.getWidth();
+	height = rt.final_image.getHeight();
+	int rows = std::max(1, rt.wavefront_rows);
+	bool aux = rt.output_aux || rt.denoise;
+
+	for (int row_begin = 0; row_begin < height; row_begin += rows) {
+		int row_end = std::min(height, row_begin + rows);
+		accum.assign(width * (row_end - row_begin), glm::vec3(0.0f));
+		stats.assign(accum.size(), SampleStats());
+
+		// Every sample is one wave, each pixel has exactly one path per wave
+		for (uint32_t s = 0; s < rt.path_samples; s++) {
+			generate(row_begin, row_end, s);
+			wave.assign(accum.size(), glm::vec3(0.0f));
+
+			for (depth = 0; depth < rt.max_depth && paths.size() > 0; depth++) {
+				sortByDirection();
+				extend();
+				shade();
+				shadow();
+				std::swap(paths, next_paths);
+			}
+
+			for (int k = 0; k < accum.size(); k++) {
+				accum[k] += wave[k];
+				if (aux)
+					stats[k].add(wave[k] * 255.0f);
+			}
+		}
+
+		// Resolve the tile set into the image
+		for (int k = 0; k < accum.size(); k++) {
+			glm::vec3 radiance = accum[k] * (255.0f / rt.path_samples);
+			ofColor color(
+				std::fmin(255.0, radiance.x),
+				std::fmin(255.0, radiance.y),
+				std::fmin(255.0, radiance.z));
+			rt.final_image.setColor(k % width, row_begin + k / width, color);
+		}
+
+		if (aux) {
+			parallelFor(accum.size(), rt.num_threads, [&](size_t begin, size_t end) {
+				for (size_t k = begin; k < end; k++)
+					rt.writeFeatures(k % width, row_begin + k / width, rt.final_image.getColor(k % width, row_begin + k / width), stats[k]);
+			});
+		}
+	}
+} // end render
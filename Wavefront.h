@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ofApp.h"
+#include "RayTracer.h"
+
+
+/*
+	Path Queue
+	- Structure of arrays state of the paths in flight
+*/
+struct PathQueue {
+	void resize(size_t n);
+	size_t size() const { return pixel.size(); }
+
+	// Copy path src of other into slot dst
+	void copyFrom(const PathQueue &other, size_t src, size_t dst);
+
+	vector<float> ox, oy, oz;       // current ray
+	vector<float> dx, dy, dz;
+	vector<float> tr, tg, tb;       // throughput
+	vector<float> px, py, pz;       // vertex the ray left from, for MIS
+	vector<float> bsdf_pdf;         // pdf of the bounce that produced the ray, 0 for camera rays
+	vector<int> pixel;              // pixel index in the tile set
+	vector<Sampler> samplers;
+};
+
+
+/*
+	Shadow Queue
+	- Next event estimation rays, the contribution is added if the ray reaches its luminaire
+*/
+struct ShadowQueue {
+	void resize(size_t n);
+
+	vector<float> ox, oy, oz;
+	vector<float> dx, dy, dz;
+	vector<float> cr, cg, cb;       // contribution if unoccluded
+	vector<int> target;             // object id of the sampled luminaire, -1 for no ray
+};
+
+
+/*
+	Wavefront Tracer
+	- Stream path tracer, runs the same estimator as RayTracer::pathTrace but in bulk stages
+	- Camera rays for a set of rows are generated into a queue, then every bounce runs
+	  sort, extend (closest hit), shade and shadow as separate passes over all paths
+	- Paths are compacted after shading, sorted by direction octant before extension
+	  and shaded in material order
+*/
+class WavefrontTracer {
+public:
+	WavefrontTracer(RayTracer &tracer) : rt(tracer) {}
+
+	void render();
+
+private:
+	void generate(int row_begin, int row_end, uint32_t sample);
+	void sortByDirection();
+	void extend();
+	void shade();
+	void shadow();
+
+	RayTracer &rt;
+	int width, height;
+	uint32_t depth;                 // bounce of the current wave, shared by all paths
+
+	PathQueue paths, next_paths, sorted_paths;
+	ShadowQueue shadows;
+	vector<Hit> hits;
+	vector<uint8_t> hit_valid;
+	vector<int> shade_order;
+	vector<glm::vec3> accum;        // radiance summed over the samples of each pixel
+	vector<glm::vec3> wave;         // radiance of the current sample of each pixel
+	vector<SampleStats> stats;      // per pixel sample statistics for the feature buffers
+};
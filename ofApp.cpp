@@ -8,7 +8,7 @@ void ofApp::setup(){
 	ofSetBackgroundColor(background_color);
 	//cam.setDistance(30);
 	camOfRender.setPosition(ray_tracer.render_cam.position);
-	camOfRender.lookAt(ray_tracer.render_cam.aim);
+	camOfRender.lookAt(ray_tracer.render_cam.position + ray_tracer.render_cam.aim);
 	camOfRender.setNearClip(.1);
 	
 	// Set easycam
@@ -52,6 +52,37 @@ void ofApp::setup(){
 	
 	//spheres.push_back(Sphere(glm::vec3(8, 3, -7), 5.0, ofColor::purple, 600));
 
+	//meshes.push_back(Mesh("../../models/bunny.obj", glm::vec3(0, 2, -20), ofColor::lightGray, 500.0f));
+
+	// Grid of instances of one torus
+	//torus_prototypes.push_back(TwistedTorus(glm::vec3(0.0f), 1.0f, 0.4f, ofColor::white, 500.0f));
+	//torus_prototypes.back().setTwist(0.0f);
+	//for (int i = 0; i < 20; i++) {
+	//	for (int j = 0; j < 20; j++) {
+	//		instances.push_back(Instance(&torus_prototypes.back(), glm::vec3(i * 3.0f - 30.0f, 2.0f, -20.0f - j * 3.0f), ofColor::aquamarine, 500.0f));
+	//		instances.back().setRotateAxis(glm::vec3(1.0f, 0.0f, 0.0f));
+	//		instances.back().setRotateAmt(i * 18.0f);
+	//	}
+	//}
+
+	// The twisted repeated torus above from CSG operators, the leaf is the untwisted
+	// torus of the twisted classes and the twist turns by the marched point's height
+	//csg_tori.push_back(TwistedTorus(glm::vec3(0.0f), 4.0f, 2.0f, ofColor::aquamarine, 500.0f));
+	//csg_tori.back().setTwist(0.0f);
+	//csg_tori.back().setRotateAmt(0.0f);
+	//glm::mat4 frame = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(-4.0f, -1.5f, -25.0f)), glm::radians(45.0f), glm::vec3(-0.7f, -0.3f, 0.0f));
+	//CSGNode *twisted = CSGNode::twist(CSGNode::leaf(&csg_tori.back()), -0.2f, true);
+	//csg_objects.emplace_back(CSGNode::transform(CSGNode::repeat(twisted, glm::vec3(21.0f)), frame), ofColor::aquamarine, 500.0f);
+
+	// A sphere blended into a torus, with a smaller sphere cut out of both
+	//csg_spheres.push_back(Sphere(glm::vec3(12.0f, 0.0f, -25.0f), 3.0f, ofColor::white, 500.0f));
+	//csg_spheres.push_back(Sphere(glm::vec3(12.0f, 0.0f, -21.5f), 1.5f, ofColor::white, 500.0f));
+	//csg_tori.push_back(TwistedTorus(glm::vec3(12.0f, 0.0f, -25.0f), 4.0f, 1.0f, ofColor::white, 500.0f));
+	//csg_tori.back().setTwist(0.0f);
+	//csg_tori.back().setRotateAmt(0.0f);
+	//CSGNode *blend = CSGNode::smoothUnite({ CSGNode::leaf(&csg_spheres[0]), CSGNode::leaf(&csg_tori.back()) }, 1.5f);
+	//csg_objects.emplace_back(CSGNode::subtract(blend, CSGNode::leaf(&csg_spheres[1])), ofColor::paleGreen, 500.0f);
+
 	
 	//planes.push_back(Plane(glm::vec3(0, -100, 0), glm::vec3(0, 1, 0), 500, "../../textures/stone.jpg", ofColor::blue, 100.0, 200.0));
 	//planes.push_back(Plane(glm::vec3(0, 0, -50), glm::vec3(0, 0, 1), 500, "../../textures/stone.jpg", true, ofColor::lightCoral, 30.0, 10.0));
@@ -125,6 +156,30 @@ void ofApp::setup(){
 	}
 
 
+	// Add meshes
+	if (!meshes.empty()) {
+		for (auto &mesh : meshes) {
+			ray_tracer.addSceneObject(&mesh);
+		}
+	}
+
+
+	// Add instances
+	if (!instances.empty()) {
+		for (auto &instance : instances) {
+			ray_tracer.addSceneObject(&instance);
+		}
+	}
+
+
+	// Add CSG trees
+	if (!csg_objects.empty()) {
+		for (auto &csg : csg_objects) {
+			ray_tracer.addSceneObject(&csg);
+		}
+	}
+
+
 	// Add lights
 	if (!lights.empty()) {
 		for (auto &light : lights) {
@@ -150,9 +205,19 @@ void ofApp::setup(){
 	gui.setup();
 	gui.add(pathOn.setup("Pathtrace(On)/DOF(Off)", false));
 	gui.add(trace_bounces.setup("Pathtrace Bounces", 10, 1, 10000));
+	gui.add(path_samples.setup("Pathtrace Samples", 16, 1, 4096));
 	gui.add(dof_samples.setup("DOF samples", 180, 50, 10000));
 	gui.add(focal_distance.setup("Focal Distance", 37, 10, 100));
 	gui.add(apeture_size.setup("Apeture Size", 0.3, 0.1, 2.0));
+	gui.add(bakeSDF.setup("Bake SDF", false));
+	gui.add(jitSDF.setup("Compile SDF", false));
+	gui.add(irradianceCache.setup("Irradiance Cache", false));
+	gui.add(pathGuiding.setup("Path Guiding", false));
+	gui.add(denoise.setup("Denoise", false));
+	gui.add(outputAux.setup("Save Feature Buffers", false));
+	gui.add(pixelRecords.setup("Keep Pixel Records", false));
+	gui.add(render_workers.setup("Render Workers", 0, 0, 32));
+	gui.add(time_budget.setup("Time Budget (ms)", 2000, 100, 60000));
 	
 }
 
@@ -161,9 +226,18 @@ void ofApp::setup(){
 void ofApp::update(){
 	ray_tracer.path_trace = pathOn;
 	ray_tracer.max_depth = trace_bounces;
+	ray_tracer.path_samples = path_samples;
 	ray_tracer.focal_dist = focal_distance;
 	ray_tracer.dof_samples = dof_samples;
 	ray_tracer.apeture_size = apeture_size;
+	ray_tracer.bake_sdf = bakeSDF;
+	ray_tracer.jit_sdf = jitSDF;
+	ray_tracer.irradiance_caching = irradianceCache;
+	ray_tracer.path_guiding = pathGuiding;
+	ray_tracer.denoise = denoise;
+	ray_tracer.output_aux = outputAux;
+	ray_tracer.pixel_records = pixelRecords;
+	ray_tracer.render_workers = render_workers;
 }
 
 //--------------------------------------------------------------
@@ -213,6 +287,27 @@ void ofApp::keyPressed(int key){
 		isRendered = true;
 		cout << "rendered in images folder" << endl;
 		break;
+	case 'b':
+	case 'B':
+		// Compare the render kernels of the current settings
+		ray_tracer.benchmarkKernels();
+		break;
+	case 't':
+	case 'T':
+		// Best image the time budget allows
+		ray_tracer.renderBudgeted(time_budget);
+		isRendered = true;
+		break;
+	case 'u':
+	case 'U':
+		// Shade again the pixels edits marked since the last render
+		ray_tracer.renderDirty();
+		break;
+	case 'g':
+	case 'G':
+		// Compare path tracing with and without path guiding
+		ray_tracer.benchmarkGuiding();
+		break;
 	default:
 		break;
 	}
@@ -45,6 +45,17 @@ class ofApp : public ofBaseApp{
 		deque<Torus> tori;
 		deque<TwistedTorus> t_tori;
 		deque<TwistedRepeatedTorus> tr_tori;
+		deque<Mesh> meshes;
+
+		// Instances share prototypes that aren't in the scene themselves
+		deque<TwistedTorus> torus_prototypes;
+		deque<Mesh> mesh_prototypes;
+		deque<Instance> instances;
+
+		// CSG trees, their leaves' objects aren't in the scene themselves
+		deque<Sphere> csg_spheres;
+		deque<TwistedTorus> csg_tori;
+		deque<CSGObject> csg_objects;
 
 		float intensity = 500;
 		//float intensity = 100;
@@ -58,8 +69,18 @@ class ofApp : public ofBaseApp{
 		ofxPanel gui;
 		ofxToggle pathOn;
 		ofxIntSlider trace_bounces;
+		ofxIntSlider path_samples;
 		ofxIntSlider dof_samples;
 		ofxFloatSlider focal_distance;
 		ofxFloatSlider apeture_size;
+		ofxToggle bakeSDF;
+		ofxToggle jitSDF;
+		ofxToggle denoise;
+		ofxToggle irradianceCache;
+		ofxToggle pathGuiding;
+		ofxToggle outputAux;
+		ofxToggle pixelRecords;
+		ofxIntSlider render_workers;
+		ofxIntSlider time_budget;
 		
 };
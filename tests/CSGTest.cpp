@@ -0,0 +1,115 @@
+// Checks of the CSG trees: the twisted repeated torus rebuilt from operators matches
+// the hand written class, and bounded evaluation never reports a surface nearer than
+// it is. Built on its own against CSG.cpp and the scene object sources, returns
+// nonzero when a check fails
+
+#include "ofApp.h"
+#include "CSG.h"
+#include <random>
+
+
+static int failures = 0;
+
+static void check(bool ok, const string &what) {
+	if (!ok) {
+		cerr << "FAIL " << what << endl;
+		failures++;
+	}
+}
+
+static const float inf = std::numeric_limits<float>::infinity();
+
+
+// Same operators as the commented CSG scene in ofApp::setup
+static CSGNode *twistedRepeatedTorus(TwistedTorus &leaf, const glm::vec3 &position, float rotate_amt,
+	const glm::vec3 &rotate_axis, float k, const glm::vec3 &period) {
+	glm::mat4 frame = glm::rotate(glm::translate(glm::mat4(1.0f), position), glm::radians(rotate_amt), rotate_axis);
+	CSGNode *twisted = CSGNode::twist(CSGNode::leaf(&leaf), -k, true);
+	return CSGNode::transform(CSGNode::repeat(twisted, period), frame);
+}
+
+
+int main() {
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<float> u(-40.0f, 40.0f), b(0.0f, 15.0f);
+
+	// Leaf torus of the twisted classes, untwisted and in place
+	deque<TwistedTorus> leaves;
+	auto leaf = [&](float R, float r) -> TwistedTorus & {
+		leaves.push_back(TwistedTorus(glm::vec3(0.0f), R, r, ofColor::white, 500.0f));
+		leaves.back().setTwist(0.0f);
+		leaves.back().setRotateAmt(0.0f);
+		return leaves.back();
+	};
+
+	// The app's torus, then one turned about another axis over a smaller lattice
+	TwistedRepeatedTorus app_torus(glm::vec3(-4.0f, -1.5f, -25.0f), 4.0f, 2.0f, ofColor::aquamarine, 500.0f);
+	app_torus.setTwist(0.2f);
+	TwistedRepeatedTorus turned(glm::vec3(3.0f, 2.0f, -10.0f), 2.5f, 0.8f, ofColor::aquamarine, 500.0f);
+	turned.setTwist(0.35f);
+	turned.setRotateAmt(70.0f);
+	turned.setRotateAxis(glm::vec3(0.2f, 1.0f, 0.4f));
+	turned.setRepeatPeriod(glm::vec3(9.0f, 12.0f, 10.0f));
+
+	CSGObject app_csg(twistedRepeatedTorus(leaf(4.0f, 2.0f), glm::vec3(-4.0f, -1.5f, -25.0f), 45.0f,
+		glm::vec3(-0.7f, -0.3f, 0.0f), 0.2f, glm::vec3(21.0f)), ofColor::aquamarine, 500.0f);
+	CSGObject turned_csg(twistedRepeatedTorus(leaf(2.5f, 0.8f), glm::vec3(3.0f, 2.0f, -10.0f), 70.0f,
+		glm::normalize(glm::vec3(0.2f, 1.0f, 0.4f)), 0.35f, glm::vec3(9.0f, 12.0f, 10.0f)), ofColor::aquamarine, 500.0f);
+
+	std::pair<TwistedRepeatedTorus*, CSGObject*> pairs[] = { { &app_torus, &app_csg }, { &turned, &turned_csg } };
+	for (auto &pair : pairs) {
+		float worst = 0.0f;
+		for (int k = 0; k < 20000; k++) {
+			glm::vec3 p(u(rng), u(rng), u(rng));
+			float exact = pair.first->sdf(p);
+			worst = std::max(worst, std::abs(pair.second->sdf(p) - exact) / std::max(1.0f, std::abs(exact)));
+		}
+		check(worst < 1e-4f, "twisted repeated torus from CSG differs by " + std::to_string(worst));
+	}
+
+	// A sphere blended into a torus with a smaller sphere cut out, and a twisted, turned
+	// union and intersection of spheres and tori
+	deque<Sphere> spheres;
+	spheres.push_back(Sphere(glm::vec3(12.0f, 0.0f, -25.0f), 3.0f, ofColor::white, 500.0f));
+	spheres.push_back(Sphere(glm::vec3(12.0f, 0.0f, -21.5f), 1.5f, ofColor::white, 500.0f));
+	spheres.push_back(Sphere(glm::vec3(-2.0f, 1.0f, 0.0f), 2.0f, ofColor::white, 500.0f));
+	spheres.push_back(Sphere(glm::vec3(-1.0f, 1.0f, 0.5f), 2.0f, ofColor::white, 500.0f));
+	TwistedTorus &ring = leaf(4.0f, 1.0f);
+	TwistedTorus &small_ring = leaf(1.5f, 0.5f);
+
+	CSGNode *blend = CSGNode::smoothUnite({ CSGNode::leaf(&spheres[0]), CSGNode::transform(CSGNode::leaf(&ring),
+		glm::translate(glm::mat4(1.0f), glm::vec3(12.0f, 0.0f, -25.0f))) }, 1.5f);
+	CSGObject blended(CSGNode::subtract(blend, CSGNode::leaf(&spheres[1])), ofColor::paleGreen, 500.0f);
+
+	CSGNode *lens = CSGNode::intersect({ CSGNode::leaf(&spheres[2]), CSGNode::leaf(&spheres[3]) });
+	CSGNode *group = CSGNode::unite({ lens, CSGNode::leaf(&small_ring),
+		CSGNode::transform(CSGNode::leaf(&small_ring), glm::translate(glm::mat4(1.0f), glm::vec3(4.0f, -2.0f, 1.0f))) });
+	glm::mat4 frame = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -15.0f)), 0.6f, glm::vec3(0.3f, 1.0f, 0.2f));
+	CSGObject composite(CSGNode::transform(CSGNode::twist(group, 0.3f), frame), ofColor::paleGreen, 500.0f);
+
+	// Bounded evaluation, exact when best is infinite and otherwise at least min(exact, best)
+	CSGObject *trees[] = { &app_csg, &turned_csg, &blended, &composite };
+	for (CSGObject *tree : trees) {
+		int below = 0;
+		for (int k = 0; k < 20000; k++) {
+			glm::vec3 p(u(rng), u(rng), u(rng) - 15.0f);
+			float exact = tree->sdf(p);
+			float best = b(rng);
+			float bounded = static_cast<const CSGObject*>(tree)->sdf(p, best);
+			below += bounded < std::min(exact, best) - 1e-5f * std::max(1.0f, std::abs(exact));
+		}
+		check(below == 0, "bounded evaluation below min(exact, best) at " + std::to_string(below) + " points");
+	}
+
+	// Trees move between containers without being deleted twice
+	deque<CSGObject> moved;
+	moved.push_back(CSGObject(CSGNode::leaf(&spheres[2]), ofColor::white, 500.0f));
+	moved.emplace_back(CSGNode::unite({ CSGNode::leaf(&spheres[2]), CSGNode::leaf(&spheres[3]) }), ofColor::white, 500.0f);
+	vector<CSGObject> grown;
+	for (int k = 0; k < 8; k++)
+		grown.push_back(CSGObject(CSGNode::leaf(&spheres[k % 4]), ofColor::white, 500.0f));
+	check(std::abs(grown[2].sdf(glm::vec3(-2.0f, 1.0f, 4.0f)) - 2.0f) < 1e-5f, "moved tree keeps its distance");
+
+	cout << (failures ? "CSG checks failed" : "CSG checks passed") << endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,45 @@
+// Checks of the Fresnel split shared by the ray tracer and the photon tracer.
+// Built on its own against the app sources, returns nonzero when a check fails
+
+#include "ofApp.h"
+#include "Sampling.h"
+
+
+static int failures = 0;
+
+static void check(bool ok, const string &what, float got, float expected) {
+	if (!ok) {
+		cerr << "FAIL " << what << ": got " << got << ", expected " << expected << endl;
+		failures++;
+	}
+}
+
+int main() {
+	const float ior = 1.5f;
+	float f0 = (ior - 1.0f) / (ior + 1.0f);
+	f0 *= f0;
+
+	// Leaving glass at normal incidence, the normal facing the ray points inside
+	glm::vec3 outward(0, 0, 1);
+	FresnelSplit exit = fresnelSplit(glm::vec3(0, 0, 1), -outward, false, 0.0f, 1.0f, ior);
+	check(std::abs(exit.k_reflect - f0) < 1e-5f, "exit reflect", exit.k_reflect, f0);
+	check(std::abs(exit.k_refract - (1.0f - f0)) < 1e-5f, "exit refract", exit.k_refract, 1.0f - f0);
+	check(glm::dot(exit.refracted, outward) > 0.999f, "exit direction", glm::dot(exit.refracted, outward), 1.0f);
+
+	// Entering at normal incidence reflects the same
+	FresnelSplit enter = fresnelSplit(glm::vec3(0, 0, -1), outward, true, 0.0f, 1.0f, ior);
+	check(std::abs(enter.k_reflect - f0) < 1e-5f, "enter reflect", enter.k_reflect, f0);
+
+	// Leaving at an angle still refracts some light out
+	glm::vec3 d = glm::normalize(glm::vec3(0.3f, 0, 1));
+	FresnelSplit oblique = fresnelSplit(d, -outward, false, 0.0f, 1.0f, ior);
+	check(oblique.k_refract > 0.5f, "oblique exit refract", oblique.k_refract, 1.0f - f0);
+
+	// Past the critical angle everything reflects
+	d = glm::normalize(glm::vec3(1, 0, 0.5f));
+	FresnelSplit tir = fresnelSplit(d, -outward, false, 0.0f, 1.0f, ior);
+	check(tir.k_refract == 0.0f && tir.k_reflect == 1.0f, "total internal reflection", tir.k_reflect, 1.0f);
+
+	cout << (failures ? "Fresnel checks failed" : "Fresnel checks passed") << endl;
+	return failures ? 1 : 0;
+}
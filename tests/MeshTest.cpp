@@ -0,0 +1,231 @@
+// Checks of the triangle mesh: OBJ and PLY parsing, the BVH, the watertight ray
+// triangle test and the binary cache. Built on its own against Mesh.cpp and BVH.cpp,
+// returns nonzero when a check fails
+
+#include "ofApp.h"
+#include "Mesh.h"
+#include <filesystem>
+#include <random>
+#include <array>
+
+
+static int failures = 0;
+
+static void check(bool ok, const string &what) {
+	if (!ok) {
+		cerr << "FAIL " << what << endl;
+		failures++;
+	}
+}
+
+static const string dir = "mesh_test/";
+
+
+/*
+	Height field of n x n quads, the mesh every format below describes
+	- Quads are split along their diagonal into two triangles sharing an edge
+*/
+struct Grid {
+	Grid(int n, float bump) : n(n) {
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> h(-bump, bump);
+		for (int j = 0; j <= n; j++) {
+			for (int i = 0; i <= n; i++)
+				vertices.push_back(glm::vec3(i, j, bump > 0.0f ? h(rng) : 0.0f));
+		}
+		for (int j = 0; j < n; j++) {
+			for (int i = 0; i < n; i++) {
+				int a = j * (n + 1) + i, b = a + 1, c = a + n + 2, d = a + n + 1;
+				quads.push_back({ a, b, c, d });
+			}
+		}
+	}
+
+	// Closest hit over every triangle in double precision (Moller and Trumbore), -1 on a miss
+	double closest(const glm::vec3 &o, const glm::vec3 &d) const {
+		typedef std::array<double, 3> D3;
+		auto sub = [](const glm::vec3 &a, const glm::vec3 &b) { return D3{ double(a.x) - b.x, double(a.y) - b.y, double(a.z) - b.z }; };
+		auto cross = [](const D3 &a, const D3 &b) { return D3{ a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] }; };
+		auto dot = [](const D3 &a, const D3 &b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; };
+
+		D3 dd = { d.x, d.y, d.z };
+		double best = -1.0;
+		for (auto &q : quads) {
+			int tris[2][3] = { { q[0], q[1], q[2] }, { q[0], q[2], q[3] } };
+			for (auto &tri : tris) {
+				const glm::vec3 &v0 = vertices[tri[0]];
+				D3 e1 = sub(vertices[tri[1]], v0), e2 = sub(vertices[tri[2]], v0), p = cross(dd, e2);
+				double det = dot(e1, p);
+				if (std::abs(det) < 1e-12)
+					continue;
+				D3 s = sub(o, v0), qv = cross(s, e1);
+				double u = dot(s, p) / det, v = dot(dd, qv) / det, t = dot(e2, qv) / det;
+				if (u >= 0 && v >= 0 && u + v <= 1 && t > 0 && (best < 0 || t < best))
+					best = t;
+			}
+		}
+		return best;
+	}
+
+	string obj() const {
+		ostringstream s;
+		s << "# grid\n";
+		for (auto &v : vertices)
+			s << "v " << v.x << " " << v.y << " " << v.z << "\n";
+		for (auto &q : quads)
+			s << "f " << q[0] + 1 << " " << q[1] + 1 << " " << q[2] + 1 << " " << q[3] + 1 << "\n";
+		return s.str();
+	}
+
+	string plyHeader(const string &format) const {
+		ostringstream s;
+		s << "ply\nformat " << format << " 1.0\n"
+			<< "element vertex " << vertices.size() << "\n"
+			<< "property float x\nproperty float y\nproperty float z\n"
+			<< "element face " << quads.size() << "\n"
+			<< "property list uchar int vertex_indices\nend_header\n";
+		return s.str();
+	}
+
+	string plyAscii() const {
+		ostringstream s;
+		s << plyHeader("ascii");
+		for (auto &v : vertices)
+			s << v.x << " " << v.y << " " << v.z << "\n";
+		for (auto &q : quads)
+			s << "4 " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << "\n";
+		return s.str();
+	}
+
+	string plyBinary() const {
+		string s = plyHeader("binary_little_endian");
+		for (auto &v : vertices)
+			s.append(reinterpret_cast<const char*>(&v), sizeof(glm::vec3));
+		for (auto &q : quads) {
+			s.push_back(4);
+			for (int k = 0; k < 4; k++)
+				s.append(reinterpret_cast<const char*>(&q[k]), sizeof(int32_t));
+		}
+		return s;
+	}
+
+	int n;
+	vector<glm::vec3> vertices;
+	vector<std::array<int32_t, 4>> quads;
+};
+
+
+static string writeFile(const string &name, const string &text) {
+	string path = dir + name;
+	ofstream out(path, ios::binary);
+	out << text;
+	return path;
+}
+
+// Random rays from above through the grid and some that miss it, BVH against brute force
+static void checkRays(const TriangleMesh &mesh, const Grid &grid, const string &what) {
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> u(-0.5f, grid.n + 0.5f), w(-0.4f, 0.4f);
+	int wrong_hit = 0, wrong_t = 0, wrong_occluded = 0;
+	for (int k = 0; k < 4000; k++) {
+		glm::vec3 o(u(rng), u(rng), 3.0f);
+		glm::vec3 d = glm::normalize(glm::vec3(w(rng), w(rng), -1.0f));
+		double expected = grid.closest(o, d);
+
+		float t;
+		glm::vec3 normal;
+		bool hit = mesh.intersect(Ray(o, d), std::numeric_limits<float>::infinity(), t, normal);
+		wrong_hit += hit != (expected > 0);
+		wrong_t += hit && expected > 0 && std::abs(t - expected) > 1e-4;
+		wrong_occluded += mesh.occluded(Ray(o, d), std::numeric_limits<float>::infinity()) != (expected > 0);
+	}
+	check(wrong_hit == 0, what + ": " + std::to_string(wrong_hit) + " rays disagree with brute force on hit or miss");
+	check(wrong_t == 0, what + ": " + std::to_string(wrong_t) + " hits at the wrong distance");
+	check(wrong_occluded == 0, what + ": " + std::to_string(wrong_occluded) + " occlusion tests disagree with brute force");
+}
+
+// Rays through points on shared edges and vertices of a flat grid can't slip between triangles
+static void checkWatertight(const TriangleMesh &mesh, int n) {
+	std::mt19937 rng(13);
+	std::uniform_real_distribution<float> s(0.0f, 1.0f), w(-0.7f, 0.7f);
+	std::uniform_int_distribution<int> cell(0, n - 1);
+	int missed = 0;
+	for (int k = 0; k < 4000; k++) {
+		int i = cell(rng), j = cell(rng);
+		float a = s(rng);
+
+		// The quad's diagonal, its lower edge, or its corner
+		glm::vec3 p = k % 3 == 0 ? glm::vec3(i + a, j + a, 0) : k % 3 == 1 ? glm::vec3(i + a, j, 0) : glm::vec3(i, j, 0);
+		if (p.x <= 0.0f || p.y <= 0.0f)
+			continue;
+		glm::vec3 d = glm::normalize(glm::vec3(w(rng), w(rng), -1.0f));
+		float t;
+		glm::vec3 normal;
+		missed += !mesh.intersect(Ray(p - 2.0f * d, d), std::numeric_limits<float>::infinity(), t, normal);
+	}
+	check(missed == 0, "watertight: " + std::to_string(missed) + " rays through shared edges missed");
+}
+
+static string cacheFile() {
+	for (auto &entry : std::filesystem::directory_iterator(dir)) {
+		if (entry.path().extension() == ".msh")
+			return entry.path().string();
+	}
+	return "";
+}
+
+
+int main() {
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	MeshCache::instance().setCacheDir(dir);
+
+	Grid bumpy(12, 0.3f);
+	vector<std::pair<string, string>> files = {
+		{ "grid.obj", bumpy.obj() },
+		{ "grid_ascii.ply", bumpy.plyAscii() },
+		{ "grid_binary.ply", bumpy.plyBinary() }
+	};
+	for (auto &file : files) {
+		TriangleMesh mesh(writeFile(file.first, file.second));
+		check(mesh.numTriangles() == 2 * bumpy.n * bumpy.n, file.first + ": triangle count");
+		checkRays(mesh, bumpy, file.first);
+	}
+
+	Grid flat(16, 0.0f);
+	TriangleMesh flat_mesh(writeFile("flat.obj", flat.obj()));
+	checkWatertight(flat_mesh, flat.n);
+
+	// A header line that doesn't parse is rejected
+	TriangleMesh broken(writeFile("broken.ply", "ply\nformat ascii 1.0\nelement vertex\nend_header\n"));
+	check(!broken.isValid(), "PLY header without an element count");
+
+	// Second load of a file maps its cache, a corrupt cache is rebuilt from the source
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	string path = writeFile("cached.obj", bumpy.obj());
+	{
+		TriangleMesh first(path);
+	}
+	string cache = cacheFile();
+	check(!cache.empty(), "cache written");
+	{
+		TriangleMesh mapped(path);
+		checkRays(mapped, bumpy, "mapped cache");
+	}
+	{
+		// A triangle index past the vertices
+		fstream f(cache, ios::in | ios::out | ios::binary);
+		uint32_t bad = 1u << 30;
+		f.seekp(64 + bumpy.vertices.size() * sizeof(glm::vec3) + 4 * sizeof(uint32_t));
+		f.write(reinterpret_cast<const char*>(&bad), sizeof(bad));
+	}
+	{
+		TriangleMesh rebuilt(path);
+		checkRays(rebuilt, bumpy, "corrupt cache");
+	}
+	std::filesystem::remove_all(dir);
+
+	cout << (failures ? "Mesh checks failed" : "Mesh checks passed") << endl;
+	return failures ? 1 : 0;
+}